@@ -0,0 +1,102 @@
+#include "actor.h"
+
+#include "clock-mock.h"
+#include "context-mock.h"
+#include "fs-mock.h"
+
+#include <catch2/catch.hpp>
+
+namespace {
+
+using trompeloeil::_;
+
+constexpr const char *TAGS = "actor";
+
+TEST_CASE("actor-test", TAGS) {
+  FileSystemMock fileSystem{};
+  ContextMock context{};
+  ClockMock clock{};
+  ALLOW_CALL(clock, now()).RETURN(Clock::time_point{std::chrono::hours(24)});
+
+  /* replies are handled up to the kernel ARP update, which fails */
+  ether_arp_frame reply{};
+  reply.arp.arp_op = htons(ARPOP_REPLY);
+  struct sockaddr_ll ifs {};
+  ifs.sll_ifindex = 3;
+
+  stats.actor_dropped = 0;
+  actor_ring *ring = actor_open();
+
+  SECTION("queued frames are handled by the state thread") {
+    for (int i = 0; i < 3; i++) {
+      CHECK(actor_push(ring, &reply, &ifs, "eth0"));
+    }
+    REQUIRE_CALL(context, socket(AF_INET, SOCK_DGRAM, 0)).TIMES(3).RETURN(-1);
+    CHECK(actor_drain(fileSystem, context, clock) == 3);
+    CHECK(actor_drain(fileSystem, context, clock) == 0);
+  }
+
+  SECTION("a full ring drops frames") {
+    int pushed = 0;
+    while (actor_push(ring, &reply, &ifs, "eth0")) {
+      pushed++;
+    }
+    CHECK(pushed == ACTOR_RING_SIZE);
+    CHECK(stats.actor_dropped == 1);
+    ALLOW_CALL(context, socket(AF_INET, SOCK_DGRAM, 0)).RETURN(-1);
+    CHECK(actor_drain(fileSystem, context, clock) == ACTOR_RING_SIZE);
+    THEN("there is room again") { CHECK(actor_push(ring, &reply, &ifs, "eth0")); }
+    actor_drain(fileSystem, context, clock);
+  }
+
+  SECTION("replies of all rings go before requests") {
+    actor_ring *other = actor_open();
+    auto *it = iface_add("eth1");
+    ether_arp_frame request{};
+    request.arp.arp_op = htons(ARPOP_REQUEST);
+    inet_pton(AF_INET, "10.0.0.9", request.arp.arp_tpa);
+    CHECK(actor_push(ring, &request, &ifs, "eth0"));
+    CHECK(actor_push(other, &reply, &ifs, "eth0"));
+    /* the request stops at its relay to eth1 */
+    std::vector<int> sockets;
+    ALLOW_CALL(context, socket(_, _, _)).LR_SIDE_EFFECT(sockets.push_back(_1)).RETURN(-1);
+    ALLOW_CALL(context, ioctl3(-1, _, _)).RETURN(-1);
+    ALLOW_CALL(context, close(-1)).RETURN(0);
+    CHECK(actor_drain(fileSystem, context, clock) == 2);
+    CHECK(sockets == std::vector<int>{AF_INET, AF_PACKET});
+    rq_clear();
+    delete iface_remove(it->name);
+    actor_close(other);
+  }
+
+  SECTION("a ring is not reused before it is drained") {
+    CHECK(actor_push(ring, &reply, &ifs, "eth0"));
+    actor_close(ring);
+    actor_ring *other = actor_open();
+    CHECK(other != ring);
+    REQUIRE_CALL(context, socket(AF_INET, SOCK_DGRAM, 0)).RETURN(-1);
+    CHECK(actor_drain(fileSystem, context, clock) == 1);
+    ring = other;
+  }
+
+  SECTION("the state thread sleeps until a frame is queued") {
+    auto start = std::chrono::steady_clock::now();
+    actor_wait(std::chrono::milliseconds(20));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+    std::thread producer([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      actor_push(ring, &reply, &ifs, "eth0");
+    });
+    start = std::chrono::steady_clock::now();
+    actor_wait(std::chrono::seconds(10));
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    producer.join();
+    REQUIRE_CALL(context, socket(AF_INET, SOCK_DGRAM, 0)).RETURN(-1);
+    CHECK(actor_drain(fileSystem, context, clock) == 1);
+  }
+
+  actor_close(ring);
+}
+
+} // namespace
@@ -0,0 +1,148 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* Actor mode (-a).
+ *
+ * The receive threads only read frames and queue them in a single
+ * producer, single consumer ring each; main_thread() is the state thread
+ * and the only consumer. It handles the frames between its polls of the
+ * kernel ARP table, so arptab, the request queue and the routes are only
+ * changed by one thread and the receive threads never wait for it. A frame
+ * is published by advancing head, the state thread advances tail. As with
+ * the log rings, rings outlive their threads and are reused once drained,
+ * so the state thread never sees a ring go away. */
+
+#include "actor.h"
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <semaphore>
+#include <vector>
+
+struct actor_ring {
+  std::array<arp_event, ACTOR_RING_SIZE> events;
+  std::atomic<uint64_t> head{}; /* advanced by the receive thread */
+  std::atomic<uint64_t> tail{}; /* advanced by the state thread */
+  std::atomic<bool> owned{};
+};
+
+namespace {
+
+std::mutex rings_mutex; /* the list, not the rings */
+std::vector<actor_ring *> rings;
+
+/* The state thread sets idle before it looks at the rings a last time and
+ * sleeps; the first frame queued after that wakes it */
+std::atomic<bool> idle{};
+std::counting_semaphore<> wake{0};
+
+bool pending() {
+  std::lock_guard lock(rings_mutex);
+  for (const auto *ring : rings) {
+    /* seq_cst: ordered after idle was set, see actor_push() */
+    if (ring->tail.load(std::memory_order_relaxed) != ring->head.load(std::memory_order_seq_cst)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+actor_ring *actor_open() {
+  std::lock_guard lock(rings_mutex);
+  for (auto *ring : rings) {
+    if (!ring->owned.load(std::memory_order_relaxed) &&
+        ring->tail.load(std::memory_order_acquire) == ring->head.load(std::memory_order_relaxed)) {
+      ring->owned.store(true, std::memory_order_relaxed);
+      return ring;
+    }
+  }
+  auto *ring = new actor_ring;
+  ring->owned.store(true, std::memory_order_relaxed);
+  rings.push_back(ring);
+  return ring;
+}
+
+void actor_close(actor_ring *ring) {
+  std::lock_guard lock(rings_mutex);
+  ring->owned.store(false, std::memory_order_relaxed);
+}
+
+bool actor_push(actor_ring *ring, const ether_arp_frame *frame, const struct sockaddr_ll *ifs,
+                const char *ifname) {
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+  if (head - ring->tail.load(std::memory_order_acquire) >= ACTOR_RING_SIZE) {
+    stats.actor_dropped++;
+    return false;
+  }
+
+  arp_event &ev = ring->events[head % ACTOR_RING_SIZE];
+  memcpy(&ev.frame, frame, sizeof(ev.frame));
+  memcpy(&ev.ifs, ifs, sizeof(ev.ifs));
+  strncpy(ev.ifname, ifname, IFNAMSIZ - 1);
+  ev.ifname[IFNAMSIZ - 1] = '\0';
+  ring->head.store(head + 1, std::memory_order_seq_cst);
+
+  if (idle.load(std::memory_order_seq_cst) && idle.exchange(false)) {
+    wake.release();
+  }
+  return true;
+}
+
+size_t actor_drain(FileSystem &fileSystem, Context &context, Clock &clock) {
+  std::lock_guard lock(rings_mutex);
+  /* the state thread's, kept to spare the allocations */
+  static arp_batch batch;
+  static std::vector<uint64_t> ends;
+  size_t handled = 0;
+
+  /* a batch of every ring at a time, so that a busy interface does not
+   * hold up the others, and the replies of all interfaces before their
+   * requests; the frames stay in their rings until handled */
+  ends.resize(rings.size());
+  for (bool more = true; more;) {
+    more = false;
+    for (size_t i = 0; i < rings.size(); i++) {
+      auto *ring = rings[i];
+      uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      ends[i] = std::min(head, tail + ARP_BATCH);
+      for (; tail != ends[i]; tail++) {
+        arp_batch_add(batch, &ring->events[tail % ACTOR_RING_SIZE]);
+        handled++;
+      }
+      more = more || ends[i] != head;
+    }
+    arp_batch_run(batch, fileSystem, context, clock);
+    for (size_t i = 0; i < rings.size(); i++) {
+      rings[i]->tail.store(ends[i], std::memory_order_release);
+    }
+  }
+  return handled;
+}
+
+void actor_wait(std::chrono::microseconds timeout) {
+  idle.store(true, std::memory_order_seq_cst);
+  if (!pending()) {
+    (void)wake.try_acquire_for(timeout);
+  }
+  idle.store(false, std::memory_order_relaxed);
+}
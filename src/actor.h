@@ -0,0 +1,47 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include "clock.h"
+#include "context.h"
+#include "fs.h"
+#include "parprouted.h"
+
+#include <chrono>
+
+#define ACTOR_RING_SIZE 1024 /* frames per receive thread; when full, frames are dropped */
+
+struct actor_ring;
+
+/* Take a ring for the calling receive thread, and give it back when the
+ * thread ends; frames still in it are handled all the same */
+extern actor_ring *actor_open();
+extern void actor_close(actor_ring *ring);
+
+/* Queue a received frame for the state thread, without a lock or a
+ * system call unless the state thread sleeps; false if the ring is full */
+extern bool actor_push(actor_ring *ring, const ether_arp_frame *frame,
+                       const struct sockaddr_ll *ifs, const char *ifname);
+
+/* On the state thread: handle the queued frames of all rings in turn, a
+ * batch of each at a time with the replies of all first; returns how many */
+extern size_t actor_drain(FileSystem &, Context &, Clock &);
+
+/* On the state thread: sleep until a frame is queued, at most timeout */
+extern void actor_wait(std::chrono::microseconds timeout);
@@ -1,10 +1,13 @@
 #include "parprouted.h"
 
+#include "clock-mock.h"
 #include "context-mock.h"
+#include "fs-mock.h"
 
 #include <catch2/catch.hpp>
 #include <experimental/array>
 #include <iostream>
+#include <map>
 #include <trompeloeil.hpp>
 
 #include <linux/if_packet.h>
@@ -165,6 +168,237 @@ TEST_CASE("arp-test", TAGS) {
       CHECK(arpFrame.arp_op == htons(ARPOP_REQUEST));
     }
   }
+
+  SECTION("refresh follows the policy of the interface") {
+    ClockMock clock{};
+    static auto epoch = std::chrono::hours(0);
+    auto now = Clock::time_point{epoch += std::chrono::hours(1)};
+    ALLOW_CALL(clock, now()).LR_RETURN(now);
+
+    ALLOW_CALL(context, socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP))).RETURN(7);
+    ALLOW_CALL(context, ioctl3(7, _, _)).RETURN(0);
+    ALLOW_CALL(context, close(7)).RETURN(0);
+    std::map<int, int> sent; /* per third byte of the target: 1 wlan0, 2 eth0 */
+    ALLOW_CALL(context, sendto(7, _, sizeof(ether_arp_frame), 0, _, sizeof(sockaddr_ll)))
+        .LR_SIDE_EFFECT(sent[static_cast<const ether_arp_frame *>(_2)->arp.arp_tpa[2]]++)
+        .RETURN(0);
+
+    /* 20 hosts behind a paced wireless interface, 2 behind a wired one */
+    policy_rules = {{"wlan0", {}, 10, {}, 2.0}};
+    auto *it = iface_add("wlan0");
+    std::vector<arptab_entry> entries(22);
+    for (size_t i = 0; i < entries.size(); i++) {
+      bool wlan = i < 20;
+      uint32_t net = wlan ? 0x0a000100U : 0x0a000200U;
+      entries[i].ipaddr_ia = in_addr{htonl(net + static_cast<uint32_t>(i))};
+      strcpy(entries[i].ifname, wlan ? "wlan0" : "eth0");
+      entries[i].next = i + 1 < entries.size() ? &entries[i + 1] : nullptr;
+    }
+
+    refresharp(entries.data(), context, clock);
+    THEN("the wired hosts are pinged, the wireless ones at the pace") {
+      CHECK(sent[2] == 2);
+      CHECK(sent[1] == 2 * POLL_MAX / 1000);
+    }
+    WHEN("a second has passed") {
+      sent.clear();
+      now += std::chrono::seconds(1);
+      refresharp(entries.data(), context, clock);
+      THEN("two more wireless hosts are pinged") {
+        CHECK(sent[1] == 2);
+        CHECK(sent[2] == 0);
+      }
+    }
+    WHEN("the refresh interval of the wireless side has passed") {
+      now += std::chrono::seconds(5);
+      refresharp(entries.data(), context, clock);
+      now += std::chrono::seconds(5);
+      sent.clear();
+      refresharp(entries.data(), context, clock);
+      THEN("only the wireless hosts are pinged again") {
+        CHECK(sent[1] == 10);
+        CHECK(sent[2] == 0);
+      }
+    }
+    delete iface_remove(it->name);
+    policy_rules.clear();
+  }
+
+  SECTION("replies are handled before requests") {
+    FileSystemMock fileSystem{};
+    ClockMock clock{};
+    ALLOW_CALL(clock, now()).RETURN(Clock::time_point{std::chrono::hours(24)});
+
+    /* the reply stops at its kernel ARP update, the request at its relay */
+    std::vector<int> sockets;
+    ALLOW_CALL(context, socket(_, _, _)).LR_SIDE_EFFECT(sockets.push_back(_1)).RETURN(-1);
+    ALLOW_CALL(context, ioctl3(-1, _, _)).RETURN(-1);
+    ALLOW_CALL(context, close(-1)).RETURN(0);
+
+    auto *it = iface_add("eth1");
+    std::vector<arp_event> events(3);
+    for (auto &ev : events) {
+      ev.ifs.sll_ifindex = 2;
+      strcpy(ev.ifname, "eth0");
+      inet_pton(AF_INET, "10.0.0.1", ev.frame.arp.arp_spa);
+      inet_pton(AF_INET, "10.0.0.9", ev.frame.arp.arp_tpa);
+    }
+    /* each request asks for another target, both are relayed */
+    inet_pton(AF_INET, "10.0.0.10", events[1].frame.arp.arp_tpa);
+    events[0].frame.arp.arp_op = htons(ARPOP_REQUEST);
+    events[1].frame.arp.arp_op = htons(ARPOP_REQUEST);
+    events[2].frame.arp.arp_op = htons(ARPOP_REPLY);
+
+    auto replies = stats.frames[ARP_CLASS_REPLY].load();
+    auto requests = stats.frames[ARP_CLASS_REQUEST].load();
+    stats.waiting_peak[ARP_CLASS_REQUEST] = 0;
+    arp_batch batch;
+    for (auto &ev : events) {
+      arp_batch_add(batch, &ev);
+    }
+    arp_batch_run(batch, fileSystem, context, clock);
+
+    THEN("the reply that came last is handled first") {
+      CHECK(sockets == std::vector<int>{AF_INET, AF_PACKET, AF_PACKET});
+    }
+    THEN("the classes are counted") {
+      CHECK(stats.frames[ARP_CLASS_REPLY] == replies + 1);
+      CHECK(stats.frames[ARP_CLASS_REQUEST] == requests + 2);
+      CHECK(stats.waiting_peak[ARP_CLASS_REQUEST] == 2);
+      CHECK(batch.queued[ARP_CLASS_REQUEST].empty());
+    }
+
+    rq_clear();
+    delete iface_remove(it->name);
+  }
+
+  SECTION("requests for one target are coalesced") {
+    FileSystemMock fileSystem{};
+    ALLOW_CALL(fileSystem, fopen(_, _)).RETURN(nullptr);
+    ALLOW_CALL(fileSystem, feof(_)).RETURN(1);
+    ALLOW_CALL(fileSystem, fclose(_)).RETURN(0);
+    ClockMock clock{};
+    auto now = Clock::time_point{std::chrono::hours(24)};
+    ALLOW_CALL(clock, now()).LR_RETURN(now);
+
+    ALLOW_CALL(context, socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP))).RETURN(7);
+    ALLOW_CALL(context, ioctl3(7, _, _)).RETURN(0);
+    ALLOW_CALL(context, close(7)).RETURN(0);
+    std::vector<ether_arp_frame> sent;
+    ALLOW_CALL(context, sendto(7, _, sizeof(ether_arp_frame), 0, _, sizeof(sockaddr_ll)))
+        .LR_SIDE_EFFECT(sent.push_back(*static_cast<const ether_arp_frame *>(_2)))
+        .RETURN(0);
+    auto count = [&](uint16_t op) {
+      return std::count_if(sent.begin(), sent.end(),
+                           [op](const auto &frame) { return frame.arp.arp_op == htons(op); });
+    };
+
+    auto *it = iface_add("eth1");
+    /* host 1 asks twice, host 3 is on the interface the target replies on */
+    auto request = [&](unsigned char host, int ifindex, const char *target) {
+      ether_arp_frame frame{};
+      struct sockaddr_ll ifs {};
+      frame.arp.arp_op = htons(ARPOP_REQUEST);
+      frame.arp.arp_sha[5] = host;
+      inet_pton(AF_INET, ("10.0.0."s + std::to_string(host)).c_str(), frame.arp.arp_spa);
+      inet_pton(AF_INET, target, frame.arp.arp_tpa);
+      ifs.sll_ifindex = ifindex;
+      arp_handle_frame(&frame, &ifs, "eth0", fileSystem, context, clock);
+    };
+    for (unsigned char host : {1, 2, 1, 3}) {
+      request(host, host == 3 ? 4 : 2, "10.0.0.9");
+    }
+
+    THEN("the target is asked for once, for all requesters") {
+      CHECK(count(ARPOP_REQUEST) == 1);
+      REQUIRE(req_queue_len == 1);
+      CHECK(req_queue->waiters.size() == 3);
+    }
+    WHEN("the target replies") {
+      rq_process(in_addr{htonl(0x0a000009)}, 4, 0, fileSystem, context, clock);
+      THEN("the requesters on other interfaces are answered in one go") {
+        REQUIRE(count(ARPOP_REPLY) == 2);
+        CHECK(sent[1].ether_hdr.ether_dhost[5] == 1);
+        CHECK(sent[2].ether_hdr.ether_dhost[5] == 2);
+        CHECK(sent[1].arp.arp_spa[3] == 9);
+        REQUIRE(req_queue_len == 1);
+        CHECK(req_queue->waiters.size() == 1);
+      }
+    }
+    WHEN("the target was asked for a while ago") {
+      now += std::chrono::seconds(RQ_RELAY_TIME);
+      request(2, 2, "10.0.0.9");
+      THEN("it is asked for again") { CHECK(count(ARPOP_REQUEST) == 2); }
+    }
+    WHEN("the queue is full") {
+      auto dropped = stats.queue_dropped.load();
+      int queue_size = std::exchange(option_queue_size, 1);
+      request(1, 2, "10.0.0.10");
+      option_queue_size = queue_size;
+      THEN("the oldest target goes with all its requesters") {
+        REQUIRE(req_queue_len == 1);
+        CHECK(req_queue->target.s_addr == htonl(0x0a00000a));
+        CHECK(stats.queue_dropped == dropped + 3);
+      }
+    }
+
+    rq_clear();
+    delete iface_remove(it->name);
+  }
+
+  SECTION("gratuitous arp is coalesced") {
+    ClockMock clock{};
+    // every run starts well past the suppression of the previous one
+    static auto epoch = std::chrono::hours(0);
+    auto now = Clock::time_point{epoch += std::chrono::hours(1)};
+    ALLOW_CALL(clock, now()).LR_RETURN(now);
+
+    ALLOW_CALL(context, socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP))).RETURN(7);
+    ALLOW_CALL(context, ioctl3(7, _, _)).RETURN(0);
+    std::vector<ether_arp> sent;
+    ALLOW_CALL(context, sendto(7, _, sizeof(ether_arp_frame), 0, _, sizeof(sockaddr_ll)))
+        .LR_SIDE_EFFECT(sent.push_back(static_cast<const ether_arp_frame *>(_2)->arp))
+        .RETURN(0);
+
+    garp_add("eth0", in_addr{htonl(0x0a000001)}, clock);
+    garp_add("eth0", in_addr{htonl(0x0a000001)}, clock);
+    garp_add("eth0", in_addr{htonl(0x0a000002)}, clock);
+
+    WHEN("window has not passed") {
+      FORBID_CALL(context, socket(_, _, _));
+      garp_flush(context, clock);
+      now += std::chrono::microseconds(GARP_WINDOW);
+      THEN("batch is sent once it has passed") {
+        REQUIRE_CALL(context, close(7)).RETURN(0);
+        garp_flush(context, clock);
+        CHECK(sent.size() == 2);
+      }
+    }
+    WHEN("window has passed") {
+      now += std::chrono::microseconds(GARP_WINDOW);
+      REQUIRE_CALL(context, socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP))).RETURN(7);
+      REQUIRE_CALL(context, close(7)).RETURN(0);
+      garp_flush(context, clock);
+      THEN("one socket, one gratuitous request per host") {
+        REQUIRE(sent.size() == 2);
+        ether_arp first = sent[0], second = sent[1];
+        CHECK(std::to_array(first.arp_spa) ==
+              std::experimental::make_array<uint8_t>(0x0a, 0x00, 0x00, 0x01));
+        CHECK(std::to_array(first.arp_tpa) ==
+              std::experimental::make_array<uint8_t>(0x0a, 0x00, 0x00, 0x01));
+        CHECK(std::to_array(second.arp_tpa) ==
+              std::experimental::make_array<uint8_t>(0x0a, 0x00, 0x00, 0x02));
+      }
+      AND_WHEN("the host replies again") {
+        now += std::chrono::seconds(1);
+        garp_add("eth0", in_addr{htonl(0x0a000001)}, clock);
+        now += std::chrono::seconds(1);
+        FORBID_CALL(context, socket(_, _, _));
+        garp_flush(context, clock);
+        THEN("it is suppressed") { CHECK(sent.size() == 2); }
+      }
+    }
+  }
 }
 
 } // namespace
@@ -17,6 +17,7 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include <linux/filter.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
@@ -24,20 +25,26 @@
 #include <netinet/if_ether.h>
 #include <sys/ioctl.h>
 
+#include "actor.h"
+#include "clock.h"
 #include "context.h"
+#include "handover.h"
 #include "parprouted.h"
+#include "probes.h"
 
-typedef struct _req_struct {
-  ether_arp_frame req_frame;
-  struct sockaddr_ll req_if;
-  struct _req_struct *next;
-} RQ_ENTRY;
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
 RQ_ENTRY *req_queue = NULL;
 RQ_ENTRY *req_queue_tail = NULL;
 int req_queue_len = 0;
 pthread_mutex_t req_queue_mutex;
 
+static RateLimiter rate_limiter;
+
 /* Check if the IP address exists in the arptab */
 
 int ipaddr_known(arptab_entry *list, struct in_addr addr, char *ifname) {
@@ -51,21 +58,19 @@ int ipaddr_known(arptab_entry *list, struct in_addr addr, char *ifname) {
     list = list->next;
   }
 
-  if (debug) {
-    printf("Did not find match for %s(%s)\n", inet_ntoa(addr), ifname);
-  }
+  LOG(LOG_DEBUG, "Did not find match for %s(%s)", addr, ifname);
 
   return 0;
 }
 
 /* Wait for an ARP packet */
 
-int arp_recv(int sock, ether_arp_frame *frame) {
+int arp_recv(int sock, ether_arp_frame *frame, int flags = 0) {
   char packet[4096];
 
   memset(frame, 0, sizeof(ether_arp_frame));
 
-  ssize_t nread = recv(sock, &packet, sizeof(packet), 0);
+  ssize_t nread = recv(sock, &packet, sizeof(packet), flags);
   if (nread < 0) {
     return -1;
   }
@@ -78,19 +83,12 @@ int arp_recv(int sock, ether_arp_frame *frame) {
   return static_cast<int>(nread);
 }
 
-/* Send ARP is-at reply */
+/* Send ARP is-at reply, made from the request, on a socket */
 
-void arp_reply(ether_arp_frame *reqframe, struct sockaddr_ll *ifs, Context &context) {
+static void arp_send_reply(int sock, ether_arp_frame *reqframe, struct sockaddr_ll *ifs,
+                           Context &context) {
   struct ether_arp *arp = &reqframe->arp;
   unsigned char ip[4];
-  int sock;
-
-  sock = context.socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP));
-
-  if (context.bind(sock, (struct sockaddr *)ifs, sizeof(struct sockaddr_ll)) < 0) {
-    fprintf(stderr, "arp_reply() bind: %s\n", strerror(errno));
-    abort();
-  }
 
   memcpy(&reqframe->ether_hdr.ether_dhost, &arp->arp_sha, ETH_ALEN);
   memcpy(&reqframe->ether_hdr.ether_shost, ifs->sll_addr, ETH_ALEN);
@@ -105,36 +103,49 @@ void arp_reply(ether_arp_frame *reqframe, struct sockaddr_ll *ifs, Context &cont
 
   arp->arp_op = htons(ARPOP_REPLY);
 
-  if (debug) {
+  PROBE(reply__send, probe_ip(arp->arp_spa), ifs->sll_ifindex);
+
+  if (LOG_DEBUG <= log_level) {
     struct in_addr sia;
     struct in_addr dia;
 
     memcpy(&sia.s_addr, arp->arp_spa, 4);
     memcpy(&dia.s_addr, arp->arp_tpa, 4);
 
-    printf("Replying to %s faking %s\n", inet_ntoa(sia), inet_ntoa(dia));
+    LOG(LOG_DEBUG, "Replying to %s faking %s", sia, dia);
   }
 
   context.sendto(sock, reqframe, sizeof(ether_arp_frame), 0, (struct sockaddr *)ifs,
                  sizeof(struct sockaddr_ll));
+}
+
+void arp_reply(ether_arp_frame *reqframe, struct sockaddr_ll *ifs, Context &context) {
+  int sock;
+
+  sock = context.socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP));
+
+  if (context.bind(sock, (struct sockaddr *)ifs, sizeof(struct sockaddr_ll)) < 0) {
+    fprintf(stderr, "arp_reply() bind: %s\n", strerror(errno));
+    abort();
+  }
+
+  arp_send_reply(sock, reqframe, ifs, context);
 
   context.close(sock);
 }
 
-/* Send ARP who-has request */
+/* Open a socket for sending ARP requests on ifname and look up the
+ * interface's link address and IP address, returns -1 on error */
 
-void arp_req(const char *ifname, struct in_addr remaddr, bool gratuitous, Context &context) {
-  ether_arp_frame frame;
-  struct ether_arp *arp = &frame.arp;
+static int arp_open(const char *ifname, struct sockaddr_ll *ifs, unsigned long *ifaddr,
+                    Context &context) {
   int sock;
-  struct sockaddr_ll ifs;
   struct ifreq ifr;
-  unsigned long ifaddr;
   struct sockaddr_in *sin;
 
   /* Make sure that interface is not empty */
   if (strcmp(ifname, "") == 0) {
-    return;
+    return -1;
   }
 
   sock = context.socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP));
@@ -143,36 +154,50 @@ void arp_req(const char *ifname, struct in_addr remaddr, bool gratuitous, Contex
   memset(ifr.ifr_name, 0, IFNAMSIZ);
   strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
   if (context.ioctl(sock, SIOCGIFHWADDR, &ifr) < 0) {
-    syslog(LOG_ERR, "error in arp_req(): ioctl SIOCGIFHWADDR for %s: %s\n", ifname,
-           strerror(errno));
-    abort();
+    LOG(LOG_ERR, "error in arp_req(): ioctl SIOCGIFHWADDR for %s: %s", ifname, strerror(errno));
+    context.close(sock);
+    return -1;
   }
 
-  memset(ifs.sll_addr, 0, ETH_ALEN);
-  memcpy(ifs.sll_addr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+  memset(ifs->sll_addr, 0, ETH_ALEN);
+  memcpy(ifs->sll_addr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
 
   if (context.ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
-    syslog(LOG_ERR, "error in arp_req(): ioctl SIOCGIFINDEX for %s: %s", ifname, strerror(errno));
-    return;
+    LOG(LOG_ERR, "error in arp_req(): ioctl SIOCGIFINDEX for %s: %s", ifname,
+        strerror(errno));
+    context.close(sock);
+    return -1;
   }
 
-  ifs.sll_family = AF_PACKET;
-  ifs.sll_protocol = htons(ETH_P_ARP);
-  ifs.sll_ifindex = ifr.ifr_ifindex;
-  ifs.sll_hatype = ARPHRD_ETHER;
-  ifs.sll_pkttype = PACKET_BROADCAST;
-  ifs.sll_halen = ETH_ALEN;
+  ifs->sll_family = AF_PACKET;
+  ifs->sll_protocol = htons(ETH_P_ARP);
+  ifs->sll_ifindex = ifr.ifr_ifindex;
+  ifs->sll_hatype = ARPHRD_ETHER;
+  ifs->sll_pkttype = PACKET_BROADCAST;
+  ifs->sll_halen = ETH_ALEN;
 
   if (context.ioctl(sock, SIOCGIFADDR, &ifr) == 0) {
     sin = (struct sockaddr_in *)&ifr.ifr_addr;
-    ifaddr = sin->sin_addr.s_addr;
+    *ifaddr = sin->sin_addr.s_addr;
   } else {
-    syslog(LOG_ERR, "error: ioctl SIOCGIFADDR for %s: %s", ifname, strerror(errno));
-    return;
+    LOG(LOG_ERR, "error: ioctl SIOCGIFADDR for %s: %s", ifname, strerror(errno));
+    context.close(sock);
+    return -1;
   }
 
+  return sock;
+}
+
+/* Send ARP who-has request on a socket opened by arp_open() */
+
+static void arp_send_req(int sock, struct sockaddr_ll *ifs, unsigned long ifaddr,
+                         const char *ifname, struct in_addr remaddr, bool gratuitous,
+                         Context &context) {
+  ether_arp_frame frame;
+  struct ether_arp *arp = &frame.arp;
+
   memset(&frame.ether_hdr.ether_dhost, 0xFF, ETH_ALEN);
-  memcpy(&frame.ether_hdr.ether_shost, ifs.sll_addr, ETH_ALEN);
+  memcpy(&frame.ether_hdr.ether_shost, ifs->sll_addr, ETH_ALEN);
   frame.ether_hdr.ether_type = htons(ETHERTYPE_ARP);
 
   arp->arp_hrd = htons(ARPHRD_ETHER);
@@ -180,7 +205,7 @@ void arp_req(const char *ifname, struct in_addr remaddr, bool gratuitous, Contex
   arp->arp_hln = 6;
   arp->arp_pln = 4;
   memset(&arp->arp_tha, 0, ETH_ALEN);
-  memcpy(&arp->arp_sha, ifs.sll_addr, ETH_ALEN);
+  memcpy(&arp->arp_sha, ifs->sll_addr, ETH_ALEN);
 
   memcpy(&arp->arp_tpa, &remaddr.s_addr, 4);
   if (gratuitous) {
@@ -191,146 +216,591 @@ void arp_req(const char *ifname, struct in_addr remaddr, bool gratuitous, Contex
 
   arp->arp_op = htons(ARPOP_REQUEST);
 
-  if (debug) {
-    printf("Sending ARP request for %s to %s\n", inet_ntoa(remaddr), ifname);
-  }
-  context.sendto(sock, &frame, sizeof(ether_arp_frame), 0, (struct sockaddr *)&ifs,
+  LOG(LOG_DEBUG, "Sending ARP request for %s to %s", remaddr, ifname);
+  PROBE(request__send, remaddr.s_addr, ifs->sll_ifindex, gratuitous);
+  context.sendto(sock, &frame, sizeof(ether_arp_frame), 0, (struct sockaddr *)ifs,
                  sizeof(struct sockaddr_ll));
+}
+
+/* Send ARP who-has request */
+
+void arp_req(const char *ifname, struct in_addr remaddr, bool gratuitous, Context &context) {
+  struct sockaddr_ll ifs;
+  unsigned long ifaddr;
+  int sock;
+
+  if ((sock = arp_open(ifname, &ifs, &ifaddr, context)) < 0) {
+    return;
+  }
+  arp_send_req(sock, &ifs, ifaddr, ifname, remaddr, gratuitous, context);
   context.close(sock);
 }
 
-/* ARP ping all entries in the table */
+/* Send ARP who-has requests for several addresses over one socket */
+
+void arp_req_batch(const char *ifname, const std::vector<struct in_addr> &addrs,
+                   bool gratuitous, Context &context) {
+  struct sockaddr_ll ifs;
+  unsigned long ifaddr;
+  int sock;
 
-void refresharp(arptab_entry *list, Context &context) {
-  if (debug) {
-    printf("Refreshing ARP entries.\n");
+  if ((sock = arp_open(ifname, &ifs, &ifaddr, context)) < 0) {
+    return; /* interface is gone */
   }
+  for (const auto &addr : addrs) {
+    arp_send_req(sock, &ifs, ifaddr, ifname, addr, gratuitous, context);
+  }
+  context.close(sock);
+}
 
-  while (list != NULL) {
-    arp_req(list->ifname, list->ipaddr_ia, false, context);
-    list = list->next;
+/* Gratuitous ARP announcements of learned hosts to the other interfaces.
+ *
+ * Replies arrive in bursts during convergence, so announcements are not
+ * sent right away: they are collected for GARP_WINDOW, deduplicated per
+ * (interface, IP) and sent in one batch per interface over a single
+ * socket, at most GARP_BATCH per interface and window. A host announced
+ * on an interface is not announced there again for GARP_SUPPRESS seconds. */
+
+struct garp_state {
+  Clock::time_point sent{}; /* last announcement */
+  bool announced = false;
+  bool pending = false;
+};
+
+/* ordered by interface first, so a flush walks one interface at a time */
+static std::map<std::pair<std::string, in_addr_t>, garp_state> garp_table;
+static size_t garp_pending = 0;
+static Clock::time_point garp_window_start{};
+static pthread_mutex_t garp_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void garp_add(const char *ifname, struct in_addr addr, Clock &clock) {
+  auto now = clock.now();
+
+  pthread_mutex_lock(&garp_mutex);
+  garp_state &state = garp_table[{ifname, addr.s_addr}];
+  if (state.pending) {
+    pthread_mutex_unlock(&garp_mutex);
+    return;
+  }
+  if (state.announced && now - state.sent < std::chrono::seconds(GARP_SUPPRESS)) {
+    LOG(LOG_DEBUG, "Gratuitous ARP for %s to %s suppressed", addr, ifname);
+    pthread_mutex_unlock(&garp_mutex);
+    return;
+  }
+  state.pending = true;
+  if (garp_pending++ == 0) {
+    garp_window_start = now;
   }
+  pthread_mutex_unlock(&garp_mutex);
 }
 
-int rq_add(ether_arp_frame *req_frame, struct sockaddr_ll *req_if) {
-  RQ_ENTRY *new_entry;
+void garp_flush(Context &context, Clock &clock) {
+  std::vector<std::pair<std::string, std::vector<struct in_addr>>> batch;
+  auto now = clock.now();
 
-  if ((new_entry = (RQ_ENTRY *)malloc(sizeof(RQ_ENTRY))) == NULL) {
-    syslog(LOG_INFO, "No memory: %s", strerror(errno));
-    return 0;
+  pthread_mutex_lock(&garp_mutex);
+  if (garp_pending == 0 || now - garp_window_start < std::chrono::microseconds(GARP_WINDOW)) {
+    pthread_mutex_unlock(&garp_mutex);
+    return;
   }
 
-  pthread_mutex_lock(&req_queue_mutex);
+  for (auto it = garp_table.begin(); it != garp_table.end();) {
+    const auto &[ifname, ip] = it->first;
+    garp_state &state = it->second;
+
+    if (!state.pending) {
+      /* forget hosts once they may be announced again */
+      if (now - state.sent >= std::chrono::seconds(GARP_SUPPRESS)) {
+        it = garp_table.erase(it);
+      } else {
+        ++it;
+      }
+      continue;
+    }
+    if (batch.empty() || batch.back().first != ifname) {
+      batch.emplace_back(ifname, std::vector<struct in_addr>{});
+    }
+    if (batch.back().second.size() < GARP_BATCH) {
+      batch.back().second.push_back(in_addr{ip});
+      state.pending = false;
+      state.announced = true;
+      state.sent = now;
+      garp_pending--;
+    }
+    ++it;
+  }
+  /* the rest goes out with the next batch */
+  garp_window_start = now;
+  pthread_mutex_unlock(&garp_mutex);
+
+  for (const auto &[ifname, addrs] : batch) {
+    LOG(LOG_DEBUG, "Sending %zu gratuitous ARP requests to %s", addrs.size(), ifname.c_str());
+    arp_req_batch(ifname.c_str(), addrs, true, context);
+  }
+}
 
-  req_queue_len++;
+void *garp_thread(Context &context, Clock &clock) {
+  while (true) {
+    clock.sleep_for(std::chrono::microseconds(GARP_WINDOW));
+    garp_flush(context, clock);
+  }
+}
 
-  /* Check if the list has more entries than MAX_RQ_SIZE,
-   * and delete the oldest entry */
-  if (req_queue_len > MAX_RQ_SIZE) {
-    RQ_ENTRY *temp;
+/* ARP ping all entries in the table */
 
-    if (debug) {
-      printf("Request queue has grown too large, deleting last element\n");
+/* Pings per interface still allowed by its pace; under arptab_mutex */
+struct refresh_pace {
+  double budget = 0;
+  Clock::time_point last{};
+};
+
+static std::map<std::string, refresh_pace> refresh_paces;
+
+/* Called at every poll: pings the entries whose interface's refresh
+ * interval has passed since their last ping, at most at the interface's
+ * pace, in one batch per interface. Entries left over by the pace are
+ * pinged at the next polls. */
+void refresharp(arptab_entry *list, Context &context, Clock &clock) {
+  std::map<std::string, std::vector<struct in_addr>> batches;
+  auto now = clock.now();
+  const iface_policies policies;
+
+  for (; list != NULL; list = list->next) {
+    const iface_policy &policy = policies.of(list->ifname);
+    if (now - list->refreshed < std::chrono::seconds(policy.refresh)) {
+      continue;
+    }
+    if (policy.pace > 0) {
+      refresh_pace &pace = refresh_paces[list->ifname];
+      if (pace.last != now) {
+        /* a poll interval's worth, but no more */
+        double elapsed = std::min(std::chrono::duration<double>(now - pace.last).count(),
+                                  option_poll_max / 1e3);
+        pace.budget = std::min(pace.budget + policy.pace * elapsed,
+                               policy.pace * std::max(elapsed, 1.0));
+        pace.last = now;
+      }
+      if (pace.budget < 1) {
+        continue;
+      }
+      pace.budget--;
     }
-    temp = req_queue;
-    req_queue = req_queue->next;
-    req_queue_len--;
+    list->refreshed = now;
+    batches[list->ifname].push_back(list->ipaddr_ia);
+  }
+
+  for (const auto &[ifname, addrs] : batches) {
+    LOG(LOG_DEBUG, "Refreshing %zu ARP entries on %s.", addrs.size(), ifname.c_str());
+    arp_req_batch(ifname.c_str(), addrs, false, context);
+  }
+}
 
-    free(temp);
+/* Drop the oldest target and its waiters; under req_queue_mutex */
+static void rq_evict() {
+  RQ_ENTRY *temp = req_queue;
+
+  LOG(LOG_DEBUG, "Request queue has grown too large, dropping %s", temp->target);
+  PROBE(queue__evict, temp->target.s_addr, temp->waiters.front().ifindex,
+        probe_clock() - temp->queued);
+  stats.queue_dropped += temp->waiters.size();
+  req_queue = temp->next;
+  if (req_queue == NULL) {
+    req_queue_tail = NULL;
   }
+  req_queue_len--;
+  delete temp;
+}
 
-  /* Add entry to the list */
+bool rq_add(const ether_arp_frame *req_frame, const struct sockaddr_ll *req_if, int group,
+            std::chrono::steady_clock::time_point now) {
+  struct in_addr target;
+  rq_waiter waiter{};
+  RQ_ENTRY *entry;
 
-  if (req_queue != NULL) {
-    req_queue_tail->next = new_entry;
-  } else {
-    req_queue = new_entry;
+  memcpy(&target, req_frame->arp.arp_tpa, sizeof(target));
+  memcpy(waiter.hwaddr, req_frame->arp.arp_sha, ETH_ALEN);
+  memcpy(&waiter.ipaddr, req_frame->arp.arp_spa, sizeof(waiter.ipaddr));
+  waiter.ifindex = req_if->sll_ifindex;
+  memcpy(waiter.ifaddr, req_if->sll_addr, ETH_ALEN);
+
+  pthread_mutex_lock(&req_queue_mutex);
+
+  for (entry = req_queue; entry != NULL; entry = entry->next) {
+    if (entry->target.s_addr == target.s_addr && entry->group == group) {
+      break;
+    }
   }
 
-  req_queue_tail = new_entry;
+  if (entry == NULL) {
+    /* Make room for the new target, the oldest go first */
+    while (req_queue != NULL && req_queue_len >= option_queue_size) {
+      rq_evict();
+    }
+
+    entry = new RQ_ENTRY();
+    entry->target = target;
+    entry->group = group;
+    entry->queued = probe_clock();
+    entry->next = NULL;
+    if (req_queue != NULL) {
+      req_queue_tail->next = entry;
+    } else {
+      req_queue = entry;
+    }
+    req_queue_tail = entry;
+    req_queue_len++;
+  }
 
-  new_entry->next = NULL;
+  /* a host asking again waits once */
+  auto same = std::find_if(entry->waiters.begin(), entry->waiters.end(), [&](const auto &it) {
+    return it.ipaddr.s_addr == waiter.ipaddr.s_addr && it.ifindex == waiter.ifindex &&
+           memcmp(it.hwaddr, waiter.hwaddr, ETH_ALEN) == 0;
+  });
+  if (same == entry->waiters.end()) {
+    if (entry->waiters.size() >= RQ_MAX_WAITERS) {
+      entry->waiters.erase(entry->waiters.begin());
+      stats.queue_dropped++;
+    }
+    entry->waiters.push_back(waiter);
+  }
 
-  memcpy(&new_entry->req_frame, req_frame, sizeof(ether_arp_frame));
-  memcpy(&new_entry->req_if, req_if, sizeof(struct sockaddr_ll));
+  bool relay = entry->relayed == std::chrono::steady_clock::time_point{} ||
+               now - entry->relayed >= std::chrono::seconds(RQ_RELAY_TIME);
+  if (relay) {
+    entry->relayed = now;
+  }
 
+  PROBE(queue__add, target.s_addr, waiter.ifindex, req_queue_len);
   pthread_mutex_unlock(&req_queue_mutex);
+  return relay;
+}
 
-  return 1;
+void rq_request(const RQ_ENTRY &entry, const rq_waiter &waiter, ether_arp_frame &frame,
+                struct sockaddr_ll &req_if) {
+  memset(&frame, 0, sizeof(frame));
+  memset(frame.ether_hdr.ether_dhost, 0xFF, ETH_ALEN);
+  memcpy(frame.ether_hdr.ether_shost, waiter.hwaddr, ETH_ALEN);
+  frame.ether_hdr.ether_type = htons(ETHERTYPE_ARP);
+  frame.arp.arp_hrd = htons(ARPHRD_ETHER);
+  frame.arp.arp_pro = htons(ETH_P_IP);
+  frame.arp.arp_hln = ETH_ALEN;
+  frame.arp.arp_pln = 4;
+  frame.arp.arp_op = htons(ARPOP_REQUEST);
+  memcpy(frame.arp.arp_sha, waiter.hwaddr, ETH_ALEN);
+  memcpy(frame.arp.arp_spa, &waiter.ipaddr, 4);
+  memcpy(frame.arp.arp_tpa, &entry.target, 4);
+
+  memset(&req_if, 0, sizeof(req_if));
+  req_if.sll_family = AF_PACKET;
+  req_if.sll_protocol = htons(ETH_P_ARP);
+  req_if.sll_ifindex = waiter.ifindex;
+  req_if.sll_hatype = ARPHRD_ETHER;
+  req_if.sll_pkttype = PACKET_BROADCAST;
+  req_if.sll_halen = ETH_ALEN;
+  memcpy(req_if.sll_addr, waiter.ifaddr, ETH_ALEN);
+}
+
+void rq_clear() {
+  pthread_mutex_lock(&req_queue_mutex);
+  while (req_queue != NULL) {
+    delete std::exchange(req_queue, req_queue->next);
+  }
+  req_queue_tail = NULL;
+  req_queue_len = 0;
+  pthread_mutex_unlock(&req_queue_mutex);
 }
 
-void rq_process(struct in_addr ipaddr, int ifindex, FileSystem &fileSystem, Context &context) {
+/* Answer the waiters of a target in one burst over one socket */
+
+static void arp_reply_batch(const RQ_ENTRY &entry, Context &context) {
+  int sock;
+
+  if ((sock = context.socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP))) < 0) {
+    LOG(LOG_ERR, "error: reply socket for %s: %s", entry.target, strerror(errno));
+    return;
+  }
+  for (const auto &waiter : entry.waiters) {
+    ether_arp_frame frame;
+    struct sockaddr_ll req_if;
+
+    PROBE(queue__match, entry.target.s_addr, waiter.ifindex, probe_clock() - entry.queued);
+    rq_request(entry, waiter, frame, req_if);
+    arp_send_reply(sock, &frame, &req_if, context);
+  }
+  context.close(sock);
+}
+
+void rq_process(struct in_addr ipaddr, int ifindex, int group, FileSystem &fileSystem,
+                Context &context, Clock &clock) {
   RQ_ENTRY *cur_entry;
   RQ_ENTRY *prev_entry = NULL;
+  RQ_ENTRY answered;
 
   pthread_mutex_lock(&arptab_mutex);
-  parseproc(fileSystem, context);
-  processarp(context, false);
+  parseproc(fileSystem, context, clock);
+  processarp(context, clock, false);
   pthread_mutex_unlock(&arptab_mutex);
 
   pthread_mutex_lock(&req_queue_mutex);
 
-  cur_entry = req_queue;
-
-  /* Walk through the list */
-
-  while (cur_entry != NULL) {
-    if (ipaddr.s_addr == ((struct in_addr *)cur_entry->req_frame.arp.arp_tpa)->s_addr &&
-        ifindex != cur_entry->req_if.sll_ifindex) {
-
-      if (debug) {
-        printf("Found %s in request queue\n", inet_ntoa(ipaddr));
-      }
-      arp_reply(&cur_entry->req_frame, &cur_entry->req_if, context);
-
-      /* Delete entry from the linked list */
+  for (cur_entry = req_queue; cur_entry != NULL;
+       prev_entry = cur_entry, cur_entry = cur_entry->next) {
+    if (ipaddr.s_addr == cur_entry->target.s_addr && group == cur_entry->group) {
+      break;
+    }
+  }
 
+  if (cur_entry != NULL) {
+    /* hosts on the interface of the reply have got it themselves */
+    auto mine = std::stable_partition(
+        cur_entry->waiters.begin(), cur_entry->waiters.end(),
+        [ifindex](const rq_waiter &waiter) { return waiter.ifindex == ifindex; });
+    answered.target = cur_entry->target;
+    answered.queued = cur_entry->queued;
+    answered.waiters.assign(mine, cur_entry->waiters.end());
+    cur_entry->waiters.erase(mine, cur_entry->waiters.end());
+
+    /* Delete entry from the linked list */
+    if (cur_entry->waiters.empty()) {
       if (cur_entry == req_queue_tail) {
         req_queue_tail = prev_entry;
       }
-
       if (prev_entry != NULL) {
         prev_entry->next = cur_entry->next;
       } else {
         req_queue = cur_entry->next;
       }
+      delete cur_entry;
+      req_queue_len--;
+    }
+  }
 
-      free(cur_entry);
-      cur_entry = prev_entry;
+  pthread_mutex_unlock(&req_queue_mutex);
 
-      req_queue_len--;
+  if (!answered.waiters.empty()) {
+    LOG(LOG_DEBUG, "Found %s in request queue, answering %zu hosts", ipaddr,
+        answered.waiters.size());
+    arp_reply_batch(answered, context);
+  }
+}
+
+/* Handle one received ARP frame, exactly as arp_thread() does for every
+ * frame read from the interface socket */
+
+void arp_handle_frame(ether_arp_frame *frame, struct sockaddr_ll *ifs, const char *ifname,
+                      FileSystem &fileSystem, Context &context, Clock &clock) {
+  struct in_addr sia;
+  struct in_addr dia;
+
+  memcpy(&sia.s_addr, frame->arp.arp_spa, 4);
+
+  /* What we need of the receiving interface, in one go; interfaces we do
+   * not proxy on are in the default group and not restricted */
+  pthread_rwlock_rdlock(&ifaces_lock);
+  const iface *self = iface_find(ifname);
+  int group = self != NULL ? self->group : 0;
+  bool sender_in_scope = self == NULL || self->scope.contains(sia);
+  rate_limit limit = self != NULL ? self->limit : rate_limit{};
+  pthread_rwlock_unlock(&ifaces_lock);
+
+  /* Insert all the replies into ARP table */
+  if (frame->arp.arp_op == htons(ARPOP_REPLY)) {
+
+    /* Received frame is an ARP reply */
+
+    struct arpreq k_arpreq;
+    int arpsock;
+    struct sockaddr_in *sin;
+
+    if (!sender_in_scope) {
+      LOG(LOG_DEBUG, "Reply from %s on iface %s out of scope, dropped", sia, ifname);
+      return;
     }
 
-    if (cur_entry != NULL) {
-      prev_entry = cur_entry;
-      cur_entry = cur_entry->next;
+    if ((arpsock = context.socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+      LOG(LOG_ERR, "error: ARP socket for %s: %s", ifname, strerror(errno));
+      return;
     }
+
+    k_arpreq.arp_ha.sa_family = ARPHRD_ETHER;
+    memcpy(&k_arpreq.arp_ha.sa_data, &frame->arp.arp_sha, sizeof(frame->arp.arp_sha));
+    k_arpreq.arp_flags = ATF_COM;
+    if (option_arpperm) {
+      k_arpreq.arp_flags = k_arpreq.arp_flags | ATF_PERM;
+    }
+    strncpy(k_arpreq.arp_dev, ifname, sizeof(k_arpreq.arp_dev));
+
+    k_arpreq.arp_pa.sa_family = AF_INET;
+    sin = (struct sockaddr_in *)&k_arpreq.arp_pa;
+    memcpy(&sin->sin_addr.s_addr, &frame->arp.arp_spa, sizeof(sin->sin_addr));
+
+    /* Update kernel ARP table with the data from reply */
+
+    LOG(LOG_DEBUG, "Received reply: updating kernel ARP table for %s(%s).", sin->sin_addr,
+        ifname);
+    if (context.ioctl(arpsock, SIOCSARP, &k_arpreq) < 0) {
+      LOG(LOG_ERR, "error: ioctl SIOCSARP for %s(%s): %s", sin->sin_addr, ifname, strerror(errno));
+      context.close(arpsock);
+      return;
+    }
+    context.close(arpsock);
+    PROBE(reply__learned, sin->sin_addr.s_addr, ifs->sll_ifindex);
+
+    /* Check if reply is for one of the requests in request queue */
+    rq_process(sin->sin_addr, ifs->sll_ifindex, group, fileSystem, context, clock);
+
+    /* announce the host on all other interfaces of the group to let them
+     * update their ARP tables quickly */
+    pthread_rwlock_rdlock(&ifaces_lock);
+    for (const auto *it : ifaces) {
+      if (it->group == group && strcmp(it->name, ifname)) {
+        garp_add(it->name, sin->sin_addr, clock);
+      }
+    }
+    pthread_rwlock_unlock(&ifaces_lock);
+    return;
   }
 
-  pthread_mutex_unlock(&req_queue_mutex);
+  if (frame->arp.arp_op != htons(ARPOP_REQUEST)) {
+    return;
+  }
+
+  /* Received frame is an ARP request */
+
+  memcpy(&dia.s_addr, frame->arp.arp_tpa, 4);
+
+  LOG(LOG_DEBUG, "Received ARP request for %s on iface %s", dia, ifname);
+  PROBE(request__receive, dia.s_addr, sia.s_addr, ifs->sll_ifindex);
+
+  /* the sender cannot be behind this interface (probes come from 0.0.0.0) */
+  if (sia.s_addr != 0 && !sender_in_scope) {
+    LOG(LOG_DEBUG, "Request from %s on iface %s out of scope, dropped", sia, ifname);
+    return;
+  }
+
+  /* a flooding sender costs neither relays nor queue entries */
+  if (limit.rate > 0 &&
+      !rate_limiter.allow(ifs->sll_ifindex, frame->arp.arp_sha, sia, limit, clock.now())) {
+    stats.rate_limited++;
+    LOG(LOG_DEBUG, "Request from %s on iface %s rate limited, dropped", sia, ifname);
+    return;
+  }
+
+  if (memcmp(&dia, &sia, sizeof(dia)) && dia.s_addr != 0) {
+    /* all other interfaces of the group the target may be behind */
+    auto relay_to = [&](const iface *it) {
+      return it->group == group && strcmp(it->name, ifname) && it->scope.contains(dia);
+    };
+
+    pthread_mutex_lock(&arptab_mutex);
+    pthread_rwlock_rdlock(&ifaces_lock);
+    bool relayable = std::any_of(ifaces.begin(), ifaces.end(), relay_to);
+    pthread_rwlock_unlock(&ifaces_lock);
+
+    /* Add the request to the ones for its target, unless nobody can answer
+     * it; the target is asked for once for all of them */
+    if (relayable) {
+      LOG(LOG_DEBUG, "Adding %s to request queue", sia);
+    }
+    if (relayable && rq_add(frame, ifs, group, clock.now())) {
+      pthread_rwlock_rdlock(&ifaces_lock);
+      for (const auto *it : ifaces) {
+        if (relay_to(it)) {
+          arp_req(it->name, dia, false, context);
+        }
+      }
+      pthread_rwlock_unlock(&ifaces_lock);
+    }
+    pthread_mutex_unlock(&arptab_mutex);
+  }
+}
+
+void arp_batch_add(arp_batch &batch, arp_event *ev) {
+  if (ev->frame.arp.arp_op == htons(ARPOP_REPLY)) {
+    batch.queued[ARP_CLASS_REPLY].push_back(ev);
+  } else if (ev->frame.arp.arp_op == htons(ARPOP_REQUEST)) {
+    batch.queued[ARP_CLASS_REQUEST].push_back(ev);
+  }
 }
 
-void *arp_thread(const char *ifname, FileSystem &fileSystem, Context &context) {
-  int sock, i;
+void arp_batch_run(arp_batch &batch, FileSystem &fileSystem, Context &context, Clock &clock) {
+  for (int cls = 0; cls < ARP_CLASSES; cls++) {
+    auto &queued = batch.queued[cls];
+    unsigned long depth = queued.size();
+    auto &peak = stats.waiting_peak[cls];
+    for (unsigned long cur = peak.load(); depth > cur && !peak.compare_exchange_weak(cur, depth);) {
+    }
+    for (auto *ev : queued) {
+      arp_handle_frame(&ev->frame, &ev->ifs, ev->ifname, fileSystem, context, clock);
+    }
+    stats.frames[cls] += depth;
+    queued.clear();
+  }
+}
+
+/* Join the PACKET_FANOUT group of the interface so that option_workers
+ * sockets share its traffic. Frames are spread by ARP sender IP, which
+ * keeps all frames of one host on the same worker and in order. */
+
+static int join_fanout(int sock, int group, const char *ifname) {
+  /* the fanout program sees the frame from the network header on: load
+   * arp_spa (offset 14 in struct ether_arp), kernel takes it modulo workers */
+  static struct sock_filter spa_hash[] = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 14),
+      BPF_STMT(BPF_RET | BPF_A, 0),
+  };
+  struct sock_fprog prog = {sizeof(spa_hash) / sizeof(spa_hash[0]), spa_hash};
+  int arg = group | PACKET_FANOUT_CBPF << 16;
+
+  if (setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == 0) {
+    if (setsockopt(sock, SOL_PACKET, PACKET_FANOUT_DATA, &prog, sizeof(prog)) == 0) {
+      return 0;
+    }
+    syslog(LOG_ERR, "error: PACKET_FANOUT_DATA for %s: %s", ifname, strerror(errno));
+    return -1;
+  }
+
+  /* kernels before 4.3: flow hash, still stable per sender */
+  arg = group | PACKET_FANOUT_HASH << 16;
+  if (setsockopt(sock, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+    syslog(LOG_ERR, "error: PACKET_FANOUT for %s: %s", ifname, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+void *arp_thread(std::stop_token stop, const char *ifname, int inherited, FileSystem &fileSystem,
+                 Context &context, Clock &clock) {
+  int sock;
   struct sockaddr_ll ifs;
   struct ifreq ifr;
+  struct timeval timeout = {1, 0};
 
   pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
   pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
-  sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP));
+  /* after a handover, the previous instance's socket is taken over as it
+   * is: bound and in its fanout group */
+  sock = inherited >= 0 ? inherited : socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ARP));
 
   if (sock == -1) {
     fprintf(stderr, "Socket error %d.\n", errno);
     exit(1);
   }
 
+  /* wake up regularly to notice when the interface is detached */
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  /* The interface may vanish again before we get here: give up quietly,
+   * the link monitor restarts us when it comes back */
+
   /* Get the hwaddr and ifindex of the interface */
   memset(ifr.ifr_name, 0, IFNAMSIZ);
   strncpy(ifr.ifr_name, ifname, IFNAMSIZ);
   if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0) {
     syslog(LOG_ERR, "error: ioctl SIOCGIFHWADDR for %s: %s\n", ifname, strerror(errno));
-    abort();
+    close(sock);
+    return NULL;
   }
 
   memset(ifs.sll_addr, 0, ETH_ALEN);
@@ -338,7 +808,8 @@ void *arp_thread(const char *ifname, FileSystem &fileSystem, Context &context) {
 
   if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
     syslog(LOG_ERR, "error: ioctl SIOCGIFINDEX for %s: %s", ifname, strerror(errno));
-    abort();
+    close(sock);
+    return NULL;
   }
 
   ifs.sll_family = AF_PACKET;
@@ -348,100 +819,211 @@ void *arp_thread(const char *ifname, FileSystem &fileSystem, Context &context) {
   ifs.sll_pkttype = PACKET_BROADCAST;
   ifs.sll_halen = ETH_ALEN;
 
-  if (bind(sock, (struct sockaddr *)&ifs, sizeof(struct sockaddr_ll)) < 0) {
-    fprintf(stderr, "Bind %s: %d\n", ifname, errno);
-    abort();
+  if (inherited < 0 && bind(sock, (struct sockaddr *)&ifs, sizeof(struct sockaddr_ll)) < 0) {
+    syslog(LOG_ERR, "error: bind %s: %s", ifname, strerror(errno));
+    close(sock);
+    return NULL;
   }
 
-  while (true) {
-    ether_arp_frame frame;
-    struct in_addr sia;
-    struct in_addr dia;
+  if (inherited < 0 && option_workers > 1 &&
+      join_fanout(sock, (fanout_seed ^ ifs.sll_ifindex) & 0xffff, ifname) < 0) {
+    close(sock);
+    return NULL;
+  }
+  handover_register(HANDOVER_ARP, ifname, sock);
+  actor_ring *ring = option_actor ? actor_open() : NULL;
+  std::vector<arp_event> events(ARP_BATCH);
+  arp_batch batch;
+
+  for (auto &ev : events) {
+    ev.ifs = ifs;
+    strncpy(ev.ifname, ifname, IFNAMSIZ - 1);
+  }
 
-    do {
-      pthread_testcancel();
-      /* Sleep a bit in order not to overload the system */
-      usleep(300);
+  while (!stop.stop_requested()) {
+    pthread_testcancel();
+    /* Sleep a bit in order not to overload the system */
+    clock.sleep_for(std::chrono::microseconds(300));
+    if (!handover_recv_begin()) {
+      continue;
+    }
 
-      if (arp_recv(sock, &frame) <= 0) {
-        continue;
+    /* what arrived meanwhile, waiting for the first frame only */
+    for (size_t n = 0;
+         n < events.size() && arp_recv(sock, &events[n].frame, n > 0 ? MSG_DONTWAIT : 0) > 0;
+         n++) {
+      if (ring != NULL) {
+        actor_push(ring, &events[n].frame, &ifs, ifname);
+      } else {
+        arp_batch_add(batch, &events[n]);
       }
-      /* Insert all the replies into ARP table */
-      if (frame.arp.arp_op == ntohs(ARPOP_REPLY)) {
+    }
+    arp_batch_run(batch, fileSystem, context, clock);
+    handover_recv_end();
+  }
 
-        /* Received frame is an ARP reply */
+  if (ring != NULL) {
+    actor_close(ring);
+  }
+  handover_unregister(sock);
+  close(sock);
+  return NULL;
+}
 
-        struct arpreq k_arpreq;
-        int arpsock;
-        struct sockaddr_in *sin;
+/* Find the trunk member for a VLAN and its link address, returns false if
+ * the VLAN has no attached sub-interface */
+
+static bool trunk_member(int trunk, uint16_t vid, char *ifname, struct sockaddr_ll *ifs) {
+  bool found = false;
+
+  pthread_rwlock_rdlock(&ifaces_lock);
+  for (const auto *it : ifaces) {
+    if (it->vlan.trunk == trunk && it->vlan.vid == vid) {
+      strncpy(ifname, it->name, IFNAMSIZ);
+      memset(ifs, 0, sizeof(*ifs));
+      ifs->sll_family = AF_PACKET;
+      ifs->sll_protocol = htons(ETH_P_ARP);
+      ifs->sll_ifindex = it->vlan.ifindex;
+      ifs->sll_hatype = ARPHRD_ETHER;
+      ifs->sll_pkttype = PACKET_BROADCAST;
+      ifs->sll_halen = ETH_ALEN;
+      memcpy(ifs->sll_addr, it->vlan.hwaddr, ETH_ALEN);
+      found = true;
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&ifaces_lock);
+  return found;
+}
 
-        if ((arpsock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-          syslog(LOG_ERR, "error: ARP socket for %s: %s", ifname, strerror(errno));
-          continue;
-        }
+/* Read a tagged frame from the trunk socket into ev, with the VLAN's
+ * sub-interface; -1 if there is none to read, 0 if the frame is ignored */
 
-        k_arpreq.arp_ha.sa_family = ARPHRD_ETHER;
-        memcpy(&k_arpreq.arp_ha.sa_data, &frame.arp.arp_sha, sizeof(frame.arp.arp_sha));
-        k_arpreq.arp_flags = ATF_COM;
-        if (option_arpperm) {
-          k_arpreq.arp_flags = k_arpreq.arp_flags | ATF_PERM;
-        }
-        strncpy(k_arpreq.arp_dev, ifname, sizeof(k_arpreq.arp_dev));
+static int trunk_recv(int sock, int trunk, const char *ifname, arp_event &ev, int flags) {
+  char cmsgbuf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+  struct iovec iov = {&ev.frame, sizeof(ev.frame)};
+  struct msghdr msg = {};
+  struct cmsghdr *cmsg;
+  int vid = -1;
 
-        k_arpreq.arp_pa.sa_family = AF_INET;
-        sin = (struct sockaddr_in *)&k_arpreq.arp_pa;
-        memcpy(&sin->sin_addr.s_addr, &frame.arp.arp_spa, sizeof(sin->sin_addr));
+  memset(&ev.frame, 0, sizeof(ev.frame));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsgbuf;
+  msg.msg_controllen = sizeof(cmsgbuf);
 
-        /* Update kernel ARP table with the data from reply */
+  ssize_t len = recvmsg(sock, &msg, flags);
+  if (len < 0) {
+    return -1;
+  }
+  if (len < static_cast<ssize_t>(sizeof(ev.frame))) {
+    return 0;
+  }
 
-        if (debug) {
-          printf("Received reply: updating kernel ARP table for %s(%s).\n",
-                 inet_ntoa(sin->sin_addr), ifname);
-        }
-        if (ioctl(arpsock, SIOCSARP, &k_arpreq) < 0) {
-          syslog(LOG_ERR, "error: ioctl SIOCSARP for %s(%s): %s", inet_ntoa(sin->sin_addr), ifname,
-                 strerror(errno));
-          close(arpsock);
-          continue;
-        }
-        close(arpsock);
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_PACKET && cmsg->cmsg_type == PACKET_AUXDATA) {
+      struct tpacket_auxdata aux;
+      memcpy(&aux, CMSG_DATA(cmsg), sizeof(aux));
+      if (aux.tp_status & TP_STATUS_VLAN_VALID) {
+        vid = aux.tp_vlan_tci & 0x0fff;
+      }
+    }
+  }
 
-        /* Check if reply is for one of the requests in request queue */
-        rq_process(sin->sin_addr, ifs.sll_ifindex, fileSystem, context);
+  if (vid < 0 || !trunk_member(trunk, static_cast<uint16_t>(vid), ev.ifname, &ev.ifs)) {
+    LOG(LOG_TRACE, "ARP on %s for VLAN %d without sub-interface, ignored", ifname, vid);
+    return 0;
+  }
+  return 1;
+}
 
-        /* send gratuitous arp request to all other interfaces to let them
-         * update their ARP tables quickly */
-        for (i = 0; i <= last_iface_idx; i++) {
-          if (strcmp(ifaces[i], ifname)) {
-            arp_req(ifaces[i], sin->sin_addr, true, context);
-          }
-        }
-      }
-    } while (frame.arp.arp_op != htons(ARPOP_REQUEST));
+/* Receive the tagged ARP traffic of all VLANs of a trunk on one socket.
+ *
+ * The kernel strips the tag before packet taps see the frame, so the
+ * socket listens for all protocols on the parent and a filter keeps the
+ * incoming frames that carried a tag and are ARP; the VLAN id comes with
+ * PACKET_AUXDATA. Each frame is handled as if received on the VLAN's
+ * sub-interface, so arptab entries and queued requests stay per VLAN, and
+ * replies and relays go out through the sub-interface, which tags them. */
+
+void *trunk_thread(std::stop_token stop, const char *ifname, int inherited,
+                   FileSystem &fileSystem, Context &context, Clock &clock) {
+  static struct sock_filter tagged_arp[] = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<__u32>(SKF_AD_OFF + SKF_AD_PKTTYPE)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 4, 0),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<__u32>(SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 2, 0),
+      BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12), /* ether_type */
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_ARP, 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+      BPF_STMT(BPF_RET | BPF_K, sizeof(ether_arp_frame)),
+  };
+  struct sock_fprog prog = {sizeof(tagged_arp) / sizeof(tagged_arp[0]), tagged_arp};
+  struct sockaddr_ll trunk = {};
+  struct timeval timeout = {1, 0};
+  int on = 1;
+  int sock;
 
-    /* Received frame is an ARP request */
+  if ((sock = inherited >= 0 ? inherited
+                             : socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL))) < 0) {
+    syslog(LOG_ERR, "error: trunk socket for %s: %s", ifname, strerror(errno));
+    return NULL;
+  }
 
-    memcpy(&sia.s_addr, frame.arp.arp_spa, 4);
-    memcpy(&dia.s_addr, frame.arp.arp_tpa, 4);
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  trunk.sll_family = AF_PACKET;
+  trunk.sll_protocol = htons(ETH_P_ALL);
+  if ((trunk.sll_ifindex = static_cast<int>(if_nametoindex(ifname))) == 0 ||
+      (inherited < 0 && (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0 ||
+                         setsockopt(sock, SOL_PACKET, PACKET_AUXDATA, &on, sizeof(on)) < 0 ||
+                         bind(sock, (struct sockaddr *)&trunk, sizeof(trunk)) < 0))) {
+    syslog(LOG_ERR, "error: trunk %s: %s", ifname, strerror(errno));
+    close(sock);
+    return NULL;
+  }
 
-    if (debug) {
-      printf("Received ARP request for %s on iface %s\n", inet_ntoa(dia), ifname);
+  if (inherited < 0 && option_workers > 1 &&
+      join_fanout(sock, (fanout_seed ^ trunk.sll_ifindex ^ 0x8000) & 0xffff, ifname) < 0) {
+    close(sock);
+    return NULL;
+  }
+  handover_register(HANDOVER_TRUNK, ifname, sock);
+  actor_ring *ring = option_actor ? actor_open() : NULL;
+  std::vector<arp_event> events(ARP_BATCH);
+  arp_batch batch;
+
+  while (!stop.stop_requested()) {
+    if (!handover_recv_begin()) {
+      clock.sleep_for(std::chrono::milliseconds(10));
+      continue;
     }
-
-    if (memcmp(&dia, &sia, sizeof(dia)) && dia.s_addr != 0) {
-      pthread_mutex_lock(&arptab_mutex);
-      /* Relay the ARP request to all other interfaces */
-      for (i = 0; i <= last_iface_idx; i++) {
-        if (strcmp(ifaces[i], ifname)) {
-          arp_req(ifaces[i], dia, false, context);
-        }
+    /* a batch of the VLANs' frames, waiting for the first one only */
+    size_t n = 0;
+    for (size_t reads = 0; reads < events.size(); reads++) {
+      int got =
+          trunk_recv(sock, trunk.sll_ifindex, ifname, events[n], reads > 0 ? MSG_DONTWAIT : 0);
+      if (got < 0) {
+        break;
       }
-      /* Add the request to the request queue */
-      if (debug) {
-        printf("Adding %s to request queue\n", inet_ntoa(sia));
+      if (got == 0) {
+        continue;
       }
-      rq_add(&frame, &ifs);
-      pthread_mutex_unlock(&arptab_mutex);
+      if (ring != NULL) {
+        actor_push(ring, &events[n].frame, &events[n].ifs, events[n].ifname);
+      } else {
+        arp_batch_add(batch, &events[n]);
+      }
+      n++;
     }
+    arp_batch_run(batch, fileSystem, context, clock);
+    handover_recv_end();
+  }
+
+  if (ring != NULL) {
+    actor_close(ring);
   }
+  handover_unregister(sock);
+  close(sock);
+  return NULL;
 }
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <trompeloeil.hpp>
+
+#include "clock.h"
+
+struct ClockMock : trompeloeil::mock_interface<Clock> {
+  IMPLEMENT_MOCK0(now);
+  IMPLEMENT_MOCK1(sleep_for);
+};
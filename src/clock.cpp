@@ -0,0 +1,45 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "clock.h"
+
+#include <ctime>
+
+namespace {
+
+class ClockImpl final : public Clock {
+  time_point now() override {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return time_point(std::chrono::duration_cast<time_point::duration>(
+        std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+  }
+
+  void sleep_for(std::chrono::microseconds duration) override {
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(duration);
+    struct timespec ts {
+      secs.count(), std::chrono::duration_cast<std::chrono::nanoseconds>(duration - secs).count()
+    };
+    /* like usleep(), return early on signals so shutdown is not delayed */
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+  }
+};
+
+} // namespace
+
+std::unique_ptr<Clock> makeClock() { return std::make_unique<ClockImpl>(); };
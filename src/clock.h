@@ -0,0 +1,33 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+
+/* Monotonic time source; immune to wall clock steps (NTP, date) */
+struct Clock {
+  using time_point = std::chrono::steady_clock::time_point;
+
+  virtual time_point now() = 0;
+  virtual void sleep_for(std::chrono::microseconds duration) = 0;
+  virtual ~Clock() = default;
+};
+
+std::unique_ptr<Clock> makeClock();
@@ -0,0 +1,186 @@
+#include <catch2/catch.hpp>
+
+#include "config.h"
+
+#include <cstdlib>
+
+namespace {
+
+using namespace std::string_literals;
+
+constexpr const char *TAGS = "config";
+
+/* A configuration file with the given content, removed at the end */
+struct TempFile {
+  char path[32] = "/tmp/parprouted-testXXXXXX";
+  explicit TempFile(const char *content) {
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, content, strlen(content)) == static_cast<ssize_t>(strlen(content)));
+    close(fd);
+  }
+  ~TempFile() { unlink(path); }
+};
+
+TEST_CASE("config-test", TAGS) {
+  config cfg;
+  std::string error;
+
+  SECTION("keywords") {
+    GIVEN("valid values") {
+      CHECK(config_set(cfg, "interface", "eth0"));
+      CHECK(config_set(cfg, "group", "guest"));
+      CHECK(config_set(cfg, "interface", "wlan*"));
+      CHECK(config_set(cfg, "trunk", "eth1"));
+      CHECK(config_set(cfg, "scope", "eth0:10.0.0.0/8"));
+      CHECK(config_set(cfg, "rate", "wlan*:5/20"));
+      CHECK(config_set(cfg, "policy", "wlan*:timeout=20,pace=5"));
+      CHECK(config_set(cfg, "timeout", "120"));
+      CHECK(config_set(cfg, "refresh", "30"));
+      CHECK(config_set(cfg, "poll", "500"));
+      CHECK(config_set(cfg, "poll-min", "100"));
+      CHECK(config_set(cfg, "poll-max", "8000"));
+      CHECK(config_set(cfg, "sweep", "500"));
+      CHECK(config_set(cfg, "sweep-time", "30"));
+      CHECK(config_set(cfg, "queue", "200"));
+      CHECK(config_set(cfg, "control", "/run/parprouted.sock"));
+      CHECK(config_set(cfg, "max-entries", "0"));
+      CHECK(config_set(cfg, "table", "100:99"));
+      THEN("they are set, interfaces in the group given before") {
+        REQUIRE(cfg.iface_patterns.size() == 2);
+        CHECK(cfg.iface_patterns[0].group == 0);
+        CHECK(cfg.iface_patterns[1].pattern == "wlan*");
+        CHECK(cfg.iface_patterns[1].group == 1);
+        CHECK(cfg.trunk_patterns[0].group == 1);
+        CHECK(cfg.group_names == std::vector<std::string>{"", "guest"});
+        CHECK(cfg.scope_rules.size() == 1);
+        CHECK(cfg.rate_rules.size() == 1);
+        CHECK(cfg.policy_rules.size() == 1);
+        CHECK(cfg.entry_timeout == 120);
+        CHECK(cfg.refresh_time == 30);
+        CHECK(cfg.poll_time == 500);
+        CHECK(cfg.poll_min == 100);
+        CHECK(cfg.poll_max == 8000);
+        CHECK(cfg.sweep_rate == 500);
+        CHECK(cfg.sweep_time == 30);
+        CHECK(cfg.queue_size == 200);
+        CHECK(cfg.control == "/run/parprouted.sock");
+        CHECK(cfg.max_entries == 0);
+        CHECK(cfg.route_table == 100);
+        CHECK(cfg.route_proto == 99);
+      }
+    }
+    GIVEN("invalid values or keywords") {
+      THEN("they are refused") {
+        CHECK(!config_set(cfg, "timeout", "0"));
+        CHECK(!config_set(cfg, "timeout", "60s"));
+        CHECK(!config_set(cfg, "poll", "1"));
+        CHECK(!config_set(cfg, "poll-max", "600000"));
+        CHECK(!config_set(cfg, "sweep-time", "0"));
+        CHECK(!config_set(cfg, "workers", "0"));
+        CHECK(!config_set(cfg, "scope", "eth0"));
+        CHECK(!config_set(cfg, "policy", "eth0:ttl=5"));
+        CHECK(!config_set(cfg, "table", "100:300"));
+        CHECK(!config_set(cfg, "interfaces", "eth0"));
+      }
+    }
+  }
+
+  SECTION("command line and file") {
+    GIVEN("a configuration file") {
+      TempFile file("# proxy between the wired and the wireless side\n"
+                    "\n"
+                    "interface eth0\n"
+                    "group guest   # isolated\n"
+                    "interface wlan1\n"
+                    "timeout 90\n");
+      char *argv[] = {const_cast<char *>("parprouted"), const_cast<char *>("-d"),
+                      const_cast<char *>("-c"),         file.path,
+                      const_cast<char *>("wlan0"),      const_cast<char *>("-f"),
+                      const_cast<char *>("2")};
+      REQUIRE(config_args(cfg, 7, argv, error));
+      THEN("it is read where -c is given") {
+        CHECK(cfg.debug);
+        CHECK(cfg.file == file.path);
+        REQUIRE(cfg.iface_patterns.size() == 3);
+        CHECK(cfg.iface_patterns[0].pattern == "eth0");
+        CHECK(cfg.iface_patterns[2].pattern == "wlan0");
+        CHECK(cfg.iface_patterns[2].group == 1);
+        CHECK(cfg.entry_timeout == 90);
+        CHECK(cfg.workers == 2);
+      }
+    }
+    GIVEN("an invalid line") {
+      TempFile file("interface eth0\nqueue many\n");
+      THEN("the file is refused, telling where") {
+        CHECK(!config_load(cfg, file.path, error));
+        CHECK(error == file.path + ":2: invalid queue"s);
+      }
+    }
+    GIVEN("a missing file") {
+      THEN("it is refused") {
+        CHECK(!config_load(cfg, "/nonexistent/parprouted.conf", error));
+        CHECK(!error.empty());
+      }
+    }
+    GIVEN("an invalid switch value") {
+      char *argv[] = {const_cast<char *>("parprouted"), const_cast<char *>("-s"),
+                      const_cast<char *>("eth0:10.0.0.0/33"), const_cast<char *>("eth0")};
+      THEN("the command line is refused") {
+        CHECK(!config_args(cfg, 4, argv, error));
+        CHECK(error == "invalid scope eth0:10.0.0.0/33");
+      }
+    }
+  }
+
+  SECTION("reload") {
+    while (arptab != nullptr) {
+      delete std::exchange(arptab, arptab->next);
+    }
+    arptab_len = 0;
+    group_names = {"", "lab", "guest"};
+    for (uint32_t ip = 0x0a000001; ip <= 0x0a000004; ip++) {
+      replace_entry(in_addr{htonl(ip)}, "eth0")->ipaddr_ia = in_addr{htonl(ip)};
+    }
+    auto *it = iface_add("eth0");
+
+    GIVEN("a new configuration") {
+      config_set(cfg, "interface", "eth0");
+      config_set(cfg, "group", "guest");
+      config_set(cfg, "interface", "wlan*");
+      config_set(cfg, "scope", "eth0:10.0.0.0/8");
+      config_set(cfg, "rate", "eth*:5");
+      config_set(cfg, "max-entries", "2");
+      config_set(cfg, "queue", "10");
+      config_set(cfg, "timeout", "30");
+      config_apply(cfg, true);
+      THEN("groups keep their index") {
+        CHECK(group_names.size() == 3);
+        REQUIRE(iface_patterns.size() == 2);
+        CHECK(iface_patterns[1].group == 2);
+      }
+      THEN("attached interfaces get the new scope and limit") {
+        CHECK(it->scope.contains(in_addr{htonl(0x0a000001)}));
+        CHECK(!it->scope.contains(in_addr{htonl(0x0b000001)}));
+        CHECK(it->limit.rate == 5);
+      }
+      THEN("the table shrinks to the new limit, the rest stays") {
+        CHECK(arptab_len == 2);
+      }
+      THEN("timeouts and sizes are set") {
+        CHECK(option_entry_timeout == 30);
+        CHECK(option_queue_size == 10);
+      }
+    }
+
+    delete iface_remove("eth0");
+    while (arptab != nullptr) {
+      delete std::exchange(arptab, arptab->next);
+    }
+    arptab_len = 0;
+    config_apply(config{}, true);
+    group_names = {""};
+  }
+}
+
+} // namespace
@@ -0,0 +1,303 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* Configuration from the command line and the configuration file.
+ *
+ * Both set the same keywords; the command line switches are short for
+ * them. On SIGHUP both are read again into a fresh config and applied in
+ * place: the patterns, scopes and rate limits are swapped under
+ * ifaces_lock, the timeouts and sizes are set under arptab_mutex, and the
+ * link monitor dumps the links again to attach and detach interfaces
+ * whose status changed. arptab, the request queue and the routes of the
+ * interfaces that stay are left alone. */
+
+#include "config.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "handover.h"
+#include "xdp.h"
+
+namespace {
+
+/* Command line switches taking a value, and their keywords */
+const struct {
+  const char *flag;
+  const char *key;
+} switches[] = {
+    {"-f", "workers"}, {"-m", "max-entries"}, {"-t", "table"}, {"-T", "trunk"},
+    {"-g", "group"},   {"-r", "rate"},        {"-s", "scope"}, {"-C", "control"},
+};
+
+const char *switch_key(const char *flag) {
+  for (const auto &it : switches) {
+    if (strcmp(it.flag, flag) == 0) {
+      return it.key;
+    }
+  }
+  return NULL;
+}
+
+bool number(const char *value, long min, long max, int &out) {
+  char *end;
+  long n = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || n < min || n > max) {
+    return false;
+  }
+  out = static_cast<int>(n);
+  return true;
+}
+
+/* "table[:protocol]" */
+bool table_parse(const char *value, config &cfg) {
+  char *end;
+  unsigned long table = strtoul(value, &end, 10);
+  long proto = *end == ':' ? strtol(end + 1, &end, 10) : 0;
+  if (end == value || *end != '\0' || table == 0 || table > UINT32_MAX || proto < 0 ||
+      proto > 255) {
+    return false;
+  }
+  cfg.route_table = static_cast<uint32_t>(table);
+  cfg.route_proto = static_cast<int>(proto);
+  return true;
+}
+
+} // namespace
+
+bool config_set(config &cfg, const char *key, const char *value) {
+  if (!strcmp(key, "interface")) {
+    cfg.iface_patterns.push_back({value, cfg.group});
+  } else if (!strcmp(key, "trunk")) {
+    cfg.trunk_patterns.push_back({value, cfg.group});
+  } else if (!strcmp(key, "group")) {
+    /* the interfaces and trunks that follow form a bridge group */
+    auto pos = std::find(cfg.group_names.begin(), cfg.group_names.end(), value);
+    cfg.group = static_cast<int>(pos - cfg.group_names.begin());
+    if (pos == cfg.group_names.end()) {
+      cfg.group_names.emplace_back(value);
+    }
+  } else if (!strcmp(key, "scope")) {
+    scope_rule rule;
+    if (!scope_parse(value, rule)) {
+      return false;
+    }
+    cfg.scope_rules.push_back(rule);
+  } else if (!strcmp(key, "rate")) {
+    rate_rule rule;
+    if (!rate_parse(value, rule)) {
+      return false;
+    }
+    cfg.rate_rules.push_back(rule);
+  } else if (!strcmp(key, "policy")) {
+    policy_rule rule;
+    if (!policy_parse(value, rule)) {
+      return false;
+    }
+    cfg.policy_rules.push_back(rule);
+  } else if (!strcmp(key, "workers")) {
+    return number(value, 1, MAX_WORKERS, cfg.workers);
+  } else if (!strcmp(key, "max-entries")) {
+    return number(value, 0, INT_MAX, cfg.max_entries);
+  } else if (!strcmp(key, "table")) {
+    return table_parse(value, cfg);
+  } else if (!strcmp(key, "timeout")) {
+    return number(value, 1, INT_MAX, cfg.entry_timeout);
+  } else if (!strcmp(key, "refresh")) {
+    return number(value, 1, INT_MAX, cfg.refresh_time);
+  } else if (!strcmp(key, "poll")) {
+    return number(value, 10, 60000, cfg.poll_time);
+  } else if (!strcmp(key, "poll-min")) {
+    return number(value, 10, 60000, cfg.poll_min);
+  } else if (!strcmp(key, "poll-max")) {
+    return number(value, 10, 60000, cfg.poll_max);
+  } else if (!strcmp(key, "sweep")) {
+    return number(value, 0, 100000, cfg.sweep_rate);
+  } else if (!strcmp(key, "sweep-time")) {
+    return number(value, 1, 3600, cfg.sweep_time);
+  } else if (!strcmp(key, "queue")) {
+    return number(value, 1, 100000, cfg.queue_size);
+  } else if (!strcmp(key, "control")) {
+    cfg.control = value;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool config_load(config &cfg, const char *path, std::string &error) {
+  const char *delim = " \t\r\n";
+  char line[256];
+  int lineno = 0;
+  bool ok = true;
+  FILE *f;
+
+  if ((f = fopen(path, "r")) == NULL) {
+    error = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+
+  while (ok && fgets(line, sizeof(line), f) != NULL) {
+    char *save;
+    lineno++;
+    if (char *comment = strchr(line, '#')) {
+      *comment = '\0';
+    }
+    char *key = strtok_r(line, delim, &save);
+    if (key == NULL) {
+      continue;
+    }
+    char *value = strtok_r(NULL, delim, &save);
+    if (value == NULL || strtok_r(NULL, delim, &save) != NULL || !config_set(cfg, key, value)) {
+      error = std::string(path) + ":" + std::to_string(lineno) + ": invalid " + key;
+      ok = false;
+    }
+  }
+
+  fclose(f);
+  return ok;
+}
+
+bool config_args(config &cfg, int argc, char **argv, std::string &error) {
+  const char *key;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-d")) {
+      cfg.debug = true;
+    } else if (!strcmp(argv[i], "-p")) {
+      cfg.arpperm = true;
+    } else if (!strcmp(argv[i], "-a")) {
+      cfg.actor = true;
+    } else if (!strcmp(argv[i], "-x")) {
+      cfg.xdp = true;
+    } else if (!strcmp(argv[i], "-v")) {
+      cfg.verbosity++;
+    } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      cfg.help = true;
+      return false;
+    } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+      cfg.file = argv[++i];
+      if (!config_load(cfg, argv[i], error)) {
+        return false;
+      }
+    } else if ((key = switch_key(argv[i])) != NULL && i + 1 < argc) {
+      if (!config_set(cfg, key, argv[++i])) {
+        error = std::string("invalid ") + key + " " + argv[i];
+        return false;
+      }
+    } else {
+      config_set(cfg, "interface", argv[i]);
+    }
+  }
+  return true;
+}
+
+void config_apply(const config &cfg, bool reload) {
+  std::vector<int> groups;
+
+  pthread_rwlock_wrlock(&ifaces_lock);
+  /* groups are known by name, a group keeps its index across reloads */
+  for (const auto &name : cfg.group_names) {
+    auto pos = std::find(group_names.begin(), group_names.end(), name);
+    groups.push_back(static_cast<int>(pos - group_names.begin()));
+    if (pos == group_names.end()) {
+      group_names.push_back(name);
+    }
+  }
+  iface_patterns.clear();
+  for (const auto &it : cfg.iface_patterns) {
+    iface_patterns.push_back({it.pattern, groups[static_cast<size_t>(it.group)]});
+  }
+  trunk_patterns.clear();
+  for (const auto &it : cfg.trunk_patterns) {
+    trunk_patterns.push_back({it.pattern, groups[static_cast<size_t>(it.group)]});
+  }
+  scope_rules = cfg.scope_rules;
+  rate_rules = cfg.rate_rules;
+  policy_rules = cfg.policy_rules;
+  /* the policies start from these */
+  option_entry_timeout = cfg.entry_timeout;
+  option_refresh_time = cfg.refresh_time;
+  for (auto *it : ifaces) {
+    it->scope = Scope{};
+    scope_build(it->name, it->scope);
+    it->limit = rate_lookup(it->name);
+    it->policy = policy_lookup(it->name, policy_defaults());
+    if (option_xdp) {
+      xdp_attach(it);
+    }
+  }
+  pthread_rwlock_unlock(&ifaces_lock);
+
+  option_max_entries = cfg.max_entries;
+  option_poll_time = cfg.poll_time;
+  option_poll_min = cfg.poll_min;
+  option_poll_max = cfg.poll_max;
+  option_sweep_rate = cfg.sweep_rate;
+  option_sweep_time = cfg.sweep_time;
+
+  if (!reload) {
+    debug = cfg.debug;
+    option_arpperm = cfg.arpperm;
+    option_actor = cfg.actor;
+    option_xdp = cfg.xdp;
+    log_level = std::min((debug ? LOG_DEBUG : LOG_INFO) + cfg.verbosity, LOG_TRACE);
+    option_queue_size = cfg.queue_size;
+    option_workers = cfg.workers;
+    option_route_table = cfg.route_table;
+    option_route_proto = cfg.route_proto;
+    option_control = cfg.control;
+    return;
+  }
+
+  pthread_mutex_lock(&req_queue_mutex);
+  option_queue_size = cfg.queue_size;
+  pthread_mutex_unlock(&req_queue_mutex);
+
+  /* the new limit is kept from now on, entries over it go at once */
+  arptab_trim();
+
+  /* sockets and routes were set up with these */
+  if (cfg.workers != option_workers || cfg.route_table != option_route_table ||
+      cfg.route_proto != option_route_proto || cfg.actor != option_actor ||
+      cfg.control != option_control || cfg.xdp != option_xdp) {
+    syslog(LOG_WARNING, "Workers, actor mode, routing table, control socket and XDP are changed "
+                        "on restart only.");
+  }
+}
+
+bool config_reload() {
+  config cfg;
+  std::string error;
+  int argc = 0;
+
+  while (handover_argv[argc] != NULL) {
+    argc++;
+  }
+  if (!config_args(cfg, argc, handover_argv, error) ||
+      (cfg.iface_patterns.empty() && cfg.trunk_patterns.empty())) {
+    syslog(LOG_ERR, "error: reload: %s, configuration unchanged",
+           error.empty() ? "no interfaces" : error.c_str());
+    return false;
+  }
+
+  config_apply(cfg, true);
+  link_resync();
+  syslog(LOG_INFO, "Configuration reloaded.");
+  return true;
+}
@@ -0,0 +1,78 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include "parprouted.h"
+
+#include <string>
+#include <vector>
+
+/* Everything that can be configured, from the command line and the
+ * configuration file (-c). Built from scratch at startup and on every
+ * SIGHUP, then applied with config_apply(). */
+struct config {
+  bool debug = false;
+  bool arpperm = false;
+  bool actor = false;  /* -a */
+  bool xdp = false;    /* -x */
+  int verbosity = 0;   /* -v given this often */
+  bool help = false;   /* -h */
+  std::string file;    /* -c, "" = none */
+  int group = 0;       /* group of the interfaces that follow */
+  std::vector<std::string> group_names{""};
+  std::vector<iface_pattern> iface_patterns;
+  std::vector<iface_pattern> trunk_patterns;
+  std::vector<scope_rule> scope_rules;
+  std::vector<rate_rule> rate_rules;
+  std::vector<policy_rule> policy_rules;
+  int workers = 1;
+  int max_entries = ARPTAB_MAX_ENTRIES;
+  uint32_t route_table = ROUTE_TABLE_MAIN;
+  int route_proto = 0;
+  int entry_timeout = ARP_TABLE_ENTRY_TIMEOUT;
+  int refresh_time = REFRESHTIME;
+  int poll_time = SLEEPTIME / 1000;
+  int poll_min = POLL_MIN;
+  int poll_max = POLL_MAX;
+  int sweep_rate = 0;
+  int sweep_time = SWEEP_TIME;
+  int queue_size = MAX_RQ_SIZE;
+  std::string control; /* -C, "" = no control socket */
+};
+
+/* Set a configuration keyword, e.g. "scope" "eth0:10.0.0.0/8"; false if
+ * the keyword is unknown or the value invalid */
+extern bool config_set(config &cfg, const char *key, const char *value);
+
+/* Read the keywords of a configuration file, one per line with its value,
+ * "#" starts a comment. On error, error tells where. */
+extern bool config_load(config &cfg, const char *path, std::string &error);
+
+/* Read the command line, and the configuration file if -c is given where
+ * it is given. Returns false on error or -h. */
+extern bool config_args(config &cfg, int argc, char **argv, std::string &error);
+
+/* Make cfg the running configuration. On reload, arptab and the routes
+ * stay; the caller holds arptab_mutex and resyncs the interfaces. Settings
+ * that only take effect on restart are kept and logged. */
+extern void config_apply(const config &cfg, bool reload);
+
+/* SIGHUP: read the command line and configuration file again and apply
+ * them, the running configuration stays if they are invalid */
+extern bool config_reload();
@@ -0,0 +1,166 @@
+#include "control.h"
+
+#include <catch2/catch.hpp>
+
+#include "clock-mock.h"
+#include "context-mock.h"
+#include "fs-mock.h"
+
+namespace {
+
+using trompeloeil::_;
+using trompeloeil::eq;
+using namespace std::string_literals;
+
+constexpr const char *TAGS = "control";
+
+TEST_CASE("control-test", TAGS) {
+  auto clear = [] {
+    while (arptab != nullptr) {
+      delete std::exchange(arptab, arptab->next);
+    }
+    arptab_len = 0;
+    rq_clear();
+  };
+  auto add = [](const char *ip, const char *dev, Clock::time_point tstamp) {
+    in_addr addr{};
+    inet_pton(AF_INET, ip, &addr);
+    auto *entry = replace_entry(addr, dev);
+    entry->ipaddr_ia = addr;
+    strcpy(entry->ifname, dev);
+    strcpy(entry->hwaddr, "02:00:00:00:00:01");
+    entry->tstamp = tstamp;
+    entry->want_route = entry->route_added = true;
+    return entry;
+  };
+
+  clear();
+  ContextMock context{};
+  ClockMock clock{};
+  auto now = Clock::time_point{std::chrono::hours(24)};
+  ALLOW_CALL(clock, now()).LR_RETURN(now);
+  control_snapshot snap;
+  std::string out;
+  auto command = [&](const char *line) {
+    out.clear();
+    control_command(line, snap, out, context, clock);
+    return out;
+  };
+
+  auto *eth0 = iface_add("eth0");
+  auto *wlan0 = iface_add("wlan0");
+  add("10.0.0.7", "eth0", now - std::chrono::seconds(2));
+
+  SECTION("queries") {
+    ether_arp_frame frame{};
+    frame.arp.arp_op = htons(ARPOP_REQUEST);
+    inet_pton(AF_INET, "10.0.0.1", frame.arp.arp_spa);
+    inet_pton(AF_INET, "10.0.0.9", frame.arp.arp_tpa);
+    memcpy(frame.arp.arp_sha, "\x02\x00\x00\x00\x00\x02", ETH_ALEN);
+    struct sockaddr_ll req_if {};
+    req_if.sll_ifindex = 3;
+    rq_add(&frame, &req_if, 0, now);
+
+    THEN("a host is found by its address") {
+      CHECK(command("where 10.0.0.7") ==
+            "{\"ip\":\"10.0.0.7\",\"hosts\":[{\"ip\":\"10.0.0.7\",\"ifname\":\"eth0\","
+            "\"hwaddr\":\"02:00:00:00:00:01\",\"group\":0,\"age\":2.0,\"incomplete\":false,"
+            "\"want_route\":true,\"route\":true,\"pinned\":false}]}\n");
+      CHECK(command("where 10.0.0.8") == "{\"ip\":\"10.0.0.8\",\"hosts\":[]}\n");
+    }
+    THEN("the dump holds the table and the requests") {
+      auto dump = command("dump");
+      CHECK(dump.starts_with("{\"arptab\":[{\"ip\":\"10.0.0.7\","));
+      CHECK(dump.ends_with("],\"requests\":[{\"target\":\"10.0.0.9\",\"group\":0,"
+                           "\"waiters\":[{\"ip\":\"10.0.0.1\",\"hwaddr\":\"02:00:00:00:00:02\","
+                           "\"ifindex\":3}]}]}\n"));
+    }
+    WHEN("a host appears") {
+      command("where 10.0.0.8");
+      add("10.0.0.8", "wlan0", now);
+      THEN("it is not seen before the snapshot is taken again") {
+        CHECK(command("where 10.0.0.8").find("wlan0") == std::string::npos);
+        now += std::chrono::milliseconds(CONTROL_SNAPSHOT_AGE);
+        CHECK(command("where 10.0.0.8").find("wlan0") != std::string::npos);
+      }
+    }
+    THEN("invalid commands are refused") {
+      CHECK(command("where") == "{\"error\":\"invalid command\"}\n");
+      CHECK(command("where 10.0.0") == "{\"error\":\"invalid address\"}\n");
+      CHECK(command("dump all") == "{\"error\":\"invalid address\"}\n");
+      CHECK(command("flush") == "{\"error\":\"invalid command\"}\n");
+      CHECK(command("") == "{\"error\":\"no command\"}\n");
+    }
+  }
+
+  SECTION("changes") {
+    GIVEN("a host pinned to another interface") {
+      REQUIRE_CALL(context,
+                   system(eq("/sbin/ip route add 10.0.0.7/32 metric 50 dev wlan0 scope link"s)))
+          .RETURN(0);
+      REQUIRE_CALL(context,
+                   system(eq("/sbin/ip route del 10.0.0.7/32 metric 50 dev eth0 scope link"s)))
+          .RETURN(0);
+      CHECK(command("pin 10.0.0.7 wlan0") == "{\"changed\":1}\n");
+
+      THEN("the route moves there at once") {
+        REQUIRE(arptab_len == 1);
+        CHECK(std::string(arptab->ifname) == "wlan0");
+        CHECK(arptab->pinned);
+        CHECK(arptab->route_added);
+        CHECK(command("where 10.0.0.7").find("\"pinned\":true") != std::string::npos);
+      }
+      WHEN("it is not seen for longer than the timeout") {
+        now += std::chrono::seconds(option_entry_timeout + 1);
+        processarp(context, clock, false);
+        THEN("it stays") { CHECK(arptab_len == 1); }
+        AND_WHEN("it is unpinned") {
+          CHECK(command("unpin 10.0.0.7") == "{\"changed\":1}\n");
+          REQUIRE_CALL(context,
+                       system(eq("/sbin/ip route del 10.0.0.7/32 metric 50 dev wlan0 scope link"s)))
+              .RETURN(0);
+          processarp(context, clock, false);
+          THEN("it ages again") { CHECK(arptab_len == 0); }
+        }
+      }
+      WHEN("the kernel still has it on the old interface") {
+        FileSystemMock fileSystem{};
+        std::vector<std::string> lines = {
+            "IP address       HW type     Flags       HW address            Mask     Device",
+            "10.0.0.7         0x1         0x2         02:00:00:00:00:01     *        eth0"};
+        size_t next = 0;
+        ALLOW_CALL(fileSystem, fopen(_, _)).RETURN(reinterpret_cast<FILE *>(0xdeadbeef));
+        ALLOW_CALL(fileSystem, feof(_)).LR_RETURN(next >= lines.size());
+        ALLOW_CALL(fileSystem, fgets(_, _, _))
+            .LR_SIDE_EFFECT(std::strcpy(_1, lines[next++].c_str()))
+            .RETURN(_1);
+        ALLOW_CALL(fileSystem, fclose(_)).RETURN(0);
+        parseproc(fileSystem, context, clock);
+        THEN("that is ignored") {
+          REQUIRE(arptab_len == 1);
+          CHECK(std::string(arptab->ifname) == "wlan0");
+        }
+      }
+      WHEN("it is expired") {
+        REQUIRE_CALL(context,
+                     system(eq("/sbin/ip route del 10.0.0.7/32 metric 50 dev wlan0 scope link"s)))
+            .RETURN(0);
+        CHECK(command("expire 10.0.0.7") == "{\"changed\":1}\n");
+        THEN("entry and route are gone") {
+          CHECK(arptab_len == 0);
+          CHECK(command("where 10.0.0.7") == "{\"ip\":\"10.0.0.7\",\"hosts\":[]}\n");
+        }
+      }
+    }
+    THEN("only attached interfaces are pinned to") {
+      CHECK(command("pin 10.0.0.7 eth9") == "{\"error\":\"interface not attached\"}\n");
+      CHECK(command("unpin 10.0.0.7") == "{\"changed\":0}\n");
+    }
+  }
+
+  delete iface_remove(wlan0->name);
+  delete iface_remove(eth0->name);
+  clear();
+}
+
+} // namespace
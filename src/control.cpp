@@ -0,0 +1,344 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+/* Control socket.
+ *
+ * A UNIX stream socket at option_control, mode 0600, for operators and
+ * scripts: e.g. echo "where 10.0.0.7" | socat - UNIX:/run/parprouted.sock
+ * Each line is a command, each answer one line of JSON:
+ *
+ *   where IP         the entries of IP: {"ip":IP,"hosts":[ENTRY...]}
+ *   dump             {"arptab":[ENTRY...],"requests":[REQUEST...]}
+ *   pin IP IFNAME    keep IP behind IFNAME until unpinned: {"changed":N}
+ *   unpin IP         let the entries of IP age again: {"changed":N}
+ *   expire IP        drop the entries and routes of IP now: {"changed":N}
+ *
+ * Errors are answered with {"error":TEXT}. Queries are served from a
+ * snapshot of arptab and the request queue, indexed by address, so that
+ * neither a lookup nor a dump of the whole table holds arptab_mutex for
+ * more than one copy every CONTROL_SNAPSHOT_AGE. The changes are made
+ * under arptab_mutex, as a poll of main_thread() makes them. */
+
+#include "control.h"
+
+#include "handover.h"
+
+#include <sys/stat.h>
+#include <sys/un.h>
+
+std::string option_control;
+
+namespace {
+
+void json_string(std::string &out, const char *str) {
+  out += '"';
+  for (const char *c = str; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      out += '\\';
+      out += *c;
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", *c);
+      out += esc;
+    } else {
+      out += *c;
+    }
+  }
+  out += '"';
+}
+
+void json_ip(std::string &out, struct in_addr addr) {
+  char ip[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+  json_string(out, ip);
+}
+
+void json_bool(std::string &out, const char *key, bool value) {
+  out += ",\"";
+  out += key;
+  out += value ? "\":true" : "\":false";
+}
+
+void json_host(std::string &out, const arptab_entry &host, Clock::time_point now) {
+  char age[32];
+  snprintf(age, sizeof(age), "%.1f",
+           std::chrono::duration<double>(now - host.tstamp).count());
+  out += "{\"ip\":";
+  json_ip(out, host.ipaddr_ia);
+  out += ",\"ifname\":";
+  json_string(out, host.ifname);
+  out += ",\"hwaddr\":";
+  json_string(out, host.hwaddr);
+  out += ",\"group\":" + std::to_string(host.group);
+  out += ",\"age\":";
+  out += age;
+  json_bool(out, "incomplete", host.incomplete);
+  json_bool(out, "want_route", host.want_route);
+  json_bool(out, "route", host.route_added);
+  json_bool(out, "pinned", host.pinned);
+  out += '}';
+}
+
+void json_request(std::string &out, const RQ_ENTRY &req) {
+  out += "{\"target\":";
+  json_ip(out, req.target);
+  out += ",\"group\":" + std::to_string(req.group);
+  out += ",\"waiters\":[";
+  for (const auto &waiter : req.waiters) {
+    char hwaddr[ARP_TABLE_ENTRY_LEN];
+    const unsigned char *ha = waiter.hwaddr;
+    snprintf(hwaddr, sizeof(hwaddr), "%02x:%02x:%02x:%02x:%02x:%02x", ha[0], ha[1], ha[2], ha[3],
+             ha[4], ha[5]);
+    if (&waiter != &req.waiters.front()) {
+      out += ',';
+    }
+    out += "{\"ip\":";
+    json_ip(out, waiter.ipaddr);
+    out += ",\"hwaddr\":";
+    json_string(out, hwaddr);
+    out += ",\"ifindex\":" + std::to_string(waiter.ifindex);
+    out += '}';
+  }
+  out += "]}";
+}
+
+void json_error(std::string &out, const char *error) {
+  out += "{\"error\":";
+  json_string(out, error);
+  out += "}\n";
+}
+
+/* Pin addr to ifname: the entry wants a route whether the kernel knows
+ * the host or not, never expires, and entries of addr on the other
+ * interfaces of the group go */
+int control_pin(struct in_addr addr, const char *ifname, Context &context, Clock &clock) {
+  pthread_rwlock_rdlock(&ifaces_lock);
+  const iface *it = iface_find(ifname);
+  int group = it != NULL ? it->group : -1;
+  pthread_rwlock_unlock(&ifaces_lock);
+  if (group < 0) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&arptab_mutex);
+  arptab_entry *entry = replace_entry(addr, ifname);
+  if (entry->tstamp == Clock::time_point{}) {
+    entry->ipaddr_ia = addr;
+    strncpy(entry->ifname, ifname, ARP_TABLE_ENTRY_LEN - 1);
+    entry->tstamp = entry->refreshed = clock.now();
+  }
+  entry->group = group;
+  entry->want_route = true;
+  entry->pinned = true;
+  remove_other_routes(addr, ifname, group);
+  processarp(context, clock, false);
+  pthread_mutex_unlock(&arptab_mutex);
+  LOG(LOG_INFO, "Pinned %s to %s.", addr, ifname);
+  return 1;
+}
+
+/* Unpin the entries of addr, or with expire drop them and their routes;
+ * an expired host the kernel still knows is learned again */
+int control_release(struct in_addr addr, bool expire, Context &context, Clock &clock) {
+  int changed = 0;
+
+  pthread_mutex_lock(&arptab_mutex);
+  for (arptab_entry *cur_entry = arptab; cur_entry != NULL; cur_entry = cur_entry->next) {
+    if (cur_entry->ipaddr_ia.s_addr == addr.s_addr && (expire || cur_entry->pinned)) {
+      cur_entry->pinned = false;
+      cur_entry->want_route = cur_entry->want_route && !expire;
+      changed++;
+    }
+  }
+  if (expire && changed > 0) {
+    processarp(context, clock, false);
+  }
+  pthread_mutex_unlock(&arptab_mutex);
+  if (changed > 0) {
+    LOG(LOG_INFO, expire ? "Expired %s." : "Unpinned %s.", addr);
+  }
+  return changed;
+}
+
+} // namespace
+
+void control_snapshot_take(control_snapshot &snap, Clock &clock) {
+  /* cleared, not freed: after the first snapshot the copies allocate only
+   * when the table grew */
+  snap.hosts.clear();
+  snap.requests.clear();
+  snap.index.clear();
+
+  pthread_mutex_lock(&arptab_mutex);
+  snap.taken = clock.now();
+  snap.hosts.reserve(arptab_len);
+  for (const arptab_entry *cur_entry = arptab; cur_entry != NULL; cur_entry = cur_entry->next) {
+    snap.hosts.push_back(*cur_entry);
+    snap.hosts.back().next = nullptr;
+  }
+  pthread_mutex_unlock(&arptab_mutex);
+
+  pthread_mutex_lock(&req_queue_mutex);
+  for (const RQ_ENTRY *cur = req_queue; cur != NULL; cur = cur->next) {
+    snap.requests.push_back(*cur);
+    snap.requests.back().next = nullptr;
+  }
+  pthread_mutex_unlock(&req_queue_mutex);
+
+  for (size_t i = 0; i < snap.hosts.size(); i++) {
+    snap.index.emplace(snap.hosts[i].ipaddr_ia.s_addr, i);
+  }
+}
+
+void control_command(const char *line, control_snapshot &snap, std::string &out,
+                     Context &context, Clock &clock) {
+  char cmd[16], arg1[INET_ADDRSTRLEN], arg2[IFNAMSIZ], extra;
+  struct in_addr addr {};
+
+  int args = sscanf(line, "%15s %15s %15s %c", cmd, arg1, arg2, &extra);
+  if (args < 1) {
+    json_error(out, "no command");
+    return;
+  }
+  if (args >= 2 && inet_pton(AF_INET, arg1, &addr) != 1) {
+    json_error(out, "invalid address");
+    return;
+  }
+
+  bool query = !strcmp(cmd, "where") || !strcmp(cmd, "dump");
+  if (query && (snap.taken == Clock::time_point{} ||
+                clock.now() - snap.taken >= std::chrono::milliseconds(CONTROL_SNAPSHOT_AGE))) {
+    control_snapshot_take(snap, clock);
+  }
+
+  if (!strcmp(cmd, "where") && args == 2) {
+    out += "{\"ip\":";
+    json_ip(out, addr);
+    out += ",\"hosts\":[";
+    auto [first, last] = snap.index.equal_range(addr.s_addr);
+    for (auto pos = first; pos != last; ++pos) {
+      out += pos == first ? "" : ",";
+      json_host(out, snap.hosts[pos->second], snap.taken);
+    }
+    out += "]}\n";
+  } else if (!strcmp(cmd, "dump") && args == 1) {
+    out += "{\"arptab\":[";
+    for (const auto &host : snap.hosts) {
+      out += &host == snap.hosts.data() ? "" : ",";
+      json_host(out, host, snap.taken);
+    }
+    out += "],\"requests\":[";
+    for (const auto &req : snap.requests) {
+      out += &req == snap.requests.data() ? "" : ",";
+      json_request(out, req);
+    }
+    out += "]}\n";
+  } else if (!strcmp(cmd, "pin") && args == 3) {
+    if (control_pin(addr, arg2, context, clock) < 0) {
+      json_error(out, "interface not attached");
+      return;
+    }
+    snap.taken = {};
+    out += "{\"changed\":1}\n";
+  } else if ((!strcmp(cmd, "unpin") || !strcmp(cmd, "expire")) && args == 2) {
+    int changed = control_release(addr, !strcmp(cmd, "expire"), context, clock);
+    snap.taken = {};
+    out += "{\"changed\":" + std::to_string(changed) + "}\n";
+  } else {
+    json_error(out, "invalid command");
+  }
+}
+
+void control_unlink() {
+  if (!option_control.empty()) {
+    unlink(option_control.c_str());
+  }
+}
+
+void *control_thread(Context &context, Clock &clock) {
+  struct sockaddr_un sun = {};
+  control_snapshot snap;
+  int sock;
+
+  if (option_control.size() >= sizeof(sun.sun_path)) {
+    syslog(LOG_ERR, "error: control socket path too long: %s", option_control.c_str());
+    return NULL;
+  }
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, option_control.c_str(), sizeof(sun.sun_path) - 1);
+
+  /* after a handover clients connect all along, the socket stays bound */
+  if ((sock = handover_take(HANDOVER_CONTROL, "")) < 0) {
+    if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+      syslog(LOG_ERR, "error: control socket: %s", strerror(errno));
+      return NULL;
+    }
+    /* left behind by an instance that was killed */
+    unlink(sun.sun_path);
+    if (bind(sock, (struct sockaddr *)&sun, sizeof(sun)) < 0 || chmod(sun.sun_path, 0600) < 0 ||
+        listen(sock, SOMAXCONN) < 0) {
+      syslog(LOG_ERR, "error: control socket %s: %s", sun.sun_path, strerror(errno));
+      close(sock);
+      return NULL;
+    }
+  }
+  handover_register(HANDOVER_CONTROL, "", sock);
+
+  while (true) {
+    int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        syslog(LOG_ERR, "error: control accept: %s", strerror(errno));
+        sleep(1);
+      }
+      continue;
+    }
+
+    /* one client at a time; a slow one is cut off */
+    struct timeval timeout = {CONTROL_TIMEOUT, 0};
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string in, out;
+    char buf[CONTROL_LINE_LEN];
+    ssize_t len;
+    bool open = true;
+    while (open && (len = recv(conn, buf, sizeof(buf), 0)) > 0) {
+      in.append(buf, static_cast<size_t>(len));
+      size_t eol;
+      while ((eol = in.find('\n')) != std::string::npos) {
+        in[eol] = '\0';
+        control_command(in.c_str(), snap, out, context, clock);
+        in.erase(0, eol + 1);
+      }
+      if (in.size() >= CONTROL_LINE_LEN) {
+        json_error(out, "line too long");
+        open = false;
+      }
+      for (size_t sent = 0; sent < out.size();) {
+        ssize_t n = send(conn, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+          open = false;
+          break;
+        }
+        sent += static_cast<size_t>(n);
+      }
+      out.clear();
+    }
+    close(conn);
+  }
+}
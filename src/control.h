@@ -0,0 +1,54 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+#pragma once
+
+#include "clock.h"
+#include "context.h"
+#include "parprouted.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define CONTROL_SNAPSHOT_AGE 100 /* ms a snapshot answers queries before it is taken again */
+#define CONTROL_TIMEOUT 5        /* seconds a client may take to send a command or read */
+#define CONTROL_LINE_LEN 256     /* longest command line */
+
+/* arptab and the request queue as they were when taken. Copied under the
+ * locks, which are held for the copy only; queries and dumps are answered
+ * from the copy. next pointers are not valid. */
+struct control_snapshot {
+  Clock::time_point taken{}; /* {} = to be taken before the next query */
+  std::vector<arptab_entry> hosts;
+  std::vector<RQ_ENTRY> requests;
+  std::unordered_multimap<in_addr_t, size_t> index; /* hosts by address */
+};
+
+extern void control_snapshot_take(control_snapshot &snap, Clock &);
+
+/* Carry out one command line and append its answer, one line of JSON, to
+ * out. Queries are answered from snap, taken again when older than
+ * CONTROL_SNAPSHOT_AGE; changes take arptab_mutex and invalidate it. */
+extern void control_command(const char *line, control_snapshot &snap, std::string &out,
+                            Context &, Clock &);
+
+/* Serve the control socket at option_control; started if it is set */
+extern void *control_thread(Context &, Clock &);
+
+/* Remove the socket file on exit */
+extern void control_unlink();
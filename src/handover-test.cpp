@@ -0,0 +1,169 @@
+#include "handover.h"
+
+#include "parprouted.h"
+
+#include <catch2/catch.hpp>
+
+#include <sys/stat.h>
+
+#include <filesystem>
+
+namespace {
+
+constexpr const char *TAGS = "handover";
+
+TEST_CASE("handover-test", TAGS) {
+  auto clear = [] {
+    while (arptab != nullptr) {
+      delete std::exchange(arptab, arptab->next);
+    }
+    arptab_len = 0;
+    rq_clear();
+    for (int sock; (sock = handover_take(HANDOVER_ARP, "eth0")) >= 0;) {
+      close(sock);
+    }
+  };
+  auto same_file = [](int fd1, int fd2) {
+    struct stat st1, st2;
+    return fstat(fd1, &st1) == 0 && fstat(fd2, &st2) == 0 && st1.st_dev == st2.st_dev &&
+           st1.st_ino == st2.st_ino;
+  };
+  int sv[2];
+  int probe[2];
+
+  clear();
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, probe) == 0);
+
+  GIVEN("two hosts, a queued request and a registered socket") {
+    auto now = std::chrono::steady_clock::time_point{std::chrono::hours(24)};
+    auto *entry1 = replace_entry(in_addr{htonl(0x0a000001)}, "eth0");
+    entry1->ipaddr_ia = in_addr{htonl(0x0a000001)};
+    strcpy(entry1->ifname, "eth0");
+    strcpy(entry1->hwaddr, "02:00:00:00:00:01");
+    entry1->tstamp = now;
+    entry1->route_added = true;
+    entry1->pinned = true;
+    auto *entry2 = replace_entry(in_addr{htonl(0x0a000002)}, "wlan0");
+    entry2->ipaddr_ia = in_addr{htonl(0x0a000002)};
+    strcpy(entry2->ifname, "wlan0");
+    entry2->incomplete = true;
+    entry2->want_route = false;
+    entry2->group = 1;
+
+    ether_arp_frame frame{};
+    frame.arp.arp_op = htons(ARPOP_REQUEST);
+    struct sockaddr_ll req_if {};
+    req_if.sll_ifindex = 3;
+    rq_add(&frame, &req_if, 1, now);
+
+    handover_register(HANDOVER_ARP, "eth0", probe[0]);
+    fanout_seed = 4711;
+
+    WHEN("the state is handed over") {
+      REQUIRE(handover_send(sv[1]));
+      clear();
+      fanout_seed = 0;
+      REQUIRE(handover_receive(sv[0]));
+
+      THEN("arptab is restored in order, routes are known to be installed") {
+        REQUIRE(arptab_len == 2);
+        CHECK(arptab->ipaddr_ia.s_addr == htonl(0x0a000001));
+        CHECK(std::string(arptab->ifname) == "eth0");
+        CHECK(std::string(arptab->hwaddr) == "02:00:00:00:00:01");
+        CHECK(arptab->tstamp == now);
+        CHECK(arptab->route_added);
+        CHECK(arptab->want_route);
+        CHECK(arptab->pinned);
+        CHECK(arptab->next->group == 1);
+        CHECK(arptab->next->incomplete);
+        CHECK(!arptab->next->want_route);
+        CHECK(!arptab->next->pinned);
+        CHECK(arptab->next->next == nullptr);
+      }
+      THEN("the request queue is restored") {
+        REQUIRE(req_queue_len == 1);
+        CHECK(req_queue->group == 1);
+        CHECK(req_queue->waiters.size() == 1);
+        CHECK(req_queue->waiters.front().ifindex == 3);
+      }
+      THEN("the socket is inherited once") {
+        int sock = handover_take(HANDOVER_ARP, "eth0");
+        REQUIRE(sock >= 0);
+        CHECK(same_file(sock, probe[0]));
+        CHECK(handover_take(HANDOVER_ARP, "eth0") == -1);
+        close(sock);
+      }
+      THEN("the fanout groups are kept") { CHECK(fanout_seed == 4711); }
+      THEN("a socket nobody takes can be closed") {
+        handover_close(HANDOVER_ARP);
+        CHECK(handover_take(HANDOVER_ARP, "eth0") == -1);
+      }
+    }
+    WHEN("the socket was closed before") {
+      handover_unregister(probe[0]);
+      REQUIRE(handover_send(sv[1]));
+      clear();
+      REQUIRE(handover_receive(sv[0]));
+      THEN("it is not handed over") { CHECK(handover_take(HANDOVER_ARP, "eth0") == -1); }
+    }
+    handover_unregister(probe[0]);
+  }
+
+  GIVEN("the sockets of two workers of an interface") {
+    auto open_fds = [] {
+      return std::distance(std::filesystem::directory_iterator("/proc/self/fd"),
+                           std::filesystem::directory_iterator{});
+    };
+    handover_register(HANDOVER_ARP, "eth0", probe[0]);
+    handover_register(HANDOVER_ARP, "eth0", probe[1]);
+    REQUIRE(handover_send(sv[1]));
+    clear();
+    REQUIRE(handover_receive(sv[0]));
+    WHEN("the new instance runs one worker") {
+      int sock = handover_take(HANDOVER_ARP, "eth0");
+      REQUIRE(sock >= 0);
+      auto fds = open_fds();
+      handover_close(HANDOVER_ARP);
+      THEN("the other socket is closed, the taken one stays open") {
+        CHECK(open_fds() == fds - 1);
+        CHECK(handover_take(HANDOVER_ARP, "eth0") == -1);
+        CHECK(same_file(sock, probe[0]));
+      }
+      close(sock);
+    }
+    handover_unregister(probe[0]);
+    handover_unregister(probe[1]);
+  }
+
+  GIVEN("a peer that is no parprouted") {
+    const char garbage[] = "GET / HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    REQUIRE(write(sv[1], garbage, sizeof(garbage)) == sizeof(garbage));
+    THEN("nothing is taken over") {
+      CHECK(!handover_receive(sv[0]));
+      CHECK(arptab == nullptr);
+    }
+  }
+
+  GIVEN("a receive thread with a batch at hand") {
+    REQUIRE(handover_recv_begin());
+    WHEN("the handover pauses the receive threads") {
+      std::thread pause(handover_pause);
+      THEN("it waits for the batch, and no more is read until resumed") {
+        handover_recv_end();
+        pause.join();
+        CHECK(!handover_recv_begin());
+        handover_resume();
+        CHECK(handover_recv_begin());
+        handover_recv_end();
+      }
+    }
+  }
+
+  clear();
+  for (int fd : {sv[0], sv[1], probe[0], probe[1]}) {
+    close(fd);
+  }
+}
+
+} // namespace
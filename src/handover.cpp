@@ -0,0 +1,432 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* Hitless upgrade: the running instance execs the (new) binary and hands
+ * it everything needed to carry on where it stops.
+ *
+ * The packet and netlink sockets are passed with SCM_RIGHTS, so they are
+ * never closed: frames arriving while neither instance reads are queued
+ * in the sockets, not lost. arptab and the request queue are serialized,
+ * the routes stay in the kernel and the new instance knows it added them.
+ *
+ *   old                                     new
+ *   pause receive threads
+ *   lock arptab_mutex, fork+exec  ------>   parse arguments
+ *   state, sockets                ------>   load state
+ *                                 <------   ack
+ *   _exit(0), no cleanup          ------>   EOF: start threads
+ *
+ * The receive threads of the old instance stop reading before, and the
+ * frames they have read are handled, so none is read and dropped at exit.
+ * The new instance only starts reading after the old one is gone, so no
+ * link event or dump reply is consumed by the wrong instance. If the new
+ * instance does not acknowledge, the old one kills it and carries on. */
+
+#include "handover.h"
+
+#include "parprouted.h"
+
+#include <poll.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define HANDOVER_MAGIC 0x50415250 /* "PARP" */
+#define HANDOVER_VERSION 2 /* 1 had no pinned entries, still taken over */
+
+int fanout_seed = getpid();
+char **handover_argv = nullptr;
+
+namespace {
+
+struct handover_header {
+  uint32_t magic;
+  uint32_t version;
+  int32_t fanout_seed;
+  uint32_t entries;
+  uint32_t requests;
+  uint32_t socks;
+};
+
+struct handover_entry {
+  struct in_addr ipaddr;
+  char hwaddr[ARP_TABLE_ENTRY_LEN];
+  char ifname[ARP_TABLE_ENTRY_LEN];
+  int64_t tstamp; /* ns of CLOCK_MONOTONIC, the same for both instances */
+  int32_t group;
+  uint8_t route_added;
+  uint8_t incomplete;
+  uint8_t want_route;
+  uint8_t pinned; /* version 2 */
+};
+
+struct handover_request {
+  ether_arp_frame frame;
+  struct sockaddr_ll req_if;
+  int32_t group;
+};
+
+/* sent with the socket itself as SCM_RIGHTS */
+struct handover_sock {
+  int32_t kind;
+  char name[IFNAMSIZ];
+};
+
+struct registered_sock {
+  handover_kind kind;
+  std::string name;
+  int sock;
+};
+
+std::vector<registered_sock> socks;     /* ours */
+std::vector<registered_sock> inherited; /* of the previous instance, not yet taken */
+std::mutex socks_mutex;
+
+bool write_full(int fd, const void *buf, size_t len) {
+  const auto *p = static_cast<const char *>(buf);
+
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+/* Exactly len bytes; never reads into the next record, which may carry a
+ * socket that a plain read() would discard */
+bool read_full(int fd, void *buf, size_t len) {
+  auto *p = static_cast<char *>(buf);
+
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool send_sock(int fd, const registered_sock &it) {
+  handover_sock rec{};
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  struct iovec iov = {&rec, sizeof(rec)};
+  struct msghdr msg = {};
+
+  rec.kind = it.kind;
+  strncpy(rec.name, it.name.c_str(), IFNAMSIZ - 1);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &it.sock, sizeof(int));
+
+  return sendmsg(fd, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(rec));
+}
+
+bool recv_sock(int fd, registered_sock &it) {
+  handover_sock rec{};
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  struct iovec iov = {&rec, sizeof(rec)};
+  struct msghdr msg = {};
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(rec))) {
+    return false;
+  }
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+    return false;
+  }
+  rec.name[IFNAMSIZ - 1] = '\0';
+  it.kind = static_cast<handover_kind>(rec.kind);
+  it.name = rec.name;
+  memcpy(&it.sock, CMSG_DATA(cmsg), sizeof(int));
+  return true;
+}
+
+} // namespace
+
+void handover_register(handover_kind kind, const char *name, int sock) {
+  std::lock_guard lock(socks_mutex);
+  socks.push_back({kind, name, sock});
+}
+
+void handover_unregister(int sock) {
+  std::lock_guard lock(socks_mutex);
+  std::erase_if(socks, [sock](const registered_sock &it) { return it.sock == sock; });
+}
+
+int handover_take(handover_kind kind, const char *name) {
+  std::lock_guard lock(socks_mutex);
+  for (auto pos = inherited.begin(); pos != inherited.end(); ++pos) {
+    if (pos->kind == kind && pos->name == name) {
+      int sock = pos->sock;
+      inherited.erase(pos);
+      return sock;
+    }
+  }
+  return -1;
+}
+
+void handover_close(handover_kind kind) {
+  std::lock_guard lock(socks_mutex);
+  std::erase_if(inherited, [kind](const registered_sock &it) {
+    if (it.kind == kind) {
+      close(it.sock);
+    }
+    return it.kind == kind;
+  });
+}
+
+/* Receive threads between reading a batch and having handled it */
+static std::atomic<int> receiving{0};
+static std::atomic<bool> paused{false};
+
+bool handover_recv_begin() {
+  receiving++;
+  if (paused) {
+    receiving--;
+    return false;
+  }
+  return true;
+}
+
+void handover_recv_end() { receiving--; }
+
+void handover_pause() {
+  paused = true;
+  /* a thread waiting for a frame wakes within its receive timeout */
+  while (receiving > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+void handover_resume() { paused = false; }
+
+bool handover_send(int fd) {
+  std::vector<handover_entry> entries;
+  std::vector<handover_request> requests;
+  std::vector<registered_sock> sending;
+
+  entries.reserve(arptab_len);
+  for (const arptab_entry *cur = arptab; cur != NULL; cur = cur->next) {
+    handover_entry rec{};
+    rec.ipaddr = cur->ipaddr_ia;
+    memcpy(rec.hwaddr, cur->hwaddr, sizeof(rec.hwaddr));
+    memcpy(rec.ifname, cur->ifname, sizeof(rec.ifname));
+    rec.tstamp =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(cur->tstamp.time_since_epoch())
+            .count();
+    rec.group = cur->group;
+    rec.route_added = cur->route_added;
+    rec.incomplete = cur->incomplete;
+    rec.want_route = cur->want_route;
+    rec.pinned = cur->pinned;
+    entries.push_back(rec);
+  }
+
+  pthread_mutex_lock(&req_queue_mutex);
+  /* one request per waiter, the receiver queues them up again */
+  for (const RQ_ENTRY *cur = req_queue; cur != NULL; cur = cur->next) {
+    for (const auto &waiter : cur->waiters) {
+      handover_request rec{};
+      rq_request(*cur, waiter, rec.frame, rec.req_if);
+      rec.group = cur->group;
+      requests.push_back(rec);
+    }
+  }
+  pthread_mutex_unlock(&req_queue_mutex);
+
+  {
+    std::lock_guard lock(socks_mutex);
+    sending = socks;
+  }
+
+  handover_header hdr{HANDOVER_MAGIC,
+                      HANDOVER_VERSION,
+                      fanout_seed,
+                      static_cast<uint32_t>(entries.size()),
+                      static_cast<uint32_t>(requests.size()),
+                      static_cast<uint32_t>(sending.size())};
+
+  if (!write_full(fd, &hdr, sizeof(hdr)) ||
+      !write_full(fd, entries.data(), entries.size() * sizeof(handover_entry)) ||
+      !write_full(fd, requests.data(), requests.size() * sizeof(handover_request))) {
+    return false;
+  }
+  for (const auto &it : sending) {
+    if (!send_sock(fd, it)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool handover_receive(int fd) {
+  handover_header hdr;
+  arptab_entry *tail = NULL;
+
+  if (!read_full(fd, &hdr, sizeof(hdr)) || hdr.magic != HANDOVER_MAGIC ||
+      hdr.version < 1 || hdr.version > HANDOVER_VERSION) {
+    syslog(LOG_ERR, "error: handover: no state or version mismatch");
+    return false;
+  }
+  fanout_seed = hdr.fanout_seed;
+
+  /* appended in order, the table is empty before any thread runs */
+  for (uint32_t i = 0; i < hdr.entries; i++) {
+    handover_entry rec;
+    if (!read_full(fd, &rec, sizeof(rec))) {
+      syslog(LOG_ERR, "error: handover: truncated arptab");
+      return false;
+    }
+    auto *entry = new arptab_entry();
+    entry->ipaddr_ia = rec.ipaddr;
+    memcpy(entry->hwaddr, rec.hwaddr, sizeof(entry->hwaddr));
+    memcpy(entry->ifname, rec.ifname, sizeof(entry->ifname));
+    entry->hwaddr[ARP_TABLE_ENTRY_LEN - 1] = entry->ifname[ARP_TABLE_ENTRY_LEN - 1] = '\0';
+    entry->tstamp = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(rec.tstamp));
+    entry->group = rec.group;
+    entry->route_added = rec.route_added;
+    entry->incomplete = rec.incomplete;
+    entry->want_route = rec.want_route;
+    entry->pinned = hdr.version >= 2 && rec.pinned;
+    if (tail == NULL) {
+      arptab = entry;
+    } else {
+      tail->next = entry;
+    }
+    tail = entry;
+    arptab_len++;
+  }
+
+  for (uint32_t i = 0; i < hdr.requests; i++) {
+    handover_request rec;
+    if (!read_full(fd, &rec, sizeof(rec))) {
+      syslog(LOG_ERR, "error: handover: truncated request queue");
+      return false;
+    }
+    /* not relayed yet in this instance, the next request for the target is */
+    rq_add(&rec.frame, &rec.req_if, rec.group, {});
+  }
+
+  for (uint32_t i = 0; i < hdr.socks; i++) {
+    registered_sock it;
+    if (!recv_sock(fd, it)) {
+      syslog(LOG_ERR, "error: handover: socket %u of %u missing", i, hdr.socks);
+      return false;
+    }
+    std::lock_guard lock(socks_mutex);
+    inherited.push_back(it);
+  }
+
+  syslog(LOG_INFO, "Took over %u entries, %u queued requests and %u sockets.", hdr.entries,
+         hdr.requests, hdr.socks);
+  return true;
+}
+
+bool handover_accept(int fd) {
+  char ack = 1;
+
+  if (!handover_receive(fd) || !write_full(fd, &ack, sizeof(ack))) {
+    close(fd);
+    return false;
+  }
+  /* EOF once the old instance has exited */
+  while (read(fd, &ack, sizeof(ack)) < 0 && errno == EINTR) {
+  }
+  close(fd);
+  return true;
+}
+
+bool handover_start() {
+  std::string fdenv;
+  std::vector<char *> envp;
+  struct pollfd pfd;
+  struct timeval timeout = {HANDOVER_TIMEOUT, 0};
+  char ack;
+  pid_t pid;
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+    syslog(LOG_ERR, "error: handover socketpair: %s", strerror(errno));
+    return false;
+  }
+
+  /* prepared before fork(), the child may only exec */
+  fdenv = std::string(HANDOVER_ENV "=") + std::to_string(sv[1]);
+  for (char **env = environ; *env != NULL; env++) {
+    if (strncmp(*env, HANDOVER_ENV "=", strlen(HANDOVER_ENV "=")) != 0) {
+      envp.push_back(*env);
+    }
+  }
+  envp.push_back(fdenv.data());
+  envp.push_back(NULL);
+
+  syslog(LOG_INFO, "Handing over to a new %s.", handover_argv[0]);
+  if ((pid = fork()) < 0) {
+    syslog(LOG_ERR, "error: handover fork: %s", strerror(errno));
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+  if (pid == 0) {
+    fcntl(sv[1], F_SETFD, 0);
+    execvpe(handover_argv[0], handover_argv, envp.data());
+    _exit(127);
+  }
+  close(sv[1]);
+
+  /* a new instance that dies or hangs must not take us with it */
+  setsockopt(sv[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  pfd = {sv[0], POLLIN, 0};
+  if (!handover_send(sv[0]) || poll(&pfd, 1, HANDOVER_TIMEOUT * 1000) != 1 ||
+      read(sv[0], &ack, sizeof(ack)) != 1) {
+    syslog(LOG_ERR, "error: handover to %s failed, carrying on", handover_argv[0]);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    close(sv[0]);
+    return false;
+  }
+  return true;
+}
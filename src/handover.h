@@ -0,0 +1,76 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#define HANDOVER_ENV "PARPROUTED_HANDOVER" /* fd of the handover socket */
+#define HANDOVER_TIMEOUT 5                 /* seconds to wait for the new instance */
+
+/* Sockets that survive a handover to a new instance */
+enum handover_kind {
+  HANDOVER_ARP,     /* arp_thread() socket of an interface, one per worker */
+  HANDOVER_TRUNK,   /* trunk_thread() socket of a trunk, one per worker */
+  HANDOVER_LINK,    /* link_thread() netlink socket */
+  HANDOVER_CONTROL, /* control_thread() listening socket */
+  HANDOVER_XDP,     /* XDP responder link of an interface, and the maps */
+};
+
+/* Packet and netlink sockets of the running instance; the receive threads
+ * register them once bound and unregister them before closing */
+extern void handover_register(handover_kind kind, const char *name, int sock);
+extern void handover_unregister(int sock);
+
+/* A socket of the given kind and name inherited from the previous
+ * instance, -1 if there is none left */
+extern int handover_take(handover_kind kind, const char *name);
+
+/* Close the inherited sockets of a kind that nobody took */
+extern void handover_close(handover_kind kind);
+
+/* Receive threads read a batch only if handover_recv_begin() lets them,
+ * and call handover_recv_end() once it is handled */
+extern bool handover_recv_begin();
+extern void handover_recv_end();
+
+/* Old instance: keep the receive threads from reading and wait for the
+ * batches they have, before arptab_mutex is taken; the frames arriving
+ * meanwhile stay queued in the sockets. Resumed if the handover fails. */
+extern void handover_pause();
+extern void handover_resume();
+
+/* Seed of the PACKET_FANOUT group ids, kept across handovers so that
+ * inherited and new sockets of an interface share one group */
+extern int fanout_seed;
+
+/* Command line of this instance, for the next one */
+extern char **handover_argv;
+
+/* Old instance: exec argv[0] with the same arguments and pass it the
+ * sockets, arptab and request queue. The caller has paused the receive
+ * threads and holds arptab_mutex. On success the new instance is running
+ * and the caller must exit without cleanup; on failure it carries on. */
+extern bool handover_start();
+
+/* New instance: load the state from the handover socket given in
+ * HANDOVER_ENV, tell the old instance and wait for it to exit. Called
+ * before any thread is started. */
+extern bool handover_accept(int fd);
+
+/* Serialize the state to / load it from a handover socket */
+extern bool handover_send(int fd);
+extern bool handover_receive(int fd);
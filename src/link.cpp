@@ -0,0 +1,345 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "parprouted.h"
+
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "context.h"
+#include "fs.h"
+#include "handover.h"
+#include "xdp.h"
+
+/* Trunks with their receive workers; only the link monitor uses them */
+static std::vector<iface *> trunks;
+
+/* Netlink socket of the link monitor, -1 until it runs */
+static std::atomic<int> link_sock{-1};
+
+std::atomic<bool> link_synced{false};
+
+/* Start the receive workers of a wanted interface that came up; VLANs of
+ * a trunk have none, their frames arrive on the trunk's socket */
+static void link_attach(const char *ifname, int group, const vlan_link &vlan,
+                        FileSystem &fileSystem, Context &context, Clock &clock) {
+  iface *it = iface_add(ifname, group, vlan);
+  if (it == NULL) {
+    return; /* already attached */
+  }
+
+  if (vlan.trunk != 0) {
+    syslog(LOG_INFO, "Attaching %s (VLAN %u on trunk).", ifname, vlan.vid);
+    return;
+  }
+
+  syslog(LOG_INFO, "Attaching %s.", ifname);
+  if (option_xdp) {
+    pthread_rwlock_rdlock(&ifaces_lock);
+    xdp_attach(it);
+    pthread_rwlock_unlock(&ifaces_lock);
+  }
+  /* the inherited sockets are taken here, before the first dump is done
+   * and those nobody took are closed */
+  for (int worker = 0; worker < option_workers; worker++) {
+    it->workers.emplace_back(arp_thread, it->name, handover_take(HANDOVER_ARP, it->name),
+                             std::ref(fileSystem), std::ref(context), std::ref(clock));
+  }
+  LOG(LOG_DEBUG, "Created %d ARP thread(s) for %s.", option_workers, ifname);
+}
+
+/* Stop the receive workers of an interface that went down or away and
+ * withdraw its routes */
+static void link_detach(const char *ifname, Context &context, Clock &clock) {
+  char name[IFNAMSIZ];
+  iface *it = iface_remove(ifname);
+  if (it == NULL) {
+    return;
+  }
+
+  syslog(LOG_INFO, "Detaching %s.", ifname);
+  if (option_xdp) {
+    xdp_detach(ifname);
+  }
+  strncpy(name, it->name, IFNAMSIZ);
+  /* ~jthread requests stop and joins; the workers poll once a second */
+  delete it;
+  iface_withdraw(name, context, clock);
+}
+
+static void trunk_attach(const char *ifname, FileSystem &fileSystem, Context &context,
+                         Clock &clock) {
+  for (const auto *it : trunks) {
+    if (strcmp(it->name, ifname) == 0) {
+      return;
+    }
+  }
+
+  syslog(LOG_INFO, "Attaching trunk %s.", ifname);
+  auto *it = new iface();
+  strncpy(it->name, ifname, IFNAMSIZ - 1);
+  for (int worker = 0; worker < option_workers; worker++) {
+    it->workers.emplace_back(trunk_thread, it->name, handover_take(HANDOVER_TRUNK, it->name),
+                             std::ref(fileSystem), std::ref(context), std::ref(clock));
+  }
+  trunks.push_back(it);
+}
+
+/* The VLANs go down with the trunk and are detached on their own events */
+static void trunk_detach(const char *ifname) {
+  for (auto pos = trunks.begin(); pos != trunks.end(); ++pos) {
+    if (strcmp((*pos)->name, ifname) == 0) {
+      syslog(LOG_INFO, "Detaching trunk %s.", ifname);
+      delete *pos;
+      trunks.erase(pos);
+      return;
+    }
+  }
+}
+
+/* VLAN id of a vlan link from its IFLA_LINKINFO, -1 for other links */
+static int link_vlan_id(struct rtattr *linkinfo) {
+  int len = static_cast<int>(RTA_PAYLOAD(linkinfo));
+  bool vlan = false;
+  int vid = -1;
+
+  for (struct rtattr *rta = static_cast<struct rtattr *>(RTA_DATA(linkinfo)); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == IFLA_INFO_KIND) {
+      vlan = strcmp(static_cast<const char *>(RTA_DATA(rta)), "vlan") == 0;
+    } else if (rta->rta_type == IFLA_INFO_DATA) {
+      int dlen = static_cast<int>(RTA_PAYLOAD(rta));
+      for (struct rtattr *data = static_cast<struct rtattr *>(RTA_DATA(rta)); RTA_OK(data, dlen);
+           data = RTA_NEXT(data, dlen)) {
+        if (data->rta_type == IFLA_VLAN_ID) {
+          vid = *static_cast<uint16_t *>(RTA_DATA(data));
+        }
+      }
+    }
+  }
+  return vlan ? vid : -1;
+}
+
+static void link_event(struct nlmsghdr *nlh, FileSystem &fileSystem, Context &context,
+                       Clock &clock) {
+  auto *ifi = static_cast<struct ifinfomsg *>(NLMSG_DATA(nlh));
+  int len = static_cast<int>(nlh->nlmsg_len) - static_cast<int>(NLMSG_LENGTH(sizeof(*ifi)));
+  const char *ifname = NULL;
+  char parent[IFNAMSIZ] = "";
+  vlan_link vlan;
+  int vid = -1;
+  int group;
+
+  for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == IFLA_IFNAME) {
+      ifname = static_cast<const char *>(RTA_DATA(rta));
+    } else if (rta->rta_type == IFLA_LINK) {
+      vlan.trunk = *static_cast<int *>(RTA_DATA(rta));
+    } else if (rta->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(rta) == ETH_ALEN) {
+      memcpy(vlan.hwaddr, RTA_DATA(rta), ETH_ALEN);
+    } else if (rta->rta_type == IFLA_LINKINFO) {
+      vid = link_vlan_id(rta);
+    }
+  }
+
+  if (ifname == NULL) {
+    return;
+  }
+
+  bool up = nlh->nlmsg_type == RTM_NEWLINK && (ifi->ifi_flags & IFF_UP) &&
+            (ifi->ifi_flags & IFF_RUNNING);
+
+  /* the patterns change on reload, under the lock */
+  pthread_rwlock_rdlock(&ifaces_lock);
+  bool trunk = trunk_group(ifname) >= 0;
+  /* all VLANs of a trunk are proxied in the trunk's group, received on the
+   * trunk's socket */
+  if (vid >= 0 && vlan.trunk != 0 && if_indextoname(static_cast<unsigned>(vlan.trunk), parent) &&
+      (group = trunk_group(parent)) >= 0) {
+    vlan.vid = static_cast<uint16_t>(vid);
+    vlan.ifindex = ifi->ifi_index;
+  } else {
+    group = iface_group(ifname);
+    vlan = vlan_link{};
+  }
+  const iface *cur = iface_find(ifname);
+  /* after a reload an attached interface may be unwanted or in another group */
+  bool stale = cur != NULL &&
+               (trunk || group != cur->group || vlan.trunk != cur->vlan.trunk || !up);
+  pthread_rwlock_unlock(&ifaces_lock);
+
+  if (trunk) {
+    if (up) {
+      trunk_attach(ifname, fileSystem, context, clock);
+    } else {
+      trunk_detach(ifname);
+    }
+  } else {
+    trunk_detach(ifname); /* no more a trunk after a reload */
+  }
+
+  if (stale) {
+    link_detach(ifname, context, clock);
+  }
+  if (up && !trunk && group >= 0) {
+    link_attach(ifname, group, vlan, fileSystem, context, clock);
+  }
+}
+
+/* Detach the interfaces and trunks that no longer exist; a dump does not
+ * show them, when their RTM_DELLINK was lost */
+static void link_prune(Context &context, Clock &clock) {
+  std::vector<std::string> gone;
+
+  pthread_rwlock_rdlock(&ifaces_lock);
+  for (const auto *it : ifaces) {
+    if (if_nametoindex(it->name) == 0) {
+      gone.emplace_back(it->name);
+    }
+  }
+  pthread_rwlock_unlock(&ifaces_lock);
+  for (const auto *it : trunks) {
+    if (if_nametoindex(it->name) == 0) {
+      gone.emplace_back(it->name);
+    }
+  }
+  for (const auto &name : gone) {
+    link_detach(name.c_str(), context, clock);
+    trunk_detach(name.c_str());
+  }
+}
+
+/* Ask for a dump of all links, seq 1 for the first one and 2 for those
+ * of a reload; the answers arrive at link_thread() */
+static bool link_dump(int sock, uint32_t seq) {
+  struct {
+    struct nlmsghdr nlh;
+    struct ifinfomsg ifi;
+  } req = {};
+
+  req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+  req.nlh.nlmsg_type = RTM_GETLINK;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nlh.nlmsg_seq = seq;
+  req.ifi.ifi_family = AF_UNSPEC;
+  if (send(sock, &req, req.nlh.nlmsg_len, 0) < 0) {
+    syslog(LOG_ERR, "error: netlink RTM_GETLINK: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/* Dump the links again, so that link_event() sees every link after a
+ * reload */
+void link_resync() {
+  int sock = link_sock;
+
+  if (sock >= 0) {
+    link_dump(sock, 2);
+  }
+}
+
+/* Link monitor: attaches interfaces matching the command line, and the
+ * VLANs of trunks, as they come up and detaches them when they go down or
+ * are removed */
+void *link_thread(FileSystem &fileSystem, Context &context, Clock &clock) {
+  struct sockaddr_nl snl = {};
+  char buf[16384];
+  bool resync_pending = false;
+  int sock;
+
+  /* after a handover the subscription carries on; the dump below brings
+   * the new instance in sync with links that changed in between */
+  if ((sock = handover_take(HANDOVER_LINK, "")) < 0) {
+    if ((sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+      syslog(LOG_ERR, "error: netlink socket: %s", strerror(errno));
+      exit(1);
+    }
+
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = RTMGRP_LINK;
+    if (bind(sock, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+      syslog(LOG_ERR, "error: netlink bind: %s", strerror(errno));
+      exit(1);
+    }
+  }
+  handover_register(HANDOVER_LINK, "", sock);
+  link_sock = sock;
+
+  /* Subscribed before the dump, so no link change gets lost in between */
+  if (!link_dump(sock, 1)) {
+    exit(1);
+  }
+
+  while (true) {
+    ssize_t len = recv(sock, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOBUFS) {
+        /* lost events, maybe the only one of a link that went down: a
+         * dump brings us in sync, after the running one if busy */
+        syslog(LOG_WARNING, "netlink: link events lost, dumping the links again");
+        link_dump(sock, 2);
+        continue;
+      }
+      syslog(LOG_ERR, "error: netlink recv: %s", strerror(errno));
+      exit(1);
+    }
+
+    int remaining = static_cast<int>(len);
+    for (auto *nlh = reinterpret_cast<struct nlmsghdr *>(buf); NLMSG_OK(nlh, remaining);
+         nlh = NLMSG_NEXT(nlh, remaining)) {
+      if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK) {
+        link_event(nlh, fileSystem, context, clock);
+      } else if (nlh->nlmsg_type == NLMSG_ERROR && nlh->nlmsg_seq == 2) {
+        /* the socket runs one dump at a time; a reload's that came while
+         * another was running is asked for again once that one is done */
+        int error = static_cast<struct nlmsgerr *>(NLMSG_DATA(nlh))->error;
+        if (error == -EBUSY) {
+          resync_pending = true;
+        } else if (error != 0) {
+          syslog(LOG_ERR, "error: netlink RTM_GETLINK: %s", strerror(-error));
+        }
+      } else if (nlh->nlmsg_type == NLMSG_DONE) {
+        link_prune(context, clock);
+        if (nlh->nlmsg_seq == 1) {
+          /* what the previous instance had for interfaces, trunks or
+           * workers we no longer run must go: packet sockets would keep
+           * their share of the fanout group's frames unread, responders
+           * go on answering in the kernel */
+          handover_close(HANDOVER_ARP);
+          handover_close(HANDOVER_TRUNK);
+          handover_close(HANDOVER_XDP);
+          link_synced = true;
+        }
+        if (resync_pending) {
+          resync_pending = false;
+          link_dump(sock, 2);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,120 @@
+#include <catch2/catch.hpp>
+
+#include "parprouted.h"
+
+namespace {
+
+using namespace std::string_literals;
+
+constexpr const char *TAGS = "log";
+
+template <typename... Args> std::string format(size_t len, const char *fmt, const Args &...args) {
+  log_record rec{};
+  int i = 0;
+  rec.fmt = fmt;
+  rec.nargs = sizeof...(args);
+  (log_put(rec.args[i++], args), ...);
+  std::vector<char> buf(len);
+  log_format(rec, buf.data(), len);
+  return buf.data();
+}
+
+TEST_CASE("log-test", TAGS) {
+  log_flush();
+  stats.log_dropped = 0;
+  log_level = LOG_INFO;
+
+  SECTION("formatting") {
+    GIVEN("addresses") {
+      THEN("they are formatted with %s, each on its own") {
+        CHECK(format(128, "Replying to %s faking %s", in_addr{htonl(0x0a000001)},
+                     in_addr{htonl(0x0a000002)}) == "Replying to 10.0.0.1 faking 10.0.0.2"s);
+      }
+    }
+    GIVEN("integers with length modifiers") {
+      THEN("they are formatted as given") {
+        CHECK(format(128, "%zu %ld %d %u %x %05d %c", size_t{7}, -8L, -9, 10U, 255, 42, 'A') ==
+              "7 -8 -9 10 ff 00042 A"s);
+      }
+    }
+    GIVEN("strings") {
+      char ifname[ARP_TABLE_ENTRY_LEN] = "eth0";
+      THEN("they are copied") {
+        CHECK(format(128, "%s(%s) %-5s|", "10.0.0.1", ifname, "a") == "10.0.0.1(eth0) a    |"s);
+      }
+      THEN("long ones are cut") {
+        CHECK(format(256, "%s", std::string(100, 'x').c_str()) ==
+              std::string(LOG_STR_LEN - 1, 'x'));
+      }
+    }
+    GIVEN("a percent sign, a double and a bool") {
+      THEN("they are formatted") {
+        CHECK(format(128, "100%% %.1f %d", 0.25, true) == "100% 0.2 1"s);
+      }
+    }
+    GIVEN("a format that does not match the arguments") {
+      THEN("arguments are printed as their type, missing ones as the conversion") {
+        CHECK(format(128, "%d %s %s", "eth0", 5, in_addr{htonl(0x7f000001)}) ==
+              "eth0 5 127.0.0.1"s);
+        CHECK(format(128, "%s %d", "eth0") == "eth0 %d"s);
+      }
+    }
+    GIVEN("a small buffer") {
+      THEN("the output is cut") { CHECK(format(8, "%s and %s", "eth0", "eth1") == "eth0 an"s); }
+    }
+  }
+
+  SECTION("ring") {
+    GIVEN("records below the level") {
+      for (int i = 0; i < LOG_RING_SIZE + 10; i++) {
+        LOG(LOG_DEBUG, "record %d", i);
+      }
+      log_flush();
+      THEN("they are not written") { CHECK(stats.log_dropped == 0); }
+    }
+    GIVEN("more records than the ring holds") {
+      for (int i = 0; i < LOG_RING_SIZE + 10; i++) {
+        LOG(LOG_INFO, "record %d", i);
+      }
+      log_flush();
+      THEN("the excess is dropped and counted") { CHECK(stats.log_dropped == 10); }
+      AND_WHEN("the ring was drained") {
+        for (int i = 0; i < LOG_RING_SIZE; i++) {
+          LOG(LOG_INFO, "record %d", i);
+        }
+        log_flush();
+        THEN("it takes records again") { CHECK(stats.log_dropped == 10); }
+      }
+    }
+    GIVEN("records of other threads") {
+      for (int t = 0; t < 4; t++) {
+        std::thread([] {
+          for (int i = 0; i < LOG_RING_SIZE; i++) {
+            LOG(LOG_INFO, "record %d", i);
+          }
+        }).join();
+      }
+      log_flush();
+      THEN("each thread has a ring of its own") { CHECK(stats.log_dropped == 0); }
+    }
+  }
+
+  SECTION("runtime verbosity") {
+    WHEN("raised") {
+      log_more(0);
+      log_more(0);
+      log_more(0);
+      THEN("it stops at LOG_TRACE") { CHECK(log_level == LOG_TRACE); }
+    }
+    WHEN("lowered") {
+      for (int i = 0; i < 10; i++) {
+        log_less(0);
+      }
+      THEN("errors are still logged") { CHECK(log_level == LOG_ERR); }
+    }
+  }
+
+  log_level = LOG_INFO;
+}
+
+} // namespace
@@ -0,0 +1,283 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* Asynchronous logging.
+ *
+ * Every thread that logs owns a single producer, single consumer ring of
+ * log_records; the drainer is the consumer. A record is claimed at head,
+ * filled and published by advancing head; the drainer copies the records
+ * between tail and head and advances tail. No lock is taken and no string
+ * is formatted on the logging thread, and a full ring drops the record
+ * instead of waiting. Rings outlive their threads and are reused, once
+ * drained, by the next thread that logs. */
+
+#include "parprouted.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdarg>
+#include <mutex>
+#include <vector>
+
+std::atomic<int> log_level{LOG_INFO};
+
+namespace {
+
+struct log_ring {
+  std::array<log_record, LOG_RING_SIZE> records;
+  std::atomic<uint64_t> head{}; /* advanced by the owner */
+  std::atomic<uint64_t> tail{}; /* advanced by the drainer */
+  std::atomic<unsigned long> dropped{};
+  std::atomic<bool> owned{};
+};
+
+std::mutex rings_mutex;
+std::vector<log_ring *> rings;
+
+/* Gives the ring back when its thread exits */
+struct ring_owner {
+  log_ring *ring = nullptr;
+  ~ring_owner() {
+    if (ring != nullptr) {
+      ring->owned.store(false, std::memory_order_release);
+      ring = nullptr;
+    }
+  }
+};
+
+thread_local ring_owner owner;
+
+log_ring *log_ring_get() {
+  if (owner.ring == nullptr) {
+    std::lock_guard lock(rings_mutex);
+    for (auto *ring : rings) {
+      /* not before the drainer has caught up with the last owner */
+      if (!ring->owned.load(std::memory_order_acquire) &&
+          ring->tail.load(std::memory_order_acquire) ==
+              ring->head.load(std::memory_order_relaxed)) {
+        owner.ring = ring;
+        break;
+      }
+    }
+    if (owner.ring == nullptr) {
+      owner.ring = new log_ring; /* pages are touched as records are written */
+      rings.push_back(owner.ring);
+    }
+    owner.ring->owned.store(true, std::memory_order_relaxed);
+  }
+  return owner.ring;
+}
+
+/* Append to buf at n with a format built at runtime, as snprintf(3) */
+void log_append(char *buf, size_t len, size_t &n, const char *fmt, ...) {
+  va_list ap;
+  if (n + 1 >= len) {
+    return;
+  }
+  va_start(ap, fmt);
+  int ret = vsnprintf(buf + n, len - n, fmt, ap);
+  va_end(ap);
+  if (ret > 0) {
+    n = std::min(n + static_cast<size_t>(ret), len - 1);
+  }
+}
+
+} // namespace
+
+log_record *log_claim() {
+  log_ring *ring = log_ring_get();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  struct timespec ts;
+
+  if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return NULL;
+  }
+
+  log_record *rec = &ring->records[head % LOG_RING_SIZE];
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  rec->tstamp = int64_t{ts.tv_sec} * 1000000000 + ts.tv_nsec;
+  return rec;
+}
+
+void log_commit() {
+  log_ring *ring = owner.ring;
+  ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/* Conversions are taken from the format, the argument types from the
+ * record; an argument that does not fit its conversion is printed as
+ * its own type, so a wrong format cannot read garbage */
+int log_format(const log_record &rec, char *buf, size_t len) {
+  char spec[32];
+  char ip[INET_ADDRSTRLEN];
+  size_t n = 0;
+  int arg = 0;
+
+  if (len == 0) {
+    return 0;
+  }
+  buf[0] = '\0';
+
+  for (const char *p = rec.fmt; *p != '\0' && n + 1 < len; p++) {
+    if (*p != '%') {
+      buf[n++] = *p;
+      buf[n] = '\0';
+      continue;
+    }
+    if (p[1] == '%') {
+      buf[n++] = *++p;
+      buf[n] = '\0';
+      continue;
+    }
+
+    /* flags, width and precision are kept, length modifiers dropped */
+    size_t s = 0;
+    spec[s++] = '%';
+    while (*++p != '\0' && strchr("-+ #0123456789.", *p) != NULL && s < sizeof(spec) - 5) {
+      spec[s++] = *p;
+    }
+    while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+      p++;
+    }
+    if (*p == '\0') {
+      break;
+    }
+    char conv = *p;
+    spec[s] = '\0';
+
+    if (arg >= rec.nargs) {
+      log_append(buf, len, n, "%s%c", spec, conv);
+      continue;
+    }
+
+    const log_arg &a = rec.args[arg++];
+    switch (a.type) {
+    case LOG_ARG_IP:
+      inet_ntop(AF_INET, &a.ip, ip, sizeof(ip));
+      strcpy(spec + s, "s");
+      log_append(buf, len, n, spec, ip);
+      break;
+    case LOG_ARG_STR:
+      strcpy(spec + s, "s");
+      log_append(buf, len, n, spec, a.str);
+      break;
+    case LOG_ARG_DOUBLE:
+      if (strchr("feEgGaA", conv) != NULL) {
+        spec[s++] = conv;
+        spec[s] = '\0';
+      } else {
+        strcpy(spec + s, "g");
+      }
+      log_append(buf, len, n, spec, a.d);
+      break;
+    case LOG_ARG_INT:
+    case LOG_ARG_UINT:
+      if (conv == 'c') {
+        strcpy(spec + s, "c");
+        log_append(buf, len, n, spec, static_cast<int>(a.i));
+      } else if (strchr("uxXo", conv) != NULL) {
+        snprintf(spec + s, sizeof(spec) - s, "ll%c", conv);
+        log_append(buf, len, n, spec, a.u);
+      } else if (a.type == LOG_ARG_INT) {
+        strcpy(spec + s, "lld");
+        log_append(buf, len, n, spec, a.i);
+      } else {
+        strcpy(spec + s, "llu");
+        log_append(buf, len, n, spec, a.u);
+      }
+      break;
+    }
+  }
+  return static_cast<int>(n);
+}
+
+void log_flush() {
+  static std::mutex flush_mutex;
+  static std::vector<log_record> pending;
+  static int last_level = log_level;
+  unsigned long dropped = 0;
+  char buf[512];
+
+  std::lock_guard flush_lock(flush_mutex);
+  {
+    std::lock_guard lock(rings_mutex);
+    for (auto *ring : rings) {
+      uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      for (; tail != head; tail++) {
+        pending.push_back(ring->records[tail % LOG_RING_SIZE]);
+      }
+      ring->tail.store(tail, std::memory_order_release);
+      dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+  }
+
+  /* each ring is in order, the threads are interleaved by time */
+  std::stable_sort(pending.begin(), pending.end(),
+                   [](const log_record &a, const log_record &b) { return a.tstamp < b.tstamp; });
+
+  for (const auto &rec : pending) {
+    /* a trailing newline is dropped, as syslog(3) does */
+    int n = log_format(rec, buf, sizeof(buf));
+    if (n > 0 && buf[n - 1] == '\n') {
+      buf[n - 1] = '\0';
+    }
+    if (rec.level >= LOG_DEBUG && debug) {
+      printf("%lld.%06lld %s\n", static_cast<long long>(rec.tstamp / 1000000000),
+             static_cast<long long>(rec.tstamp % 1000000000 / 1000), buf);
+    } else {
+      syslog(std::min(rec.level, LOG_DEBUG), "%s", buf);
+    }
+  }
+  if (!pending.empty() && debug) {
+    fflush(stdout);
+  }
+  pending.clear();
+
+  if (dropped > 0) {
+    stats.log_dropped += dropped;
+    syslog(LOG_WARNING, "log: %lu records dropped", dropped);
+  }
+  /* the signal handlers cannot log themselves */
+  if (log_level != last_level) {
+    last_level = log_level;
+    syslog(LOG_INFO, "Log level %d.", last_level);
+  }
+}
+
+void *log_thread(Clock &clock) {
+  while (true) {
+    clock.sleep_for(std::chrono::microseconds(LOG_INTERVAL));
+    log_flush();
+  }
+}
+
+void log_more(int /* unused */) {
+  int level = log_level.load();
+  if (level < LOG_TRACE) {
+    log_level.store(level + 1);
+  }
+}
+
+void log_less(int /* unused */) {
+  int level = log_level.load();
+  if (level > LOG_ERR) {
+    log_level.store(level - 1);
+  }
+}
@@ -0,0 +1,133 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include "clock.h"
+
+#include <netinet/in.h>
+#include <syslog.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#define LOG_TRACE (LOG_DEBUG + 1) /* every frame, more than -d */
+#define LOG_RING_SIZE 512         /* records per thread; when full, records are dropped */
+#define LOG_ARGS 6                /* max arguments per record */
+#define LOG_STR_LEN 64            /* string arguments are cut to this */
+#define LOG_INTERVAL 100000       /* us between drains */
+
+/* A log record holds the format and its arguments in binary; the drainer
+ * formats it later, so that logging costs a receive thread no more than
+ * a few stores. Addresses are formatted with inet_ntop(), no inet_ntoa()
+ * buffer is shared between threads. */
+enum log_arg_type : uint8_t { LOG_ARG_INT, LOG_ARG_UINT, LOG_ARG_DOUBLE, LOG_ARG_IP, LOG_ARG_STR };
+
+struct log_arg {
+  log_arg_type type;
+  union {
+    long long i;
+    unsigned long long u;
+    double d;
+    struct in_addr ip;
+    char str[LOG_STR_LEN];
+  };
+};
+
+struct log_record {
+  int64_t tstamp; /* CLOCK_MONOTONIC, ns */
+  int level;
+  const char *fmt; /* printf(3) format, must be a string literal */
+  int nargs;
+  log_arg args[LOG_ARGS];
+};
+
+/* Records above this syslog(3) level are discarded at the call site;
+ * -d raises it to LOG_DEBUG, SIGRTMIN and SIGRTMIN+1 move it at runtime */
+extern std::atomic<int> log_level;
+
+inline void log_put(log_arg &arg, struct in_addr ip) {
+  arg.type = LOG_ARG_IP;
+  arg.ip = ip;
+}
+
+inline void log_put(log_arg &arg, const char *str) {
+  arg.type = LOG_ARG_STR;
+  strncpy(arg.str, str ? str : "(null)", LOG_STR_LEN - 1);
+  arg.str[LOG_STR_LEN - 1] = '\0';
+}
+
+inline void log_put(log_arg &arg, double d) {
+  arg.type = LOG_ARG_DOUBLE;
+  arg.d = d;
+}
+
+template <typename T>
+  requires std::is_integral_v<T> || std::is_enum_v<T>
+inline void log_put(log_arg &arg, T v) {
+  if constexpr (std::is_signed_v<T>) {
+    arg.type = LOG_ARG_INT;
+    arg.i = static_cast<long long>(v);
+  } else {
+    arg.type = LOG_ARG_UINT;
+    arg.u = static_cast<unsigned long long>(v);
+  }
+}
+
+/* The next free record of the calling thread's ring, NULL if it is full;
+ * log_commit() hands it to the drainer */
+extern log_record *log_claim();
+extern void log_commit();
+
+template <typename... Args> void log_write(int level, const char *fmt, const Args &...args) {
+  static_assert(sizeof...(args) <= LOG_ARGS, "too many log arguments");
+  log_record *rec = log_claim();
+  if (rec == nullptr) {
+    return;
+  }
+  int i = 0;
+  rec->level = level;
+  rec->fmt = fmt;
+  rec->nargs = sizeof...(args);
+  (log_put(rec->args[i++], args), ...);
+  log_commit();
+}
+
+/* syslog(3) replacement for the receive and main threads */
+#define LOG(level, ...)                                                                           \
+  do {                                                                                            \
+    if ((level) <= log_level.load(std::memory_order_relaxed)) {                                   \
+      log_write(level, __VA_ARGS__);                                                              \
+    }                                                                                             \
+  } while (0)
+
+/* Format a record into buf, as snprintf(3) */
+extern int log_format(const log_record &rec, char *buf, size_t len);
+
+/* Format and write out the records of all threads in time order: up to
+ * LOG_INFO to syslog, debug records to stdout when in the foreground */
+extern void log_flush();
+
+/* Drainer, calls log_flush() every LOG_INTERVAL */
+extern void *log_thread(Clock &clock);
+
+/* SIGRTMIN and SIGRTMIN+1 handlers */
+extern void log_more(int);
+extern void log_less(int);
@@ -1,47 +1,46 @@
 #include "parprouted.h"
 
+#include "clock.h"
+#include "config.h"
 #include "context.h"
+#include "control.h"
 #include "fs.h"
+#include "handover.h"
+#include "xdp.h"
 
 #include <string>
 #include <thread>
 
 std::string progname{};
 
-int last_thread_idx = -1;
-std::thread my_threads[MAX_IFACES + 1];
-
 int main(int argc, char **argv) {
   pid_t child_pid;
-  int i;
-  bool help = true;
+  config cfg;
+  std::string error;
 
   progname = basename(argv[0]);
+  handover_argv = argv;
 
-  for (i = 1; i < argc; i++) {
-    if (!strcmp(argv[i], "-d")) {
-      debug = true;
-      help = false;
-    } else if (!strcmp(argv[i], "-p")) {
-      option_arpperm = true;
-      help = false;
-    } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
-      break;
-    } else {
-      last_iface_idx++;
-      ifaces[last_iface_idx] = argv[i];
-      help = false;
-    }
-  }
+  /* started by a running instance handing over to us */
+  const char *handover = getenv(HANDOVER_ENV);
 
-  if (help || last_iface_idx <= -1) {
+  if (!config_args(cfg, argc, argv, error) ||
+      (cfg.iface_patterns.empty() && cfg.trunk_patterns.empty())) {
+    if (!error.empty()) {
+      fprintf(stderr, "%s\n", error.c_str());
+    }
     printf("parprouted: proxy ARP routing daemon, version %s.\n", VERSION);
     printf("(C) 2007 Vladimir Ivaschenko <vi@maks.net>, GPL2 license.\n");
-    printf("Usage: parprouted [-d] [-p] interface [interface]\n");
+    printf("Usage: parprouted [-d] [-v] [-p] [-a] [-c file] [-f workers] [-m entries]\n"
+           "                 [-r interface:rate[/burst]] [-s interface:[!]prefix/len]\n"
+           "                 [-t table[:protocol]] [-T trunk] [-g group] [-C socket] [-x]\n"
+           "                 interface|pattern [interface|pattern]\n");
     exit(1);
   }
+  debug = cfg.debug;
 
-  if (!debug) {
+  /* after a handover we are already in the background */
+  if (!debug && handover == NULL) {
     /* fork to go into the background */
     if ((child_pid = fork()) < 0) {
       fprintf(stderr, "could not fork(): %s", strerror(errno));
@@ -77,26 +76,42 @@ int main(int argc, char **argv) {
 
   signal(SIGINT, sighandler);
   signal(SIGTERM, sighandler);
-  signal(SIGHUP, sighandler);
+  signal(SIGHUP, reloadhandler);
 
   pthread_mutex_init(&arptab_mutex, NULL);
   pthread_mutex_init(&req_queue_mutex, NULL);
 
+  config_apply(cfg, false);
+
   auto fileSystem = makeFileSystem();
   auto context = makeContext();
+  auto clock = makeClock();
 
-  my_threads[++last_thread_idx] =
-      std::thread(main_thread, std::ref(*fileSystem), std::ref(*context));
-
-  for (i = 0; i <= last_iface_idx; i++) {
-    my_threads[++last_thread_idx] =
-        std::thread(arp_thread, ifaces[i], std::ref(*fileSystem), std::ref(*context));
-    if (debug) {
-      printf("Created ARP thread for %s.\n", ifaces[i]);
+  if (handover != NULL) {
+    int fd = atoi(handover);
+    unsetenv(HANDOVER_ENV);
+    if (!handover_accept(fd)) {
+      syslog(LOG_ERR, "Handover failed, the running instance carries on.");
+      exit(1);
     }
   }
 
-  my_threads[0].join();
+  /* the maps are there before the first interface is attached */
+  if (option_xdp && !xdp_open()) {
+    syslog(LOG_ERR, "No XDP, all requests are answered in userspace.");
+    option_xdp = false;
+  }
+
+  std::thread main_loop(main_thread, std::ref(*fileSystem), std::ref(*context), std::ref(*clock));
+  /* attaches the interfaces as they come up */
+  std::thread(link_thread, std::ref(*fileSystem), std::ref(*context), std::ref(*clock)).detach();
+  std::thread(garp_thread, std::ref(*context), std::ref(*clock)).detach();
+  std::thread(log_thread, std::ref(*clock)).detach();
+  if (!option_control.empty()) {
+    std::thread(control_thread, std::ref(*context), std::ref(*clock)).detach();
+  }
+
+  main_loop.join();
 
   while (waitpid(-1, NULL, WNOHANG)) {
   }
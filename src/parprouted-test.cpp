@@ -1,5 +1,6 @@
 #include <catch2/catch.hpp>
 
+#include "clock-mock.h"
 #include "context-mock.h"
 #include "fs-mock.h"
 #include "parprouted.h"
@@ -20,10 +21,16 @@ TEST_CASE("parprouted-test", TAGS) {
       free(std::exchange(list, list->next));
     }
   }(arptab);
+  arptab_len = 0;
+  proc_poll = {};
 
   CHECK(arptab == nullptr);
   FileSystemMock fileSystem{};
   ContextMock context{};
+  ClockMock clock{};
+
+  auto now = Clock::time_point{std::chrono::hours(24)};
+  ALLOW_CALL(clock, now()).LR_RETURN(now);
 
   SECTION("route_remove") {
     GIVEN("entry with added route") {
@@ -159,11 +166,11 @@ TEST_CASE("parprouted-test", TAGS) {
     }
 
     GIVEN("cache with 2 entries: ip1@dev0, ip1@dev1") {
-      auto createEntry = [](auto &&ip, auto &&dev) {
+      auto createEntry = [&now](auto &&ip, auto &&dev) {
         auto entry = replace_entry(ip, dev);
         strcpy(entry->ifname, dev);
         entry->ipaddr_ia = ip;
-        entry->tstamp = time(NULL);
+        entry->tstamp = now;
         return entry;
       };
       [[maybe_unused]] auto entry1 = createEntry(ip1, dev0);
@@ -185,14 +192,14 @@ TEST_CASE("parprouted-test", TAGS) {
           REQUIRE_CALL(context,
                        system(eq("/sbin/ip route add 0.0.0.1/32 metric 50 dev dev0 scope link"s)))
               .RETURN(0);
-          processarp(context, false);
+          processarp(context, clock, false);
           THEN("entry2 is removed / entry1 route active") {
             CHECK(sizeCache() == 1);
             CHECK(replace_entry(ip1, dev0) == entry1);
             CHECK(entry1->route_added == true);
           }
           WHEN("calling processarp again") {
-            processarp(context, false);
+            processarp(context, clock, false);
             THEN("route is not added again") { CHECK(true); }
           }
         }
@@ -207,19 +214,31 @@ TEST_CASE("parprouted-test", TAGS) {
           REQUIRE_CALL(context,
                        system(eq("/sbin/ip route del 0.0.0.1/32 metric 50 dev dev1 scope link"s)))
               .RETURN(0);
-          processarp(context, false);
+          processarp(context, clock, false);
           THEN("both entries removed") { CHECK(emptyCache()); }
         }
       }
+      WHEN("dev1 is in another bridge group") {
+        entry2->group = 1;
+        THEN("each group knows its own host") {
+          CHECK(findentry(ip1, 0) == 1);
+          CHECK(findentry(ip1, 1) == 1);
+          CHECK(findentry(ip1, 2) == 0);
+        }
+        THEN("remove_other_routes leaves the other group alone") {
+          CHECK(remove_other_routes(ip1, "dev3") == 1);
+          CHECK(entry1->want_route == false);
+          CHECK(entry2->want_route == true);
+        }
+      }
     }
 
     GIVEN("2 expired entries") {
-      auto now = time(NULL);
-      auto createExpiredEntry = [now](auto &&ip, auto &&dev) {
+      auto createExpiredEntry = [&now](auto &&ip, auto &&dev) {
         auto entry = replace_entry(ip, dev);
         strcpy(entry->ifname, dev);
         entry->ipaddr_ia = ip;
-        entry->tstamp = now - 2 * ARP_TABLE_ENTRY_TIMEOUT;
+        entry->tstamp = now - 2 * std::chrono::seconds(ARP_TABLE_ENTRY_TIMEOUT);
         return entry;
       };
       [[maybe_unused]] auto entry1 = createExpiredEntry(ip1, dev0);
@@ -233,12 +252,160 @@ TEST_CASE("parprouted-test", TAGS) {
         REQUIRE_CALL(context,
                      system(eq("/sbin/ip route del 0.0.0.2/32 metric 50 dev dev1 scope link"s)))
             .RETURN(0);
-        processarp(context, false);
+        processarp(context, clock, false);
         THEN("cache is empty") { CHECK(emptyCache()); }
       }
     }
   }
 
+  SECTION("expiry follows the injected clock") {
+    GIVEN("entry with added route") {
+      auto entry = replace_entry(ip1, dev0);
+      strcpy(entry->ifname, dev0);
+      entry->ipaddr_ia = ip1;
+      entry->tstamp = now;
+      entry->route_added = true;
+
+      WHEN("just before the timeout") {
+        now += std::chrono::seconds(ARP_TABLE_ENTRY_TIMEOUT) - std::chrono::milliseconds(1);
+        processarp(context, clock, false);
+        THEN("entry is kept") { CHECK(sizeCache() == 1); }
+      }
+      WHEN("just after the timeout") {
+        now += std::chrono::seconds(ARP_TABLE_ENTRY_TIMEOUT) + std::chrono::milliseconds(1);
+        REQUIRE_CALL(context,
+                     system(eq("/sbin/ip route del 0.0.0.1/32 metric 50 dev dev0 scope link"s)))
+            .RETURN(0);
+        processarp(context, clock, false);
+        THEN("entry is removed") { CHECK(emptyCache()); }
+      }
+    }
+  }
+
+  SECTION("expiry follows the policy of the interface") {
+    policy_rules = {{"dev1", 5, {}, {}, {}}};
+    auto *it = iface_add(dev1);
+    for (auto [ip, dev] : {std::pair{ip1, dev0}, std::pair{ip2, dev1}}) {
+      auto entry = replace_entry(ip, dev);
+      strcpy(entry->ifname, dev);
+      entry->ipaddr_ia = ip;
+      entry->tstamp = now;
+      entry->want_route = entry->route_added = true;
+    }
+    now += std::chrono::seconds(6);
+    REQUIRE_CALL(context,
+                 system(eq("/sbin/ip route del 0.0.0.2/32 metric 50 dev dev1 scope link"s)))
+        .RETURN(0);
+    processarp(context, clock, false);
+    THEN("only the entry of the short-lived interface is removed") {
+      REQUIRE(sizeCache() == 1);
+      CHECK(arptab->ipaddr_ia.s_addr == ip1.s_addr);
+    }
+    delete iface_remove(it->name);
+    policy_rules.clear();
+  }
+
+  SECTION("bounded arptab") {
+    option_max_entries = 2;
+    auto createEntry = [&now](auto &&ip, auto &&dev, auto age, bool incomplete) {
+      auto entry = replace_entry(ip, dev);
+      strcpy(entry->ifname, dev);
+      entry->ipaddr_ia = ip;
+      entry->tstamp = now - age;
+      entry->incomplete = incomplete;
+      return entry;
+    };
+    auto evictions = stats.arptab_evictions.load();
+    in_addr ip3{htonl(0x00000003)};
+    in_addr ip4{htonl(0x00000004)};
+
+    GIVEN("full table with a complete and an incomplete entry") {
+      auto entry1 = createEntry(ip1, dev0, std::chrono::seconds(10), false);
+      createEntry(ip2, dev0, std::chrono::seconds(1), true);
+      entry1->route_added = true;
+
+      WHEN("adding a third entry") {
+        createEntry(ip3, dev0, std::chrono::seconds(0), false);
+        THEN("the incomplete entry is evicted first") {
+          CHECK(sizeCache() == 2);
+          CHECK(arptab_len == 2);
+          CHECK(findentry(ip1) == 1);
+          CHECK(findentry(ip2) == 0);
+          CHECK(stats.arptab_evictions == evictions + 1);
+        }
+        AND_WHEN("adding a fourth entry") {
+          createEntry(ip4, dev0, std::chrono::seconds(0), false);
+          THEN("the least recently seen entry is evicted") {
+            CHECK(findentry(ip1) == 0);
+            CHECK(findentry(ip3) == 1);
+            CHECK(findentry(ip4) == 1);
+          }
+          ALLOW_CALL(context, system(_)).RETURN(0);
+          REQUIRE_CALL(context,
+                       system(eq("/sbin/ip route del 0.0.0.1/32 metric 50 dev dev0 scope link"s)))
+              .RETURN(0);
+          processarp(context, clock, false); // withdraws the route of the evicted entry
+        }
+      }
+    }
+    option_max_entries = ARPTAB_MAX_ENTRIES;
+  }
+
+  SECTION("interface detach") {
+    GIVEN("routes on dev0 and dev1") {
+      auto createEntry = [&now](auto &&ip, auto &&dev) {
+        auto entry = replace_entry(ip, dev);
+        strcpy(entry->ifname, dev);
+        entry->ipaddr_ia = ip;
+        entry->tstamp = now;
+        entry->route_added = true;
+        return entry;
+      };
+      [[maybe_unused]] auto entry1 = createEntry(ip1, dev0);
+      [[maybe_unused]] auto entry2 = createEntry(ip2, dev1);
+
+      WHEN("dev0 is withdrawn") {
+        REQUIRE_CALL(context,
+                     system(eq("/sbin/ip route del 0.0.0.1/32 metric 50 dev dev0 scope link"s)))
+            .RETURN(0);
+        iface_withdraw(dev0, context, clock);
+        THEN("only its routes are removed at once") {
+          CHECK(sizeCache() == 1);
+          CHECK(findentry(ip2) == 1);
+        }
+      }
+    }
+  }
+
+  SECTION("interface registry") {
+    iface_patterns = {{"eth0", 0}, {"wlan*", 0}, {"eth*", 1}};
+    CHECK(iface_group("eth0") == 0);
+    CHECK(iface_group("wlan12") == 0);
+    CHECK(iface_group("eth1") == 1);
+    CHECK(iface_group("ppp0") == -1);
+    CHECK(trunk_group("eth0") == -1);
+
+    auto *it = iface_add("wlan0");
+    REQUIRE(it != nullptr);
+    CHECK(iface_add("wlan0") == nullptr);
+    CHECK(ifaces.size() == 1);
+    CHECK(iface_find("wlan0") == it);
+    CHECK(iface_find("wlan1") == nullptr);
+    CHECK(iface_remove("wlan0") == it);
+    CHECK(iface_remove("wlan0") == nullptr);
+    CHECK(ifaces.empty());
+    delete it;
+
+    it = iface_add("eth0.10", 1, vlan_link{.trunk = 2, .vid = 10, .ifindex = 5, .hwaddr = {}});
+    REQUIRE(it != nullptr);
+    CHECK(it->group == 1);
+    CHECK(it->vlan.trunk == 2);
+    CHECK(it->vlan.vid == 10);
+    CHECK(it->workers.empty());
+    delete iface_remove("eth0.10");
+    iface_patterns.clear();
+  }
+
   SECTION("parseproc") {
     trompeloeil::sequence seq;
 
@@ -261,7 +428,119 @@ TEST_CASE("parprouted-test", TAGS) {
         .IN_SEQUENCE(seq);
     REQUIRE_CALL(fileSystem, feof(_)).RETURN(true).IN_SEQUENCE(seq);
     REQUIRE_CALL(fileSystem, fclose(_)).RETURN(0);
-    parseproc(fileSystem, context);
+    parseproc(fileSystem, context, clock);
+    THEN("the new host has the table polled soon") {
+      CHECK(proc_poll.changed);
+      CHECK(proc_poll.churn);
+      CHECK(poll_next(proc_poll) == POLL_MIN);
+    }
+  }
+
+  SECTION("parseproc asks again for unresolved addresses") {
+    std::vector<std::string> lines;
+    size_t next = 0;
+    ALLOW_CALL(fileSystem, fopen(_, _)).RETURN(reinterpret_cast<FILE *>(0xdeadbeef));
+    ALLOW_CALL(fileSystem, feof(_)).LR_RETURN(next >= lines.size());
+    ALLOW_CALL(fileSystem, fgets(_, _, _))
+        .LR_SIDE_EFFECT(std::strcpy(_1, lines[next++].c_str()))
+        .RETURN(_1);
+    ALLOW_CALL(fileSystem, fclose(_)).RETURN(0);
+    auto parse = [&] {
+      lines = {"IP address       HW type     Flags       HW address            Mask     Device",
+               "10.0.0.9         0x1         0x0         00:00:00:00:00:00     *        wlan0"};
+      next = 0;
+      parseproc(fileSystem, context, clock);
+    };
+
+    policy_rules = {{"wlan0", {}, {}, 3, {}}};
+    auto *it = iface_add("wlan0");
+    int requests = 0;
+    /* the requests fail on the socket, they are counted all the same */
+    ALLOW_CALL(context, socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ARP)))
+        .LR_SIDE_EFFECT(requests++)
+        .RETURN(-1);
+    ALLOW_CALL(context, ioctl3(-1, _, _)).RETURN(-1);
+    ALLOW_CALL(context, close(-1)).RETURN(0);
+
+    parse();
+    CHECK(requests == 1);
+    parse();
+    THEN("not before the retry time") { CHECK(requests == 1); }
+    for (int i = 0; i < 5; i++) {
+      now += std::chrono::seconds(PROBE_RETRY_TIME);
+      parse();
+    }
+    THEN("as often as the policy says") { CHECK(requests == 3); }
+
+    delete iface_remove(it->name);
+    policy_rules.clear();
+  }
+
+  SECTION("poll_next") {
+    GIVEN("hosts that appear or move") {
+      proc_poll.churn = proc_poll.changed = true;
+      THEN("the table is polled fast") { CHECK(poll_next(proc_poll) == POLL_MIN); }
+      WHEN("the table stays the same") {
+        poll_next(proc_poll);
+        THEN("the interval doubles up to the longest") {
+          CHECK(poll_next(proc_poll) == 2 * POLL_MIN);
+          CHECK(poll_next(proc_poll) == 4 * POLL_MIN);
+          CHECK(poll_next(proc_poll) == 8 * POLL_MIN);
+          CHECK(poll_next(proc_poll) == 16 * POLL_MIN);
+          CHECK(poll_next(proc_poll) == POLL_MAX);
+          CHECK(poll_next(proc_poll) == POLL_MAX);
+        }
+      }
+    }
+    GIVEN("a table that changed without new hosts") {
+      proc_poll.interval = POLL_MAX;
+      proc_poll.changed = true;
+      THEN("it is polled at the configured interval again") {
+        CHECK(poll_next(proc_poll) == SLEEPTIME / 1000);
+        CHECK(!proc_poll.changed);
+      }
+    }
+    GIVEN("a configured interval outside the bounds") {
+      option_poll_time = 10000;
+      THEN("the bounds give way") {
+        CHECK(poll_next(proc_poll) == 2000);
+        CHECK(poll_next(proc_poll) == 4000);
+        CHECK(poll_next(proc_poll) == 8000);
+        CHECK(poll_next(proc_poll) == 10000);
+        proc_poll.changed = true;
+        CHECK(poll_next(proc_poll) == 10000);
+      }
+      option_poll_time = SLEEPTIME / 1000;
+    }
+  }
+
+  SECTION("parseproc skips entries out of interface scope") {
+    trompeloeil::sequence seq;
+
+    scope_rules = {{"wlp58s0", in_addr{htonl(0xc0a80000)}, 16, false}}; // !192.168.0.0/16
+    auto *it = iface_add("wlp58s0");
+
+    ALLOW_CALL(fileSystem, fopen(_, _)).RETURN(reinterpret_cast<FILE *>(0xdeadbeef));
+    REQUIRE_CALL(fileSystem, feof(_)).RETURN(false).IN_SEQUENCE(seq);
+    REQUIRE_CALL(fileSystem, fgets(_, _, _))
+        .LR_SIDE_EFFECT(std::strcpy(_1, "IP address       HW type     Flags       HW address"))
+        .RETURN(_1)
+        .IN_SEQUENCE(seq);
+    REQUIRE_CALL(fileSystem, feof(_)).RETURN(false).IN_SEQUENCE(seq);
+    REQUIRE_CALL(fileSystem, fgets(_, _, _))
+        .LR_SIDE_EFFECT(
+            auto constexpr line =
+                R"(192.168.11.182   0x1         0x2         00:1e:74:00:4a:88     *        wlp58s0)";
+            std::strcpy(_1, line))
+        .RETURN(_1)
+        .IN_SEQUENCE(seq);
+    REQUIRE_CALL(fileSystem, feof(_)).RETURN(true).IN_SEQUENCE(seq);
+    REQUIRE_CALL(fileSystem, fclose(_)).RETURN(0);
+    parseproc(fileSystem, context, clock);
+    CHECK(emptyCache());
+
+    delete iface_remove(it->name);
+    scope_rules.clear();
   }
 }
 
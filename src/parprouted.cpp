@@ -20,23 +20,186 @@
 
 #include "parprouted.h"
 
+#include <algorithm>
+#include <fnmatch.h>
+#include <utility>
+
+#include "actor.h"
+#include "clock.h"
+#include "config.h"
 #include "context.h"
+#include "control.h"
 #include "fs.h"
+#include "handover.h"
+#include "probes.h"
+#include "sweep.h"
+#include "xdp.h"
 
 bool debug = false;
-bool verbose = false;
 bool option_arpperm = false;
+bool option_actor = false;
+int option_workers = 1;
+int option_max_entries = ARPTAB_MAX_ENTRIES;
+uint32_t option_route_table = ROUTE_TABLE_MAIN;
+int option_route_proto = 0;
+int option_entry_timeout = ARP_TABLE_ENTRY_TIMEOUT;
+int option_refresh_time = REFRESHTIME;
+int option_poll_time = SLEEPTIME / 1000;
+int option_poll_min = POLL_MIN;
+int option_poll_max = POLL_MAX;
+int option_sweep_rate = 0;
+int option_sweep_time = SWEEP_TIME;
+int option_queue_size = MAX_RQ_SIZE;
 
 static bool perform_shutdown = false;
+static volatile sig_atomic_t perform_stats = false;
+static volatile sig_atomic_t perform_handover = false;
+static volatile sig_atomic_t perform_reload = false;
+
+parprouted_stats stats;
+
+poll_state proc_poll;
 
 char *errstr;
 
-const char *ifaces[MAX_IFACES];
-int last_iface_idx = -1;
+std::vector<std::string> group_names{""};
+std::vector<iface_pattern> iface_patterns;
+std::vector<iface_pattern> trunk_patterns;
+std::vector<iface *> ifaces;
+pthread_rwlock_t ifaces_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 arptab_entry *arptab = nullptr;
+size_t arptab_len = 0;
 pthread_mutex_t arptab_mutex;
 
+/* evicted entries whose route is removed by the next processarp() */
+static arptab_entry *arptab_evicted = nullptr;
+
+static int pattern_group(const std::vector<iface_pattern> &patterns, const char *name) {
+  for (const auto &it : patterns) {
+    if (fnmatch(it.pattern.c_str(), name, 0) == 0) {
+      return it.group;
+    }
+  }
+  return -1;
+}
+
+/* Bridge group of an interface we were asked to proxy on, -1 if we were
+ * not; the first matching pattern wins */
+int iface_group(const char *name) { return pattern_group(iface_patterns, name); }
+
+/* Bridge group of a trunk we were asked to proxy the VLANs of, -1 if the
+ * interface is no such trunk */
+int trunk_group(const char *name) { return pattern_group(trunk_patterns, name); }
+
+/* Attach interface, returns NULL if it is already attached */
+iface *iface_add(const char *name, int group, const vlan_link &vlan) {
+  iface *it = nullptr;
+
+  pthread_rwlock_wrlock(&ifaces_lock);
+  if (std::none_of(ifaces.begin(), ifaces.end(),
+                   [name](const iface *cur) { return strcmp(cur->name, name) == 0; })) {
+    it = new iface();
+    strncpy(it->name, name, IFNAMSIZ - 1);
+    it->group = group;
+    it->vlan = vlan;
+    scope_build(it->name, it->scope);
+    it->limit = rate_lookup(it->name);
+    it->policy = policy_lookup(it->name, policy_defaults());
+    ifaces.push_back(it);
+  }
+  pthread_rwlock_unlock(&ifaces_lock);
+  return it;
+}
+
+/* Detach interface, the caller owns (and deletes) the returned entry */
+iface *iface_remove(const char *name) {
+  iface *it = nullptr;
+
+  pthread_rwlock_wrlock(&ifaces_lock);
+  auto pos = std::find_if(ifaces.begin(), ifaces.end(),
+                          [name](const iface *cur) { return strcmp(cur->name, name) == 0; });
+  if (pos != ifaces.end()) {
+    it = *pos;
+    ifaces.erase(pos);
+  }
+  pthread_rwlock_unlock(&ifaces_lock);
+  return it;
+}
+
+/* Attached interface by name, NULL for interfaces we do not proxy on.
+ * The caller holds ifaces_lock for as long as it uses the entry */
+const iface *iface_find(const char *name) {
+  for (const auto *it : ifaces) {
+    if (strcmp(it->name, name) == 0) {
+      return it;
+    }
+  }
+  return NULL;
+}
+
+iface_policy policy_defaults() {
+  return iface_policy{option_entry_timeout, option_refresh_time, PROBE_RETRIES, 0};
+}
+
+iface_policies::iface_policies() : defaults(policy_defaults()) {
+  pthread_rwlock_rdlock(&ifaces_lock);
+  for (const iface *it : ifaces) {
+    attached.emplace(it->name, it->policy);
+  }
+  pthread_rwlock_unlock(&ifaces_lock);
+}
+
+const iface_policy &iface_policies::of(const char *name) const {
+  auto it = attached.find(name);
+  return it != attached.end() ? it->second : defaults;
+}
+
+/* The table is full: evict the least recently seen entry, incomplete
+ * entries first, so that an address scan cannot grow it without bound;
+ * pinned entries stay */
+static void evict_entry() {
+  arptab_entry *cur_entry, *prev_entry = NULL;
+  arptab_entry *victim = NULL, *victim_prev = NULL;
+
+  for (cur_entry = arptab; cur_entry != NULL; prev_entry = cur_entry, cur_entry = cur_entry->next) {
+    if (cur_entry->pinned) {
+      continue;
+    }
+    if (victim == NULL || (cur_entry->incomplete && !victim->incomplete) ||
+        (cur_entry->incomplete == victim->incomplete && cur_entry->tstamp < victim->tstamp)) {
+      victim = cur_entry;
+      victim_prev = prev_entry;
+    }
+  }
+  if (victim == NULL) {
+    return;
+  }
+
+  LOG(LOG_DEBUG, "arptab full, evicting %s(%s)", victim->ipaddr_ia, victim->ifname);
+  if (victim_prev != NULL) {
+    victim_prev->next = victim->next;
+  } else {
+    arptab = victim->next;
+  }
+  arptab_len--;
+  stats.arptab_evictions++;
+
+  if (victim->route_added) {
+    victim->next = arptab_evicted;
+    arptab_evicted = victim;
+  } else {
+    delete victim;
+  }
+}
+
+/* Evict entries until the table is within option_max_entries again */
+void arptab_trim() {
+  while (option_max_entries > 0 && arptab_len > static_cast<size_t>(option_max_entries)) {
+    evict_entry();
+  }
+}
+
 arptab_entry *replace_entry(struct in_addr ipaddr, const char *dev) {
   arptab_entry *cur_entry = arptab;
   arptab_entry *prev_entry = NULL;
@@ -48,19 +211,26 @@ arptab_entry *replace_entry(struct in_addr ipaddr, const char *dev) {
   };
 
   if (cur_entry == NULL) {
-    if (debug) {
-      printf("Creating new arptab entry %s(%s)\n", inet_ntoa(ipaddr), dev);
+    LOG(LOG_DEBUG, "Creating new arptab entry %s(%s)", ipaddr, dev);
+
+    if (option_max_entries > 0 && arptab_len >= static_cast<size_t>(option_max_entries)) {
+      evict_entry();
+      /* the victim may have been the tail */
+      for (prev_entry = arptab; prev_entry != NULL && prev_entry->next != NULL;
+           prev_entry = prev_entry->next) {
+      }
     }
 
     if ((cur_entry = new arptab_entry()) == NULL) { // std::bad_alloc
       errstr = strerror(errno);                     // not reached -> exception
-      syslog(LOG_INFO, "No memory: %s", errstr);
+      LOG(LOG_INFO, "No memory: %s", errstr);
     } else {
       if (prev_entry == NULL) {
         arptab = cur_entry;
       } else {
         prev_entry->next = cur_entry;
       }
+      arptab_len++;
       cur_entry->want_route = true;
     }
   }
@@ -68,24 +238,39 @@ arptab_entry *replace_entry(struct in_addr ipaddr, const char *dev) {
   return cur_entry;
 }
 
-bool findentry(struct in_addr ipaddr) {
+/* Is ipaddr known in the bridge group, group -1 for any group? */
+bool findentry(struct in_addr ipaddr, int group) {
   arptab_entry *cur_entry = arptab;
 
-  while (cur_entry != NULL && ipaddr.s_addr != cur_entry->ipaddr_ia.s_addr) {
+  while (cur_entry != NULL && (ipaddr.s_addr != cur_entry->ipaddr_ia.s_addr ||
+                               (group >= 0 && group != cur_entry->group))) {
     cur_entry = cur_entry->next;
   };
   return (cur_entry != NULL);
 }
 
-/* Remove all entires in arptab where ipaddr is NOT on interface dev */
-int remove_other_routes(struct in_addr ipaddr, const char *dev) {
+/* Is ipaddr pinned to another interface than dev in the bridge group? */
+static bool pinned_elsewhere(struct in_addr ipaddr, const char *dev, int group) {
+  for (arptab_entry *cur_entry = arptab; cur_entry != NULL; cur_entry = cur_entry->next) {
+    if (cur_entry->pinned && ipaddr.s_addr == cur_entry->ipaddr_ia.s_addr &&
+        group == cur_entry->group && strcmp(dev, cur_entry->ifname) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Remove all entires in arptab where ipaddr is NOT on interface dev; other
+ * bridge groups have their own hosts and are left alone */
+int remove_other_routes(struct in_addr ipaddr, const char *dev, int group) {
   arptab_entry *cur_entry;
   int removed = 0;
 
   for (cur_entry = arptab; cur_entry != NULL; cur_entry = cur_entry->next) {
-    if (ipaddr.s_addr == cur_entry->ipaddr_ia.s_addr && strcmp(dev, cur_entry->ifname) != 0) {
-      if (debug && cur_entry->want_route) {
-        printf("Marking entry %s(%s) for removal\n", inet_ntoa(ipaddr), cur_entry->ifname);
+    if (ipaddr.s_addr == cur_entry->ipaddr_ia.s_addr && group == cur_entry->group &&
+        strcmp(dev, cur_entry->ifname) != 0) {
+      if (cur_entry->want_route) {
+        LOG(LOG_DEBUG, "Marking entry %s(%s) for removal", ipaddr, cur_entry->ifname);
       }
       cur_entry->want_route = false;
       ++removed;
@@ -94,32 +279,48 @@ int remove_other_routes(struct in_addr ipaddr, const char *dev) {
   return removed;
 }
 
+/* " table N proto P" for routes outside the main table or with a tag */
+static const char *route_options(char *buf, size_t len) {
+  int n = 0;
+
+  buf[0] = '\0';
+  if (option_route_table != ROUTE_TABLE_MAIN) {
+    n = snprintf(buf, len, " table %u", option_route_table);
+  }
+  if (option_route_proto != 0) {
+    snprintf(buf + n, len - static_cast<size_t>(n), " proto %d", option_route_proto);
+  }
+  return buf;
+}
+
 /* Remove route from kernel */
 int route_remove(Context &context, arptab_entry *cur_entry) {
   char routecmd_str[ROUTE_CMD_LEN];
+  char options[32];
+  char ip[INET_ADDRSTRLEN];
   bool success = true;
+  [[maybe_unused]] int64_t start = probe_clock();
 
+  PROBE(route__remove__start, cur_entry->ipaddr_ia.s_addr, if_nametoindex(cur_entry->ifname));
+  inet_ntop(AF_INET, &cur_entry->ipaddr_ia, ip, sizeof(ip));
   if (snprintf(routecmd_str, ROUTE_CMD_LEN - 1,
-               "/sbin/ip route del %s/32 metric 50 dev %s scope link",
-               inet_ntoa(cur_entry->ipaddr_ia), cur_entry->ifname) > ROUTE_CMD_LEN - 1) {
-    syslog(LOG_INFO, "ip route command too large to fit in buffer!");
+               "/sbin/ip route del %s/32 metric %d dev %s scope link%s", ip, ROUTE_METRIC,
+               cur_entry->ifname, route_options(options, sizeof(options))) > ROUTE_CMD_LEN - 1) {
+    LOG(LOG_INFO, "ip route command too large to fit in buffer!");
   } else {
     if (context.system(routecmd_str) != 0) {
-      syslog(LOG_INFO, "'%s' unsuccessful!", routecmd_str);
-      if (debug) {
-        printf("%s failed\n", routecmd_str);
-      }
+      LOG(LOG_INFO, "'%s' unsuccessful!", routecmd_str);
       success = false;
     } else {
-      if (debug) {
-        printf("%s success\n", routecmd_str);
-      }
+      LOG(LOG_DEBUG, "%s success", routecmd_str);
       success = true;
     }
   }
   if (success) {
     cur_entry->route_added = false;
   }
+  PROBE(route__remove__done, cur_entry->ipaddr_ia.s_addr, if_nametoindex(cur_entry->ifname),
+        probe_clock() - start, success);
 
   return success;
 }
@@ -127,47 +328,62 @@ int route_remove(Context &context, arptab_entry *cur_entry) {
 /* Add route into kernel */
 int route_add(Context &context, arptab_entry *cur_entry) {
   char routecmd_str[ROUTE_CMD_LEN];
+  char options[32];
+  char ip[INET_ADDRSTRLEN];
   bool success = true;
+  [[maybe_unused]] int64_t start = probe_clock();
 
+  PROBE(route__add__start, cur_entry->ipaddr_ia.s_addr, if_nametoindex(cur_entry->ifname));
+  inet_ntop(AF_INET, &cur_entry->ipaddr_ia, ip, sizeof(ip));
   if (snprintf(routecmd_str, ROUTE_CMD_LEN - 1,
-               "/sbin/ip route add %s/32 metric 50 dev %s scope link",
-               inet_ntoa(cur_entry->ipaddr_ia), cur_entry->ifname) > ROUTE_CMD_LEN - 1) {
-    syslog(LOG_INFO, "ip route command too large to fit in buffer!");
+               "/sbin/ip route add %s/32 metric %d dev %s scope link%s", ip, ROUTE_METRIC,
+               cur_entry->ifname, route_options(options, sizeof(options))) > ROUTE_CMD_LEN - 1) {
+    LOG(LOG_INFO, "ip route command too large to fit in buffer!");
   } else {
     if (context.system(routecmd_str) != 0) {
-      syslog(LOG_INFO, "'%s' unsuccessful, will try to remove!", routecmd_str);
-      if (debug) {
-        printf("%s failed\n", routecmd_str);
-      }
+      LOG(LOG_INFO, "'%s' unsuccessful, will try to remove!", routecmd_str);
       route_remove(context, cur_entry);
       success = false;
     } else {
-      if (debug) {
-        printf("%s success\n", routecmd_str);
-      }
+      LOG(LOG_DEBUG, "%s success", routecmd_str);
       success = true;
     }
   }
   if (success) {
     cur_entry->route_added = true;
   }
+  PROBE(route__add__done, cur_entry->ipaddr_ia.s_addr, if_nametoindex(cur_entry->ifname),
+        probe_clock() - start, success);
 
   return success;
 }
 
-void processarp(Context &context, bool in_cleanup) {
+void processarp(Context &context, Clock &clock, bool in_cleanup) {
   arptab_entry *cur_entry = arptab, *prev_entry = NULL;
-
-  auto expired = [in_cleanup](const arptab_entry &it) {
-    return !it.want_route || time(NULL) - it.tstamp > ARP_TABLE_ENTRY_TIMEOUT || in_cleanup;
+  const auto now = clock.now();
+  const iface_policies policies;
+
+  auto expired = [in_cleanup, now, &policies](const arptab_entry &it) {
+    return !it.want_route ||
+           (!it.pinned &&
+            now - it.tstamp > std::chrono::seconds(policies.of(it.ifname).timeout)) ||
+           in_cleanup;
   };
 
+  /* Withdraw the routes of evicted entries */
+  while (arptab_evicted != NULL) {
+    if (arptab_evicted->route_added) {
+      route_remove(context, arptab_evicted);
+    }
+    delete std::exchange(arptab_evicted, arptab_evicted->next);
+  }
+
   /* First loop to remove unwanted routes */
   while (cur_entry != NULL) {
-    if (debug && verbose) {
-      printf("Working on route %s(%s) tstamp %u want_route %d\n", inet_ntoa(cur_entry->ipaddr_ia),
-             cur_entry->ifname, (int)cur_entry->tstamp, cur_entry->want_route);
-    }
+    LOG(LOG_TRACE, "Working on route %s(%s) age %lds want_route %d", cur_entry->ipaddr_ia,
+        cur_entry->ifname,
+        std::chrono::duration_cast<std::chrono::seconds>(now - cur_entry->tstamp).count(),
+        cur_entry->want_route);
 
     if (expired(*cur_entry)) {
       if (cur_entry->route_added) {
@@ -175,9 +391,7 @@ void processarp(Context &context, bool in_cleanup) {
       }
 
       /* remove from arp list */
-      if (debug) {
-        printf("Delete arp %s(%s)\n", inet_ntoa(cur_entry->ipaddr_ia), cur_entry->ifname);
-      }
+      LOG(LOG_DEBUG, "Delete arp %s(%s)", cur_entry->ipaddr_ia, cur_entry->ifname);
 
       if (prev_entry != NULL) {
         prev_entry->next = cur_entry->next;
@@ -188,6 +402,7 @@ void processarp(Context &context, bool in_cleanup) {
         delete cur_entry;
         cur_entry = arptab;
       }
+      arptab_len--;
     } else {
       prev_entry = cur_entry;
       cur_entry = cur_entry->next;
@@ -205,20 +420,44 @@ void processarp(Context &context, bool in_cleanup) {
   } /* while loop */
 }
 
-void parseproc(FileSystem &fileSystem, Context &context) {
+/* Interface went away: withdraw all its routes now instead of waiting for
+ * the entries to time out */
+void iface_withdraw(const char *ifname, Context &context, Clock &clock) {
+  pthread_mutex_lock(&arptab_mutex);
+  bool flushed = route_flush(ifname);
+  for (arptab_entry *cur_entry = arptab; cur_entry != NULL; cur_entry = cur_entry->next) {
+    if (strcmp(cur_entry->ifname, ifname) == 0) {
+      cur_entry->want_route = false;
+      cur_entry->route_added = cur_entry->route_added && !flushed;
+    }
+  }
+  processarp(context, clock, false);
+  /* and the responders of the group's other interfaces stop answering for
+   * these hosts now, not at the next poll */
+  if (option_xdp) {
+    xdp_sync(arptab);
+  }
+  pthread_mutex_unlock(&arptab_mutex);
+}
+
+void parseproc(FileSystem &fileSystem, Context &context, Clock &clock) {
   FILE *arpf;
   arptab_entry *entry;
   char line[ARP_LINE_LEN];
   struct in_addr ipaddr;
   bool incomplete = false;
-  int i;
   [[maybe_unused]] char *ip, *mac, *dev, *hw, *flags, *mask;
+  [[maybe_unused]] int64_t start = probe_clock();
+  [[maybe_unused]] int lines = 0;
+  uint64_t hash = 0xcbf29ce484222325; /* FNV-1a offset basis */
+
+  PROBE(parseproc__start, arptab_len);
 
   /* Parse /proc/net/arp table */
 
   if ((arpf = fileSystem.fopen(PROC_ARP, "r")) == NULL) {
     errstr = strerror(errno);
-    syslog(LOG_INFO, "Error during ARP table open: %s", errstr);
+    LOG(LOG_INFO, "Error during ARP table open: %s", errstr);
   }
 
   bool firstline = true;
@@ -230,16 +469,18 @@ void parseproc(FileSystem &fileSystem, Context &context) {
         break;
       } else {
         errstr = strerror(errno);
-        syslog(LOG_INFO, "Error during ARP table open: %s", errstr);
+        LOG(LOG_INFO, "Error during ARP table open: %s", errstr);
       }
     } else {
+      for (const char *c = line; *c != '\0'; c++) {
+        hash = (hash ^ static_cast<unsigned char>(*c)) * 0x100000001b3;
+      }
       if (firstline) {
         firstline = false;
         continue;
       }
-      if (debug && verbose) {
-        printf("read ARP line %s", line);
-      }
+      lines++;
+      LOG(LOG_TRACE, "read ARP line %s", line);
 
       incomplete = false;
 
@@ -256,19 +497,7 @@ void parseproc(FileSystem &fileSystem, Context &context) {
       ip = strtok(line, " ");
 
       if ((inet_aton(ip, &ipaddr)) == -1) {
-        syslog(LOG_INFO, "Error parsing IP address %s", ip);
-      }
-
-      /* if IP address is marked as undiscovered and does not exist in arptab,
-         send ARP request to all ifaces */
-
-      if (incomplete && !findentry(ipaddr)) {
-        if (debug) {
-          printf("incomplete entry %s found, request on all interfaces\n", inet_ntoa(ipaddr));
-        }
-        for (i = 0; i <= last_iface_idx; i++) {
-          arp_req(ifaces[i], ipaddr, false, context);
-        }
+        LOG(LOG_INFO, "Error parsing IP address %s", ip);
       }
 
       /* Hardware type */
@@ -290,61 +519,151 @@ void parseproc(FileSystem &fileSystem, Context &context) {
         dev[strlen(dev) - 1] = '\0';
       }
 
+      /* the table is read once for all bridge groups, each entry goes to
+       * the group of its device */
+      pthread_rwlock_rdlock(&ifaces_lock);
+      const iface *self = iface_find(dev);
+      int group = self != NULL ? self->group : 0;
+      bool in_scope = self == NULL || self->scope.contains(ipaddr);
+
+      /* if IP address is marked as undiscovered and does not exist in arptab,
+         send ARP request to all ifaces of the group */
+
+      bool probed = false;
+      if (incomplete && !findentry(ipaddr, group)) {
+        LOG(LOG_DEBUG, "incomplete entry %s found, request on all interfaces", ipaddr);
+        for (const auto *it : ifaces) {
+          if (it->group == group && it->scope.contains(ipaddr) && it->policy.retries > 0) {
+            arp_req(it->name, ipaddr, false, context);
+          }
+        }
+        probed = true;
+      }
+      pthread_rwlock_unlock(&ifaces_lock);
+
+      /* the host cannot be behind this interface, no route for it */
+      if (!in_scope) {
+        LOG(LOG_DEBUG, "%s(%s) out of scope, ignored", ip, dev);
+        continue;
+      }
+
+      /* the operator says the host is elsewhere */
+      if (pinned_elsewhere(ipaddr, dev, group)) {
+        LOG(LOG_TRACE, "%s(%s) pinned to another interface, ignored", ip, dev);
+        continue;
+      }
+
       entry = replace_entry(ipaddr, dev);
+      if (entry->tstamp == Clock::time_point{}) {
+        proc_poll.churn = true; /* never seen before */
+        entry->refreshed = clock.now(); /* just heard of, no ping needed yet */
+      }
 
-      if (entry->incomplete != incomplete && debug) {
-        printf("change entry %s(%s) to incomplete=%d\n", ip, dev, incomplete);
+      if (entry->incomplete != incomplete) {
+        LOG(LOG_DEBUG, "change entry %s(%s) to incomplete=%d", ipaddr, dev, incomplete);
       }
 
       entry->ipaddr_ia.s_addr = ipaddr.s_addr;
       entry->incomplete = incomplete;
+      entry->group = group;
 
       if (strlen(mac) < ARP_TABLE_ENTRY_LEN) {
         strncpy(entry->hwaddr, mac, ARP_TABLE_ENTRY_LEN);
       } else {
-        syslog(LOG_INFO, "Error during ARP table parsing");
+        LOG(LOG_INFO, "Error during ARP table parsing");
       }
 
       if (strlen(dev) < ARP_TABLE_ENTRY_LEN) {
         strncpy(entry->ifname, dev, ARP_TABLE_ENTRY_LEN);
       } else {
-        syslog(LOG_INFO, "Error during ARP table parsing");
+        LOG(LOG_INFO, "Error during ARP table parsing");
       }
 
-      /* do not add routes for incomplete entries */
-      if (debug && entry->want_route != !incomplete) {
-        printf("%s(%s): set want_route %d\n", inet_ntoa(entry->ipaddr_ia), entry->ifname,
-               !incomplete);
+      /* do not add routes for incomplete entries, unless pinned */
+      bool want_route = !incomplete || entry->pinned;
+      if (entry->want_route != want_route) {
+        LOG(LOG_DEBUG, "%s(%s): set want_route %d", entry->ipaddr_ia, entry->ifname, want_route);
       }
-      entry->want_route = !incomplete;
+      entry->want_route = want_route;
 
       /* Remove route from kernel if it already exists through
          a different interface */
       if (entry->want_route) {
-        if (remove_other_routes(entry->ipaddr_ia, entry->ifname) > 0) {
-          if (debug) {
-            printf("Found ARP entry %s(%s), removed entries via other "
-                   "interfaces\n",
-                   inet_ntoa(entry->ipaddr_ia), entry->ifname);
-          }
+        if (remove_other_routes(entry->ipaddr_ia, entry->ifname, entry->group) > 0) {
+          proc_poll.churn = true;
+          LOG(LOG_DEBUG, "Found ARP entry %s(%s), removed entries via other interfaces",
+              entry->ipaddr_ia, entry->ifname);
         }
       }
 
-      time(&entry->tstamp);
+      entry->tstamp = clock.now();
+
+      /* still unresolved: ask again on the interfaces whose policy has
+       * retries left */
+      if (!incomplete) {
+        entry->probes = 0;
+      } else if (probed) {
+        entry->probes = 1;
+        entry->probed = entry->tstamp;
+      } else if (entry->probes > 0 &&
+                 entry->tstamp - entry->probed >= std::chrono::seconds(PROBE_RETRY_TIME)) {
+        bool sent = false;
+        pthread_rwlock_rdlock(&ifaces_lock);
+        for (const auto *it : ifaces) {
+          if (it->group == group && it->scope.contains(ipaddr) &&
+              it->policy.retries > entry->probes) {
+            arp_req(it->name, ipaddr, false, context);
+            sent = true;
+          }
+        }
+        pthread_rwlock_unlock(&ifaces_lock);
+        if (sent) {
+          LOG(LOG_DEBUG, "incomplete entry %s(%s), request %d", ipaddr, dev, entry->probes + 1);
+          entry->probes++;
+          entry->probed = entry->tstamp;
+        }
+      }
 
-      if (debug && !entry->route_added && entry->want_route) {
-        printf("arptab entry: '%s' HWAddr: '%s' Dev: '%s' route_added:%d "
-               "want_route:%d\n",
-               inet_ntoa(entry->ipaddr_ia), entry->hwaddr, entry->ifname, entry->route_added,
-               entry->want_route);
+      if (!entry->route_added && entry->want_route) {
+        LOG(LOG_DEBUG, "arptab entry: '%s' HWAddr: '%s' Dev: '%s' route_added:%d want_route:%d",
+            entry->ipaddr_ia, entry->hwaddr, entry->ifname, entry->route_added, entry->want_route);
       }
     }
   }
 
   if (fileSystem.fclose(arpf)) {
     errstr = strerror(errno);
-    syslog(LOG_INFO, "Error during ARP table open: %s", errstr);
+    LOG(LOG_INFO, "Error during ARP table open: %s", errstr);
+  }
+  if (hash != proc_poll.hash) {
+    proc_poll.hash = hash;
+    proc_poll.changed = true;
+  }
+  PROBE(parseproc__done, lines, probe_clock() - start);
+}
+
+int poll_next(poll_state &state) {
+  /* the configured interval stays within the bounds, whatever they are */
+  int fast = std::min(option_poll_min, option_poll_time);
+  int slow = std::max(option_poll_max, option_poll_time);
+  int interval = state.interval;
+
+  if (state.churn) {
+    interval = fast;
+  } else if (state.changed) {
+    interval = option_poll_time;
+  } else {
+    /* from fast back to the configured interval and on towards slow */
+    interval = std::min(interval * 2, slow);
   }
+  interval = std::clamp(interval, fast, slow);
+  if (interval != state.interval) {
+    LOG(LOG_TRACE, "poll interval %d ms", interval);
+  }
+  state.interval = interval;
+  state.changed = false;
+  state.churn = false;
+  return interval;
 }
 
 void cleanup(void *arg) {
@@ -356,9 +675,20 @@ void cleanup(void *arg) {
       pthread_cancel(my_threads[i]);
   }
   */
-  auto &[context] = *static_cast<std::tuple<Context &> *>(arg);
+  auto &[context, clock] = *static_cast<std::tuple<Context &, Clock &> *>(arg);
   pthread_mutex_trylock(&arptab_mutex);
-  processarp(context, true);
+  /* in a table of our own all routes go at once, not one ip(8) each */
+  if (route_flush(NULL)) {
+    for (arptab_entry *cur_entry = arptab; cur_entry != NULL; cur_entry = cur_entry->next) {
+      cur_entry->route_added = false;
+    }
+    for (arptab_entry *cur_entry = arptab_evicted; cur_entry != NULL; cur_entry = cur_entry->next) {
+      cur_entry->route_added = false;
+    }
+  }
+  processarp(context, clock, true);
+  control_unlink();
+  log_flush();
   syslog(LOG_INFO, "Terminating.");
   exit(1);
 }
@@ -368,35 +698,117 @@ void sighandler(int /* unused */) {
   perform_shutdown = true;
 }
 
-void *main_thread(FileSystem &fileSystem, Context &context) {
-  time_t last_refresh{};
+void statshandler(int /* unused */) { perform_stats = true; }
+
+void handoverhandler(int /* unused */) { perform_handover = true; }
+
+void reloadhandler(int /* unused */) { perform_reload = true; }
+
+void stats_log() {
+  syslog(LOG_INFO, "arptab: %zu entries (max %d), %lu evicted", arptab_len, option_max_entries,
+         stats.arptab_evictions.load());
+  syslog(LOG_INFO, "requests: %lu rate limited, %lu dropped from a full queue",
+         stats.rate_limited.load(), stats.queue_dropped.load());
+  /* the peaks are since the last time they were logged */
+  syslog(LOG_INFO, "frames: %lu replies, %lu requests, at most %lu and %lu waiting in a batch",
+         stats.frames[ARP_CLASS_REPLY].load(), stats.frames[ARP_CLASS_REQUEST].load(),
+         stats.waiting_peak[ARP_CLASS_REPLY].exchange(0),
+         stats.waiting_peak[ARP_CLASS_REQUEST].exchange(0));
+  syslog(LOG_INFO, "routes: %lu missing, %lu stray, %lu adopted", stats.routes_missing.load(),
+         stats.routes_stray.load(), stats.routes_adopted.load());
+  syslog(LOG_INFO, "log: %lu records dropped", stats.log_dropped.load());
+  if (option_actor) {
+    syslog(LOG_INFO, "actor: %lu frames dropped", stats.actor_dropped.load());
+  }
+  if (option_xdp) {
+    syslog(LOG_INFO, "xdp: %lu requests answered in the kernel", xdp_replies());
+  }
+}
+
+void *main_thread(FileSystem &fileSystem, Context &context, Clock &clock) {
+  Clock::time_point last_reconcile{};
+  std::vector<kernel_route> routes;
 
   signal(SIGINT, sighandler);
   signal(SIGTERM, sighandler);
-  signal(SIGHUP, sighandler);
+  signal(SIGHUP, reloadhandler);
+  signal(SIGUSR1, statshandler);
+  signal(SIGUSR2, handoverhandler);
+  signal(SIGRTMIN, log_more);
+  signal(SIGRTMIN + 1, log_less);
 
   pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
   pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
   // pass reference to local variable
-  auto cleanupArgs = std::make_tuple(std::ref(context));
+  auto cleanupArgs = std::make_tuple(std::ref(context), std::ref(clock));
   pthread_cleanup_push(cleanup, &cleanupArgs);
 
+  /* the routes of the hosts that answer are there before the first poll */
+  sweep_run(fileSystem, context, clock);
+
   while (true) {
     if (perform_shutdown) {
       pthread_exit(0);
     }
     pthread_testcancel();
+    /* the receive threads stop reading and finish their batches, which
+     * need arptab_mutex, before the table is handed over */
+    bool handover = perform_handover;
+    if (handover) {
+      perform_handover = false;
+      handover_pause();
+      if (option_actor) {
+        actor_drain(fileSystem, context, clock);
+      }
+    }
     pthread_mutex_lock(&arptab_mutex);
-    parseproc(fileSystem, context);
-    processarp(context, false);
+    parseproc(fileSystem, context, clock);
+    processarp(context, clock, false);
+    if (option_xdp) {
+      xdp_sync(arptab);
+    }
+    /* all route changes are made under arptab_mutex, the dump is exact */
+    if (clock.now() - last_reconcile > std::chrono::seconds(RECONCILE_TIME)) {
+      if (route_dump(routes)) {
+        route_reconcile(routes, context);
+      }
+      last_reconcile = clock.now();
+    }
+    if (perform_stats) {
+      perform_stats = false;
+      stats_log();
+    }
+    if (perform_reload) {
+      perform_reload = false;
+      config_reload();
+    }
+    /* routes and table are in sync and stay as they are until we exit */
+    if (handover) {
+      if (handover_start()) {
+        log_flush();
+        syslog(LOG_INFO, "Handed over, exiting.");
+        _exit(0);
+      }
+      handover_resume();
+    }
+    int interval = poll_next(proc_poll);
     pthread_mutex_unlock(&arptab_mutex);
-    usleep(SLEEPTIME);
-    if (!option_arpperm && time(NULL) - last_refresh > REFRESHTIME) {
+    if (option_actor) {
+      /* the frames of the receive threads are handled here, in between */
+      auto until = clock.now() + std::chrono::milliseconds(interval);
+      for (auto now = clock.now(); now < until && !perform_shutdown; now = clock.now()) {
+        actor_wait(std::chrono::duration_cast<std::chrono::microseconds>(until - now));
+        actor_drain(fileSystem, context, clock);
+      }
+    } else {
+      clock.sleep_for(std::chrono::milliseconds(interval));
+    }
+    /* each entry when the policy of its interface says so */
+    if (!option_arpperm) {
       pthread_mutex_lock(&arptab_mutex);
-      refresharp(arptab, context);
+      refresharp(arptab, context, clock);
       pthread_mutex_unlock(&arptab_mutex);
-      time(&last_refresh);
     }
   }
   /* required since pthread_cleanup_* are implemented as macros */
@@ -22,13 +22,28 @@
 #define PROC_ARP "/proc/net/arp"
 #define ARP_LINE_LEN 255
 #define ARP_TABLE_ENTRY_LEN 20
-#define ARP_TABLE_ENTRY_TIMEOUT 60 /* seconds */
+#define ARP_TABLE_ENTRY_TIMEOUT 60 /* seconds, default of option_entry_timeout */
 #define ROUTE_CMD_LEN 255
-#define SLEEPTIME 1000000 /* ms */
-#define REFRESHTIME 50    /* seconds */
-#define MAX_IFACES 10
+#define ROUTE_METRIC 50  /* of the proxy routes, tells them from others */
+#define ROUTE_TABLE_MAIN 254 /* RT_TABLE_MAIN */
+#define RECONCILE_TIME 5 /* seconds between route reconciliations */
+#define SLEEPTIME 1000000 /* us, default of option_poll_time */
+#define POLL_MIN 250      /* ms, default of option_poll_min */
+#define POLL_MAX 5000     /* ms, default of option_poll_max */
+#define SWEEP_TIME 10     /* seconds, default of option_sweep_time */
+#define REFRESHTIME 50    /* seconds, default of option_refresh_time */
+#define MAX_WORKERS 64 /* receive workers per interface */
+#define ARP_BATCH 64   /* frames a receive thread reads and handles in one go */
 
-#define MAX_RQ_SIZE 50 /* maximum size of request queue */
+#define GARP_WINDOW 50000 /* us, gratuitous ARPs are collected this long */
+#define GARP_BATCH 64     /* max gratuitous ARPs per interface and window */
+#define GARP_SUPPRESS 10  /* seconds before a host is announced again */
+
+#define ARPTAB_MAX_ENTRIES 16384 /* default limit of arptab, 0 = unlimited */
+
+#define MAX_RQ_SIZE 50      /* default of option_queue_size */
+#define RQ_MAX_WAITERS 256 /* requesters per queued target; the oldest go first */
+#define RQ_RELAY_TIME 1    /* seconds before a target asked for again is relayed again */
 
 #define VERSION "0.7"
 
@@ -37,6 +52,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
 #include <netinet/if_ether.h>
 #include <netinet/in.h>
 #include <pthread.h>
@@ -50,14 +67,33 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "log.h"
+#include "policy.h"
+#include "ratelimit.h"
+#include "scope.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
 struct arptab_entry {
   struct in_addr ipaddr_ia {};
   char hwaddr[ARP_TABLE_ENTRY_LEN] = "";
   char ifname[ARP_TABLE_ENTRY_LEN] = "";
-  time_t tstamp{};
+  std::chrono::steady_clock::time_point tstamp{}; /* Clock::now() of last sighting */
+  std::chrono::steady_clock::time_point refreshed{}; /* last ARP ping by refresharp() */
+  std::chrono::steady_clock::time_point probed{};    /* last request while unresolved */
+  int probes = 0; /* requests while unresolved, see iface_policy::retries */
   bool route_added{false};
   bool incomplete{false};
   bool want_route{false};
+  bool pinned{false}; /* by the control socket: wants a route, never expires */
+  int group = 0; /* bridge group of ifname */
   struct arptab_entry *next = nullptr;
 };
 
@@ -66,35 +102,222 @@ struct ether_arp_frame {
   struct ether_arp arp;
 } __attribute__((packed));
 
+/* A received frame with the interface it was received on */
+struct arp_event {
+  ether_arp_frame frame;
+  struct sockaddr_ll ifs;
+  char ifname[IFNAMSIZ];
+};
+
+/* Received frames are handled by class, in this order */
+enum arp_class { ARP_CLASS_REPLY, ARP_CLASS_REQUEST, ARP_CLASSES };
+
 extern bool debug;
-extern bool verbose;
 extern bool option_arpperm;
+extern bool option_actor; /* receive threads hand the frames to main_thread() */
+extern int option_workers;
+extern int option_max_entries;
+extern uint32_t option_route_table; /* routing table of the proxy routes */
+extern int option_route_proto;      /* rtm_protocol of the proxy routes, 0 = ip(8) default */
+extern int option_entry_timeout;    /* seconds an entry lives without being seen */
+extern int option_refresh_time;     /* seconds between ARP pings of all entries */
+extern int option_poll_time;        /* ms between polls of the kernel ARP table */
+extern int option_poll_min;         /* ms between polls while hosts appear or move */
+extern int option_poll_max;         /* ms between polls of a table that stays the same */
+extern int option_sweep_rate;       /* ARP probes per second of the startup sweep, 0 = none */
+extern int option_sweep_time;       /* seconds the startup sweep takes at most */
+extern int option_queue_size;       /* max targets waiting for a reply */
+extern bool option_xdp;             /* answer requests for known hosts in the kernel */
+extern std::string option_control;  /* path of the control socket, "" = none */
+
+/* Counters, logged on SIGUSR1 */
+struct parprouted_stats {
+  std::atomic<unsigned long> arptab_evictions{};
+  std::atomic<unsigned long> rate_limited{}; /* requests dropped by the sender rate limit */
+  std::atomic<unsigned long> queue_dropped{}; /* requesters dropped from a full queue */
+  std::atomic<unsigned long> routes_missing{}; /* installed routes found deleted */
+  std::atomic<unsigned long> routes_stray{};   /* routes found that nobody wants */
+  std::atomic<unsigned long> routes_adopted{}; /* routes found present that ip(8) failed to add */
+  std::atomic<unsigned long> log_dropped{};    /* log records lost to a full ring */
+  std::atomic<unsigned long> actor_dropped{};  /* frames lost to a full actor ring */
+  std::atomic<unsigned long> frames[ARP_CLASSES]{}; /* handled, by class */
+  std::atomic<unsigned long> waiting_peak[ARP_CLASSES]{}; /* most of a class in one batch */
+};
+
+extern parprouted_stats stats;
 
 extern arptab_entry *arptab;
+extern size_t arptab_len;
 extern pthread_mutex_t arptab_mutex;
+
+/* A host that asked for a queued target */
+struct rq_waiter {
+  unsigned char hwaddr[ETH_ALEN]; /* arp_sha of its request */
+  struct in_addr ipaddr;          /* arp_spa of its request */
+  int ifindex;                    /* interface it asked on */
+  unsigned char ifaddr[ETH_ALEN]; /* link address of that interface */
+};
+
+/* Requests for one target relayed to other interfaces, answered together
+ * when the reply comes */
+typedef struct _req_struct {
+  struct in_addr target;
+  int group;                                       /* bridge group of the waiters */
+  int64_t queued;                                  /* probe_clock() when first queued */
+  std::chrono::steady_clock::time_point relayed{}; /* Clock::now() of the last relay */
+  std::vector<rq_waiter> waiters;                  /* in the order they asked */
+  struct _req_struct *next;
+} RQ_ENTRY;
+
+extern RQ_ENTRY *req_queue;
+extern int req_queue_len;
 extern pthread_mutex_t req_queue_mutex;
 
 arptab_entry *replace_entry(struct in_addr ipaddr, const char *dev);
-extern bool findentry(struct in_addr ipaddr);
-extern int remove_other_routes(struct in_addr ipaddr, const char *dev);
+extern void arptab_trim();
+extern bool findentry(struct in_addr ipaddr, int group = -1);
+extern int remove_other_routes(struct in_addr ipaddr, const char *dev, int group = 0);
+
+/* VLAN sub-interface whose frames are received on the socket of its
+ * trunk (parent device), trunk 0 for interfaces with their own socket */
+struct vlan_link {
+  int trunk = 0;
+  uint16_t vid = 0;
+  int ifindex = 0;
+  unsigned char hwaddr[ETH_ALEN] = {};
+};
 
-extern const char *ifaces[MAX_IFACES];
-extern int last_iface_idx;
+/* An interface we proxy on; attached while it is up */
+struct iface {
+  char name[IFNAMSIZ] = "";
+  int group = 0; /* bridge group, requests are relayed within it only */
+  vlan_link vlan;
+  Scope scope;                       /* addresses that may live behind it */
+  rate_limit limit;                  /* per sender request rate */
+  iface_policy policy;               /* timers of the hosts behind it */
+  std::vector<std::jthread> workers; /* arp_thread()s, stopped when detached */
+};
 
+/* Interface name or fnmatch(3) pattern given on the command line, and
+ * the bridge group it was given in */
+struct iface_pattern {
+  std::string pattern;
+  int group = 0;
+};
+
+/* Bridge groups (-g), indexed by group; group 0 holds the interfaces
+ * given before the first -g */
+extern std::vector<std::string> group_names;
+extern std::vector<iface_pattern> iface_patterns;
+/* Trunks: parent devices whose VLANs are all proxied via one socket */
+extern std::vector<iface_pattern> trunk_patterns;
+
+/* Attached interfaces; readers hold ifaces_lock shared, only the link
+ * monitor takes it exclusively */
+extern std::vector<iface *> ifaces;
+extern pthread_rwlock_t ifaces_lock;
+
+extern int iface_group(const char *name);
+extern int trunk_group(const char *name);
+extern iface *iface_add(const char *name, int group = 0, const vlan_link &vlan = {});
+extern iface *iface_remove(const char *name);
+extern const iface *iface_find(const char *name);
+extern iface_policy policy_defaults();
+/* Policies of the attached interfaces, taken under one lock for a pass
+ * over the table; of() gives the global options for others */
+struct iface_policies {
+  iface_policies();
+  const iface_policy &of(const char *name) const;
+
+ private:
+  std::map<std::string, iface_policy, std::less<>> attached;
+  iface_policy defaults;
+};
+extern void link_resync();
+extern std::atomic<bool> link_synced; /* the links of the first dump are attached */
+
+struct Clock;
 struct Context;
 struct FileSystem;
 
 extern int route_remove(Context &, arptab_entry *);
 extern int route_add(Context &, arptab_entry *);
 
-extern void *arp_thread(const char *ifname, FileSystem &, Context &);
-extern void refresharp(arptab_entry *list, Context &);
+/* A proxy route found in the kernel */
+struct kernel_route {
+  in_addr_t ip; /* host byte order, sorts like the addresses */
+  char ifname[IFNAMSIZ];
+  int ifindex = 0;
+};
+
+extern bool route_dump(std::vector<kernel_route> &routes);
+extern void route_reconcile(std::vector<kernel_route> &routes, Context &);
+extern bool route_flush(const char *ifname);
+
+/* Receive workers; inherited is the socket handed over for them, or -1 */
+extern void *arp_thread(std::stop_token, const char *ifname, int inherited, FileSystem &,
+                        Context &, Clock &);
+extern void *trunk_thread(std::stop_token, const char *ifname, int inherited, FileSystem &,
+                          Context &, Clock &);
+extern void arp_handle_frame(ether_arp_frame *frame, struct sockaddr_ll *ifs, const char *ifname,
+                             FileSystem &, Context &, Clock &);
+extern void refresharp(arptab_entry *list, Context &, Clock &);
+extern void garp_add(const char *ifname, struct in_addr addr, Clock &);
+extern void garp_flush(Context &, Clock &);
+extern void *garp_thread(Context &, Clock &);
 extern void arp_req(const char *ifname, struct in_addr remaddr, bool gratuitous, Context &);
+extern void arp_req_batch(const char *ifname, const std::vector<struct in_addr> &addrs,
+                          bool gratuitous, Context &);
 struct ether_arp_frame;
 extern void arp_reply(ether_arp_frame *reqframe, struct sockaddr_ll *ifs, Context &);
 
-extern void parseproc(FileSystem &, Context &);
-extern void processarp(Context &, bool cleanup);
+/* Received frames sorted by class until they are handled. Replies go
+ * first: one learns a host, installs its route and answers the requests
+ * queued for it, and should not wait behind a storm of requests that are
+ * only relayed. */
+struct arp_batch {
+  std::vector<arp_event *> queued[ARP_CLASSES];
+};
+
+/* Add a frame to its class, frames of no class are dropped */
+extern void arp_batch_add(arp_batch &batch, arp_event *ev);
+/* Handle the frames of the batch, class by class, and empty it */
+extern void arp_batch_run(arp_batch &batch, FileSystem &, Context &, Clock &);
+/* Queue a request with the others for its target; true if the target is
+ * to be relayed, because it is new or was last relayed RQ_RELAY_TIME ago */
+extern bool rq_add(const ether_arp_frame *req_frame, const struct sockaddr_ll *req_if, int group,
+                   std::chrono::steady_clock::time_point now);
+/* The request of a waiter and the interface it came on, as received */
+extern void rq_request(const RQ_ENTRY &entry, const rq_waiter &waiter, ether_arp_frame &frame,
+                       struct sockaddr_ll &req_if);
+extern void rq_clear();
+/* Answer the waiters for ipaddr that are not on ifindex, the interface it
+ * replied on */
+extern void rq_process(struct in_addr ipaddr, int ifindex, int group, FileSystem &, Context &,
+                       Clock &);
+
+/* What parseproc() saw of the kernel ARP table since main_thread() last
+ * asked, under arptab_mutex. An unchanged table is polled less and less
+ * often, hosts that appear or move have it polled at option_poll_min. */
+struct poll_state {
+  uint64_t hash = 0;    /* FNV-1a of the last read of PROC_ARP */
+  bool changed = false; /* the table differed from the read before */
+  bool churn = false;   /* new entries, or entries that moved to another interface */
+  int interval = SLEEPTIME / 1000; /* ms */
+};
+
+extern poll_state proc_poll;
+
+extern void parseproc(FileSystem &, Context &, Clock &);
+/* ms until the next poll, from what was seen since the last call */
+extern int poll_next(poll_state &state);
+extern void processarp(Context &, Clock &, bool cleanup);
+extern void iface_withdraw(const char *ifname, Context &, Clock &);
 
 extern void sighandler(int);
-void *main_thread(FileSystem &fileSystem, Context &context);
+extern void statshandler(int);
+extern void handoverhandler(int);
+extern void reloadhandler(int);
+extern void stats_log();
+void *main_thread(FileSystem &fileSystem, Context &context, Clock &clock);
+void *link_thread(FileSystem &fileSystem, Context &context, Clock &clock);
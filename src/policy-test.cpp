@@ -0,0 +1,63 @@
+#include "policy.h"
+
+#include <catch2/catch.hpp>
+
+namespace {
+
+constexpr const char *TAGS = "policy";
+
+TEST_CASE("policy-test", TAGS) {
+  SECTION("policy_parse") {
+    policy_rule rule;
+
+    CHECK(policy_parse("wlan*:timeout=20,refresh=10,retries=3,pace=2.5", rule));
+    CHECK(rule.pattern == "wlan*");
+    CHECK(rule.timeout == 20);
+    CHECK(rule.refresh == 10);
+    CHECK(rule.retries == 3);
+    CHECK(rule.pace == 2.5);
+
+    CHECK(policy_parse("eth0:refresh=300", rule));
+    CHECK(!rule.timeout);
+    CHECK(rule.refresh == 300);
+
+    CHECK(!policy_parse("eth0", rule));
+    CHECK(!policy_parse("eth0:", rule));
+    CHECK(!policy_parse("eth0:timeout=0", rule));
+    CHECK(!policy_parse("eth0:refresh", rule));
+    CHECK(!policy_parse("eth0:pace=-1", rule));
+    CHECK(!policy_parse("eth0:interval=5", rule));
+  }
+
+  SECTION("policy_lookup") {
+    iface_policy defaults{60, 50, 1, 0};
+    policy_rules.clear();
+    policy_rule rule;
+    REQUIRE(policy_parse("wlan*:timeout=20,pace=5", rule));
+    policy_rules.push_back(rule);
+    REQUIRE(policy_parse("wlan1:timeout=30,retries=3", rule));
+    policy_rules.push_back(rule);
+
+    GIVEN("an interface no rule matches") {
+      auto policy = policy_lookup("eth0", defaults);
+      THEN("the defaults apply") {
+        CHECK(policy.timeout == 60);
+        CHECK(policy.refresh == 50);
+        CHECK(policy.retries == 1);
+        CHECK(policy.pace == 0);
+      }
+    }
+    GIVEN("an interface several rules match") {
+      auto policy = policy_lookup("wlan1", defaults);
+      THEN("later rules override what they set") {
+        CHECK(policy.timeout == 30);
+        CHECK(policy.refresh == 50);
+        CHECK(policy.retries == 3);
+        CHECK(policy.pace == 5);
+      }
+    }
+    policy_rules.clear();
+  }
+}
+
+} // namespace
@@ -0,0 +1,99 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "policy.h"
+
+#include <fnmatch.h>
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+std::vector<policy_rule> policy_rules;
+
+namespace {
+
+bool integer(const char *value, long min, long max, std::optional<int> &out) {
+  char *end;
+  long n = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || n < min || n > max) {
+    return false;
+  }
+  out = static_cast<int>(n);
+  return true;
+}
+
+} // namespace
+
+bool policy_parse(const char *spec, policy_rule &rule) {
+  const char *colon = strrchr(spec, ':');
+  char buf[256];
+  char *save;
+
+  rule = policy_rule{};
+  if (colon == NULL || colon == spec || strlen(colon + 1) >= sizeof(buf)) {
+    return false;
+  }
+  rule.pattern.assign(spec, static_cast<size_t>(colon - spec));
+  strcpy(buf, colon + 1);
+
+  for (char *item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+    char *value = strchr(item, '=');
+    if (value == NULL) {
+      return false;
+    }
+    *value++ = '\0';
+    if (!strcmp(item, "timeout")) {
+      if (!integer(value, 1, INT_MAX, rule.timeout)) {
+        return false;
+      }
+    } else if (!strcmp(item, "refresh")) {
+      if (!integer(value, 1, INT_MAX, rule.refresh)) {
+        return false;
+      }
+    } else if (!strcmp(item, "retries")) {
+      if (!integer(value, 0, 100, rule.retries)) {
+        return false;
+      }
+    } else if (!strcmp(item, "pace")) {
+      char *end;
+      double pace = strtod(value, &end);
+      if (end == value || *end != '\0' || pace < 0) {
+        return false;
+      }
+      rule.pace = pace;
+    } else {
+      return false;
+    }
+  }
+  return rule.timeout || rule.refresh || rule.retries || rule.pace;
+}
+
+iface_policy policy_lookup(const char *ifname, const iface_policy &defaults) {
+  iface_policy policy = defaults;
+
+  for (const auto &rule : policy_rules) {
+    if (fnmatch(rule.pattern.c_str(), ifname, 0) == 0) {
+      policy.timeout = rule.timeout.value_or(policy.timeout);
+      policy.refresh = rule.refresh.value_or(policy.refresh);
+      policy.retries = rule.retries.value_or(policy.retries);
+      policy.pace = rule.pace.value_or(policy.pace);
+    }
+  }
+  return policy;
+}
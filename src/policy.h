@@ -0,0 +1,52 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#define PROBE_RETRIES 1    /* default of iface_policy::retries */
+#define PROBE_RETRY_TIME 1 /* seconds between requests for an unresolved address */
+
+/* How the hosts behind an interface are kept track of. A wired side can
+ * keep its hosts long and ping them rarely, a wireless side forget
+ * roaming clients quickly and ping gently to spare airtime. */
+struct iface_policy {
+  int timeout = 0;  /* seconds an entry lives without being seen */
+  int refresh = 0;  /* seconds between ARP pings of an entry */
+  int retries = PROBE_RETRIES; /* requests sent for an address the kernel cannot resolve */
+  double pace = 0;  /* ARP pings per second at most, 0 = unlimited */
+};
+
+/* Configured policy: "pattern:key=value[,key=value...]", keys timeout,
+ * refresh, retries and pace; keys not given are left to earlier rules */
+struct policy_rule {
+  std::string pattern; /* interface name or fnmatch(3) pattern */
+  std::optional<int> timeout;
+  std::optional<int> refresh;
+  std::optional<int> retries;
+  std::optional<double> pace;
+};
+
+extern std::vector<policy_rule> policy_rules;
+
+extern bool policy_parse(const char *spec, policy_rule &rule);
+/* The defaults, overridden by the rules matching ifname in order */
+extern iface_policy policy_lookup(const char *ifname, const iface_policy &defaults);
@@ -0,0 +1,72 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+/* USDT probes for perf(1), bpftrace(8) and friends, built with
+ * -DPARPROUTED_USDT (meson -Dusdt=enabled, make USDT=1). An unattached
+ * probe is a nop; without PARPROUTED_USDT the probes and their arguments
+ * are compiled out.
+ *
+ * Provider "parprouted". Addresses are in network byte order, durations
+ * in ns:
+ *   request__receive  target, sender, ifindex
+ *   request__send     target, ifindex, gratuitous (relays, refreshes, GARPs)
+ *   reply__send       faked address, ifindex (proxy reply to a requester)
+ *   reply__learned    address, ifindex (kernel ARP table updated)
+ *   queue__add        target, ifindex, queue length
+ *   queue__evict      target, ifindex, time queued
+ *   queue__match      target, ifindex, time queued
+ *   route__add__start / route__remove__start  address, ifindex
+ *   route__add__done / route__remove__done    address, ifindex, duration, success
+ *   parseproc__start  arptab entries
+ *   parseproc__done   lines read, duration */
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+/* Address of an ARP frame field, which may be unaligned */
+inline uint32_t probe_ip(const uint8_t *addr) {
+  uint32_t ip;
+  memcpy(&ip, addr, sizeof(ip));
+  return ip;
+}
+
+#ifdef PARPROUTED_USDT
+
+#include <sys/sdt.h>
+
+#define PROBE(name, ...) STAP_PROBEV(parprouted, name, __VA_ARGS__)
+
+/* Timestamp for the durations */
+inline int64_t probe_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t{ts.tv_sec} * 1000000000 + ts.tv_nsec;
+}
+
+#else
+
+#define PROBE(name, ...)                                                                          \
+  do {                                                                                            \
+  } while (0)
+
+inline int64_t probe_clock() { return 0; }
+
+#endif
@@ -0,0 +1,76 @@
+#include "ratelimit.h"
+
+#include <catch2/catch.hpp>
+
+namespace {
+
+constexpr const char *TAGS = "ratelimit";
+
+TEST_CASE("ratelimit-test", TAGS) {
+  RateLimiter limiter;
+  auto now = Clock::time_point{std::chrono::hours(1)};
+  const unsigned char mac1[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+  const unsigned char mac2[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+  const struct in_addr ip1 {
+    htonl(0x0a000001)
+  };
+
+  auto burst = [&](const unsigned char *mac, const rate_limit &limit) {
+    int allowed = 0;
+    for (int i = 0; i < 100; i++) {
+      allowed += limiter.allow(2, mac, ip1, limit, now);
+    }
+    return allowed;
+  };
+
+  SECTION("token bucket") {
+    GIVEN("no limit") {
+      THEN("everything is allowed") { CHECK(burst(mac1, rate_limit{}) == 100); }
+    }
+    GIVEN("5 per second, burst 10") {
+      rate_limit limit{5, 10};
+      THEN("a burst is cut at 10") { CHECK(burst(mac1, limit) == 10); }
+      WHEN("the burst is used up") {
+        burst(mac1, limit);
+        THEN("other senders are not affected") { CHECK(burst(mac2, limit) == 10); }
+        THEN("tokens come back at the rate") {
+          now += std::chrono::milliseconds(1000);
+          CHECK(burst(mac1, limit) == 5);
+        }
+        THEN("no more than the burst accumulates") {
+          now += std::chrono::hours(1);
+          CHECK(burst(mac1, limit) == 10);
+        }
+      }
+    }
+  }
+
+  SECTION("rate_parse") {
+    rate_rule rule;
+
+    CHECK(rate_parse("wlan*:5/20", rule));
+    CHECK(rule.pattern == "wlan*");
+    CHECK(rule.limit.rate == 5);
+    CHECK(rule.limit.burst == 20);
+
+    CHECK(rate_parse("eth0:0.5", rule));
+    CHECK(rule.limit.rate == 0.5);
+    CHECK(rule.limit.burst == 1);
+
+    CHECK(!rate_parse("eth0", rule));
+    CHECK(!rate_parse("eth0:", rule));
+    CHECK(!rate_parse("eth0:5/", rule));
+    CHECK(!rate_parse("eth0:5x", rule));
+    CHECK(!rate_parse("eth0:-1", rule));
+  }
+
+  SECTION("rate_lookup") {
+    rate_rules = {{"*", {10, 10}}, {"wlan*", {2, 4}}};
+    CHECK(rate_lookup("eth0").rate == 10);
+    CHECK(rate_lookup("wlan0").rate == 2);
+    rate_rules.clear();
+    CHECK(rate_lookup("eth0").rate == 0);
+  }
+}
+
+} // namespace
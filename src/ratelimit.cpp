@@ -0,0 +1,98 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "ratelimit.h"
+
+#include <fnmatch.h>
+#include <net/ethernet.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+std::vector<rate_rule> rate_rules;
+
+bool rate_parse(const char *spec, rate_rule &rule) {
+  const char *colon = strrchr(spec, ':');
+  char *end;
+
+  if (colon == NULL || colon == spec) {
+    return false;
+  }
+  rule.pattern.assign(spec, static_cast<size_t>(colon - spec));
+
+  rule.limit.rate = strtod(colon + 1, &end);
+  if (end == colon + 1 || rule.limit.rate < 0) {
+    return false;
+  }
+  rule.limit.burst = std::max(rule.limit.rate, 1.0);
+  if (*end == '/') {
+    const char *burst = end + 1;
+    rule.limit.burst = strtod(burst, &end);
+    if (end == burst || rule.limit.burst < 1) {
+      return false;
+    }
+  }
+  return *end == '\0';
+}
+
+/* The last rule matching the interface applies */
+rate_limit rate_lookup(const char *ifname) {
+  rate_limit limit;
+
+  for (const auto &rule : rate_rules) {
+    if (fnmatch(rule.pattern.c_str(), ifname, 0) == 0) {
+      limit = rule.limit;
+    }
+  }
+  return limit;
+}
+
+bool RateLimiter::allow(int ifindex, const unsigned char *sha, struct in_addr spa,
+                        const rate_limit &limit, Clock::time_point now) {
+  unsigned char key[sizeof(ifindex) + ETH_ALEN + sizeof(spa)];
+  uint64_t hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+
+  if (limit.rate <= 0) {
+    return true;
+  }
+
+  memcpy(key, &ifindex, sizeof(ifindex));
+  memcpy(key + sizeof(ifindex), sha, ETH_ALEN);
+  memcpy(key + sizeof(ifindex) + ETH_ALEN, &spa, sizeof(spa));
+  for (unsigned char byte : key) {
+    hash = (hash ^ byte) * 0x100000001b3ULL;
+  }
+
+  std::lock_guard lock(mutex);
+  Bucket &bucket = buckets[hash % RATE_BUCKETS];
+
+  if (!bucket.used) {
+    bucket = Bucket{limit.burst, now, true};
+  } else {
+    double elapsed = std::max(0.0, std::chrono::duration<double>(now - bucket.last).count());
+    bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed * limit.rate);
+    bucket.last = now;
+  }
+
+  if (bucket.tokens < 1) {
+    return false;
+  }
+  bucket.tokens -= 1;
+  return true;
+}
@@ -0,0 +1,69 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include "clock.h"
+
+#include <netinet/in.h>
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define RATE_BUCKETS 4096 /* token buckets shared by all senders */
+
+/* ARP requests per second and burst accepted from one sender on an
+ * interface, rate 0 = unlimited */
+struct rate_limit {
+  double rate = 0;
+  double burst = 0;
+};
+
+/* Command line limit: "pattern:rate[/burst]" */
+struct rate_rule {
+  std::string pattern; /* interface name or fnmatch(3) pattern */
+  rate_limit limit;
+};
+
+extern std::vector<rate_rule> rate_rules;
+
+extern bool rate_parse(const char *spec, rate_rule &rule);
+extern rate_limit rate_lookup(const char *ifname);
+
+/* Token buckets per sender (interface, MAC, IP) in a fixed-size hash
+ * table. Senders hashing to the same slot share its bucket: memory does
+ * not depend on the number of senders, and a flood from spoofed addresses
+ * is bounded by RATE_BUCKETS times the rate in total. */
+class RateLimiter {
+public:
+  bool allow(int ifindex, const unsigned char *sha, struct in_addr spa, const rate_limit &limit,
+             Clock::time_point now);
+
+private:
+  struct Bucket {
+    double tokens;
+    Clock::time_point last;
+    bool used;
+  };
+
+  std::array<Bucket, RATE_BUCKETS> buckets{};
+  std::mutex mutex;
+};
@@ -0,0 +1,320 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* parprouted-replay: feed pcap captures through the ARP state machine.
+ *
+ * Every frame is handed to arp_handle_frame() in capture order, on a
+ * virtual clock taken from the capture timestamps. The periodic work of
+ * main_thread() (parseproc, processarp and refresharp at the interval of
+ * poll_next()) is scheduled on the same virtual clock. The kernel is
+ * replaced by SimKernel, which records every send, route change and
+ * SIOCSARP update as a trace line.
+ *
+ * With -w the frames are spread over several worker threads by ARP sender
+ * IP, the same way the PACKET_FANOUT program of the daemon does, to
+ * measure how the state machine scales with receive workers. With -a the
+ * workers queue the frames for the main thread instead, as in the actor
+ * mode of the daemon. */
+
+#include "parprouted.h"
+
+#include "actor.h"
+#include "sim-kernel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+constexpr uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+constexpr uint32_t LINKTYPE_ETHERNET = 1;
+
+struct Packet {
+  double ts;
+  size_t iface;
+  ether_arp_frame frame;
+};
+
+uint32_t get32(const unsigned char *p, bool swapped) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return swapped ? __builtin_bswap32(v) : v;
+}
+
+/* Read all ARP frames of a classic pcap file, returns false on error */
+bool read_pcap(const char *path, size_t iface, std::vector<Packet> &packets) {
+  unsigned char hdr[24];
+  FILE *f;
+
+  if ((f = fopen(path, "rb")) == NULL) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  if (fread(hdr, sizeof(hdr), 1, f) != 1) {
+    fprintf(stderr, "%s: short pcap header\n", path);
+    fclose(f);
+    return false;
+  }
+
+  uint32_t magic = get32(hdr, false);
+  bool swapped = magic == __builtin_bswap32(PCAP_MAGIC_USEC) ||
+                 magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+  magic = get32(hdr, swapped);
+  if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+    fprintf(stderr, "%s: not a pcap file\n", path);
+    fclose(f);
+    return false;
+  }
+  double tsdiv = magic == PCAP_MAGIC_NSEC ? 1e9 : 1e6;
+
+  if (get32(hdr + 20, swapped) != LINKTYPE_ETHERNET) {
+    fprintf(stderr, "%s: link type %u not supported, need ethernet\n", path,
+            get32(hdr + 20, swapped));
+    fclose(f);
+    return false;
+  }
+
+  unsigned char rec[16];
+  std::vector<unsigned char> data;
+  while (fread(rec, sizeof(rec), 1, f) == 1) {
+    uint32_t caplen = get32(rec + 8, swapped);
+    data.resize(caplen);
+    if (caplen > 0 && fread(data.data(), caplen, 1, f) != 1) {
+      fprintf(stderr, "%s: truncated capture\n", path);
+      break;
+    }
+    if (caplen < sizeof(ether_arp_frame)) {
+      continue;
+    }
+
+    Packet pkt{get32(rec, swapped) + get32(rec + 4, swapped) / tsdiv, iface, {}};
+    memcpy(&pkt.frame, data.data(), sizeof(ether_arp_frame));
+    if (pkt.frame.ether_hdr.ether_type != htons(ETHERTYPE_ARP) ||
+        pkt.frame.arp.arp_hrd != htons(ARPHRD_ETHER) || pkt.frame.arp.arp_pro != htons(ETH_P_IP)) {
+      continue;
+    }
+    packets.push_back(pkt);
+  }
+
+  fclose(f);
+  return true;
+}
+
+double elapsed(const struct timespec &start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return static_cast<double>(end.tv_sec - start.tv_sec) +
+         static_cast<double>(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void usage() {
+  printf("Usage: parprouted-replay [-a] [-d] [-p] [-q] [-w workers] interface=capture.pcap "
+         "[interface=capture.pcap]\n");
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  SimKernel kernel;
+  std::vector<Packet> packets;
+  bool quiet = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-d")) {
+      debug = true;
+      log_level = LOG_DEBUG;
+    } else if (!strcmp(argv[i], "-a")) {
+      option_actor = true;
+    } else if (!strcmp(argv[i], "-p")) {
+      option_arpperm = true;
+    } else if (!strcmp(argv[i], "-q")) {
+      quiet = true;
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      option_workers = atoi(argv[++i]);
+      if (option_workers < 1 || option_workers > MAX_WORKERS) {
+        usage();
+      }
+    } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+      usage();
+    } else {
+      char *sep = strchr(argv[i], '=');
+      if (sep == NULL) {
+        usage();
+      }
+      *sep = '\0';
+      kernel.addIface(argv[i]);
+      iface_add(argv[i]);
+      if (!read_pcap(sep + 1, kernel.ifaces.size() - 1, packets)) {
+        exit(1);
+      }
+    }
+  }
+
+  if (kernel.ifaces.empty()) {
+    usage();
+  }
+
+  std::stable_sort(packets.begin(), packets.end(),
+                   [](const Packet &a, const Packet &b) { return a.ts < b.ts; });
+
+  openlog("parprouted-replay", LOG_PERROR, LOG_USER);
+  pthread_mutex_init(&arptab_mutex, NULL);
+  pthread_mutex_init(&req_queue_mutex, NULL);
+
+  kernel.trace = quiet ? nullptr : stdout;
+
+  std::vector<sockaddr_ll> ifs;
+  for (const auto &iface : kernel.ifaces) {
+    ifs.push_back(kernel.linkAddr(iface));
+  }
+
+  /* virtual clock, driven by the capture timestamps */
+  double start = packets.empty() ? 0 : packets.front().ts;
+  double next_poll = start;
+
+  /* returns the seconds until the next tick */
+  auto tick = [&](double now) {
+    kernel.vtime = now;
+    garp_flush(kernel, kernel);
+    pthread_mutex_lock(&arptab_mutex);
+    parseproc(kernel, kernel, kernel);
+    processarp(kernel, kernel, false);
+    int interval = poll_next(proc_poll);
+    pthread_mutex_unlock(&arptab_mutex);
+    if (!option_arpperm) {
+      pthread_mutex_lock(&arptab_mutex);
+      refresharp(arptab, kernel, kernel);
+      pthread_mutex_unlock(&arptab_mutex);
+    }
+    log_flush();
+    return interval / 1e3;
+  };
+
+  struct timespec wall;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+
+  if (option_workers == 1 && !option_actor) {
+    for (auto &pkt : packets) {
+      while (next_poll <= pkt.ts) {
+        next_poll += tick(next_poll);
+      }
+      kernel.vtime = pkt.ts;
+      garp_flush(kernel, kernel);
+      arp_handle_frame(&pkt.frame, &ifs[pkt.iface], kernel.ifaces[pkt.iface].name.c_str(), kernel,
+                       kernel, kernel);
+      /* keep the debug output next to the trace of the frame */
+      if (debug) {
+        log_flush();
+      }
+    }
+  } else {
+    /* each worker replays its share in capture order and publishes its
+     * progress; the virtual clock is the slowest worker, and the periodic
+     * work runs concurrently like main_thread() does in the daemon */
+    std::vector<std::atomic<double>> progress(static_cast<size_t>(option_workers));
+    std::vector<std::thread> workers;
+
+    for (size_t w = 0; w < progress.size(); w++) {
+      progress[w] = start;
+      workers.emplace_back([&, w] {
+        actor_ring *ring = option_actor ? actor_open() : NULL;
+        for (auto &pkt : packets) {
+          uint32_t spa;
+          memcpy(&spa, pkt.frame.arp.arp_spa, sizeof(spa));
+          if (ntohl(spa) % progress.size() != w) {
+            continue;
+          }
+          progress[w] = pkt.ts;
+          const char *ifname = kernel.ifaces[pkt.iface].name.c_str();
+          if (ring == NULL) {
+            arp_handle_frame(&pkt.frame, &ifs[pkt.iface], ifname, kernel, kernel, kernel);
+            continue;
+          }
+          /* a capture is replayed completely, no frame is dropped */
+          while (!actor_push(ring, &pkt.frame, &ifs[pkt.iface], ifname)) {
+            std::this_thread::yield();
+          }
+        }
+        if (ring != NULL) {
+          actor_close(ring);
+        }
+        progress[w] = std::numeric_limits<double>::infinity();
+      });
+    }
+
+    double end = packets.empty() ? start : packets.back().ts;
+    while (next_poll <= end) {
+      if (option_actor) {
+        actor_drain(kernel, kernel, kernel);
+      }
+      double now = std::numeric_limits<double>::infinity();
+      for (auto &p : progress) {
+        now = std::min(now, p.load());
+      }
+      if (now < next_poll) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (option_actor) {
+        actor_drain(kernel, kernel, kernel);
+      }
+      next_poll += tick(next_poll);
+    }
+    /* workers may wait for room in their rings */
+    while (option_actor && std::any_of(progress.begin(), progress.end(), [](auto &p) {
+             return p.load() != std::numeric_limits<double>::infinity();
+           })) {
+      actor_drain(kernel, kernel, kernel);
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    if (option_actor) {
+      actor_drain(kernel, kernel, kernel);
+    }
+  }
+  tick(next_poll);
+
+  double wall_secs = elapsed(wall);
+  double virt_secs = packets.empty() ? 0 : packets.back().ts - start;
+
+  fprintf(stderr, "workers:       %d\n", option_workers);
+  fprintf(stderr, "frames:        %zu\n", packets.size());
+  fprintf(stderr, "capture span:  %.3f s\n", virt_secs);
+  fprintf(stderr, "replay time:   %.3f s\n", wall_secs);
+  fprintf(stderr, "throughput:    %.0f frames/s\n",
+          wall_secs > 0 ? static_cast<double>(packets.size()) / wall_secs : 0.0);
+  fprintf(stderr, "sends:         %lu\n", kernel.counters.sends);
+  fprintf(stderr, "route adds:    %lu\n", kernel.counters.route_adds);
+  fprintf(stderr, "route dels:    %lu\n", kernel.counters.route_dels);
+  fprintf(stderr, "route errors:  %lu\n", kernel.counters.route_failures);
+  fprintf(stderr, "arp updates:   %lu\n", kernel.counters.arp_updates);
+  fprintf(stderr, "routes left:   %zu\n", kernel.routes.size());
+  fprintf(stderr, "arptab:        %zu entries, %lu evicted\n", arptab_len,
+          stats.arptab_evictions.load());
+
+  return 0;
+}
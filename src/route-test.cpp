@@ -0,0 +1,116 @@
+#include <catch2/catch.hpp>
+
+#include "context-mock.h"
+#include "parprouted.h"
+
+namespace {
+
+using trompeloeil::_;
+using namespace trompeloeil;
+using namespace std::string_literals;
+
+constexpr const char *TAGS = "route";
+
+TEST_CASE("route-test", TAGS) {
+  while (arptab != nullptr) {
+    delete std::exchange(arptab, arptab->next);
+  }
+  arptab_len = 0;
+  stats.routes_missing = stats.routes_stray = stats.routes_adopted = 0;
+
+  ContextMock context{};
+
+  auto createEntry = [](uint32_t ip, const char *dev, bool route_added, bool want_route) {
+    auto *entry = replace_entry(in_addr{htonl(ip)}, dev);
+    entry->ipaddr_ia = in_addr{htonl(ip)};
+    strcpy(entry->ifname, dev);
+    entry->route_added = route_added;
+    entry->want_route = want_route;
+    return entry;
+  };
+
+  SECTION("route reconciliation") {
+    GIVEN("arptab and kernel agree") {
+      createEntry(0x0a000002, "dev0", true, true);
+      createEntry(0x0a000001, "dev1", true, true);
+      std::vector<kernel_route> routes{{0x0a000001, "dev1"}, {0x0a000002, "dev0"}};
+      FORBID_CALL(context, system(_));
+      route_reconcile(routes, context);
+      THEN("nothing changes") {
+        CHECK(stats.routes_missing == 0);
+        CHECK(stats.routes_stray == 0);
+        CHECK(stats.routes_adopted == 0);
+      }
+    }
+    GIVEN("an installed route was deleted behind our back") {
+      auto *entry = createEntry(0x0a000001, "dev0", true, true);
+      std::vector<kernel_route> routes{};
+      route_reconcile(routes, context);
+      THEN("it is added again by the next processarp") {
+        CHECK(!entry->route_added);
+        CHECK(stats.routes_missing == 1);
+      }
+    }
+    GIVEN("a route nobody wants, on another device than the host") {
+      auto *dev1 = iface_add("dev1");
+      createEntry(0x0a000001, "dev0", true, true);
+      std::vector<kernel_route> routes{{0x0a000001, "dev0"}, {0x0a000001, "dev1"}};
+      REQUIRE_CALL(context,
+                   system(eq("/sbin/ip route del 10.0.0.1/32 metric 50 dev dev1 scope link"s)))
+          .RETURN(0);
+      route_reconcile(routes, context);
+      delete iface_remove(dev1->name);
+      THEN("it is deleted") { CHECK(stats.routes_stray == 1); }
+    }
+    GIVEN("a route on an interface we are not attached to") {
+      createEntry(0x0a000001, "dev0", true, true);
+      std::vector<kernel_route> routes{{0x0a000001, "dev0"}, {0x0a000002, "other0"}};
+      FORBID_CALL(context, system(_));
+      route_reconcile(routes, context);
+      THEN("it is left to its owner") { CHECK(stats.routes_stray == 0); }
+    }
+    GIVEN("a route that ip(8) failed to add") {
+      auto *entry = createEntry(0x0a000001, "dev0", false, true);
+      std::vector<kernel_route> routes{{0x0a000001, "dev0"}};
+      FORBID_CALL(context, system(_));
+      route_reconcile(routes, context);
+      THEN("it is adopted") {
+        CHECK(entry->route_added);
+        CHECK(stats.routes_adopted == 1);
+      }
+    }
+    GIVEN("a route of an incomplete entry") {
+      createEntry(0x0a000001, "dev0", false, false);
+      std::vector<kernel_route> routes{{0x0a000001, "dev0"}};
+      REQUIRE_CALL(context,
+                   system(eq("/sbin/ip route del 10.0.0.1/32 metric 50 dev dev0 scope link"s)))
+          .RETURN(0);
+      route_reconcile(routes, context);
+      THEN("it is deleted") { CHECK(stats.routes_stray == 1); }
+    }
+  }
+
+  SECTION("routing table of our own") {
+    auto *entry = createEntry(0x0a000001, "dev0", false, true);
+    option_route_table = 100;
+    option_route_proto = 99;
+    REQUIRE_CALL(context, system(eq("/sbin/ip route add 10.0.0.1/32 metric 50 dev dev0 scope link"
+                                    " table 100 proto 99"s)))
+        .RETURN(0);
+    CHECK(route_add(context, entry));
+    option_route_table = ROUTE_TABLE_MAIN;
+    option_route_proto = 0;
+  }
+
+  SECTION("routes in the main table are not flushed in bulk") {
+    CHECK(!route_flush(NULL));
+    CHECK(!route_flush("dev0"));
+  }
+
+  while (arptab != nullptr) {
+    delete std::exchange(arptab, arptab->next);
+  }
+  arptab_len = 0;
+}
+
+} // namespace
@@ -0,0 +1,323 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* Proxy routes as seen by the kernel, over netlink.
+ *
+ * Reconciliation: the route_added flags are only as good as the ip(8)
+ * exit codes; routes removed or added behind our back would otherwise go
+ * unnoticed until the entry expires. Every RECONCILE_TIME the proxy routes
+ * (/32, metric ROUTE_METRIC, in option_route_table, of option_route_proto
+ * if set) are dumped and merged with arptab, both sorted by address and
+ * device, and only the differences are fixed. Stray routes are only
+ * deleted on interfaces we are attached to.
+ *
+ * Flush: in a table of our own, all routes or those of an interface are
+ * deleted with one dump and a batch of RTM_DELROUTE messages per send(),
+ * instead of one ip(8) per route. */
+
+#include "parprouted.h"
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "context.h"
+
+namespace {
+
+bool route_less(in_addr_t ip1, const char *dev1, in_addr_t ip2, const char *dev2) {
+  return ip1 != ip2 ? ip1 < ip2 : strcmp(dev1, dev2) < 0;
+}
+
+/* ifindex to name, resolved once per dump */
+const char *ifindex_name(std::vector<std::pair<int, std::string>> &cache, int ifindex) {
+  for (const auto &[index, name] : cache) {
+    if (index == ifindex) {
+      return name.c_str();
+    }
+  }
+  char name[IFNAMSIZ] = "";
+  if (if_indextoname(static_cast<unsigned>(ifindex), name) == NULL) {
+    return NULL;
+  }
+  cache.emplace_back(ifindex, name);
+  return cache.back().second.c_str();
+}
+
+} // namespace
+
+bool route_dump(std::vector<kernel_route> &routes) {
+  struct {
+    struct nlmsghdr nlh;
+    struct rtmsg rtm;
+  } req = {};
+  std::vector<std::pair<int, std::string>> names;
+  char buf[32768];
+  bool done = false;
+  int sock;
+
+  routes.clear();
+  if ((sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+    LOG(LOG_ERR, "error: netlink socket: %s", strerror(errno));
+    return false;
+  }
+
+  req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.rtm));
+  req.nlh.nlmsg_type = RTM_GETROUTE;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nlh.nlmsg_seq = 1;
+  req.rtm.rtm_family = AF_INET;
+  req.rtm.rtm_table = option_route_table < 256 ? static_cast<unsigned char>(option_route_table)
+                                                : static_cast<unsigned char>(RT_TABLE_UNSPEC);
+  if (send(sock, &req, req.nlh.nlmsg_len, 0) < 0) {
+    LOG(LOG_ERR, "error: netlink RTM_GETROUTE: %s", strerror(errno));
+    close(sock);
+    return false;
+  }
+
+  while (!done) {
+    ssize_t len = recv(sock, buf, sizeof(buf), 0);
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      LOG(LOG_ERR, "error: netlink route dump: %s", strerror(errno));
+      close(sock);
+      return false;
+    }
+
+    int remaining = static_cast<int>(len);
+    for (auto *nlh = reinterpret_cast<struct nlmsghdr *>(buf); NLMSG_OK(nlh, remaining);
+         nlh = NLMSG_NEXT(nlh, remaining)) {
+      if (nlh->nlmsg_type == NLMSG_DONE) {
+        done = true;
+        break;
+      }
+      if (nlh->nlmsg_type == NLMSG_ERROR) {
+        LOG(LOG_ERR, "error: netlink route dump failed");
+        close(sock);
+        return false;
+      }
+      if (nlh->nlmsg_type != RTM_NEWROUTE) {
+        continue;
+      }
+
+      auto *rtm = static_cast<struct rtmsg *>(NLMSG_DATA(nlh));
+      if (rtm->rtm_family != AF_INET || rtm->rtm_dst_len != 32 || rtm->rtm_type != RTN_UNICAST ||
+          (option_route_proto != 0 && rtm->rtm_protocol != option_route_proto)) {
+        continue;
+      }
+
+      int alen = static_cast<int>(RTM_PAYLOAD(nlh));
+      uint32_t table = rtm->rtm_table, priority = 0, dst = 0;
+      int oif = 0;
+      for (struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, alen); rta = RTA_NEXT(rta, alen)) {
+        if (rta->rta_type == RTA_TABLE) {
+          memcpy(&table, RTA_DATA(rta), sizeof(table));
+        } else if (rta->rta_type == RTA_PRIORITY) {
+          memcpy(&priority, RTA_DATA(rta), sizeof(priority));
+        } else if (rta->rta_type == RTA_DST) {
+          memcpy(&dst, RTA_DATA(rta), sizeof(dst));
+        } else if (rta->rta_type == RTA_OIF) {
+          memcpy(&oif, RTA_DATA(rta), sizeof(oif));
+        }
+      }
+
+      const char *ifname;
+      if (table != option_route_table || priority != ROUTE_METRIC || oif == 0 ||
+          (ifname = ifindex_name(names, oif)) == NULL) {
+        continue;
+      }
+      kernel_route route{ntohl(dst), "", oif};
+      strncpy(route.ifname, ifname, IFNAMSIZ - 1);
+      routes.push_back(route);
+    }
+  }
+
+  close(sock);
+  return true;
+}
+
+void route_reconcile(std::vector<kernel_route> &routes, Context &context) {
+  std::vector<arptab_entry *> entries;
+
+  for (arptab_entry *cur_entry = arptab; cur_entry != NULL; cur_entry = cur_entry->next) {
+    entries.push_back(cur_entry);
+  }
+  std::sort(entries.begin(), entries.end(), [](const arptab_entry *a, const arptab_entry *b) {
+    return route_less(ntohl(a->ipaddr_ia.s_addr), a->ifname, ntohl(b->ipaddr_ia.s_addr),
+                      b->ifname);
+  });
+  std::sort(routes.begin(), routes.end(), [](const kernel_route &a, const kernel_route &b) {
+    return route_less(a.ip, a.ifname, b.ip, b.ifname);
+  });
+
+  auto entry = entries.begin();
+  auto route = routes.begin();
+  while (entry != entries.end() || route != routes.end()) {
+    arptab_entry *cur_entry = entry != entries.end() ? *entry : NULL;
+
+    if (route == routes.end() ||
+        (cur_entry != NULL && route_less(ntohl(cur_entry->ipaddr_ia.s_addr), cur_entry->ifname,
+                                         route->ip, route->ifname))) {
+      /* deleted behind our back: processarp() adds it again */
+      if (cur_entry->route_added) {
+        LOG(LOG_DEBUG, "Route %s(%s) is gone", cur_entry->ipaddr_ia, cur_entry->ifname);
+        cur_entry->route_added = false;
+        stats.routes_missing++;
+      }
+      ++entry;
+      continue;
+    }
+
+    if (cur_entry != NULL && ntohl(cur_entry->ipaddr_ia.s_addr) == route->ip &&
+        strcmp(cur_entry->ifname, route->ifname) == 0) {
+      /* the route is there although ip(8) failed, or was added by hand */
+      if (!cur_entry->route_added && cur_entry->want_route) {
+        cur_entry->route_added = true;
+        stats.routes_adopted++;
+      } else if (!cur_entry->route_added) {
+        route_remove(context, cur_entry);
+        stats.routes_stray++;
+      }
+      ++entry;
+      ++route;
+      continue;
+    }
+
+    /* nobody proxies this host here; routes of interfaces we are not
+     * attached to belong to someone else, e.g. another instance */
+    pthread_rwlock_rdlock(&ifaces_lock);
+    bool ours = iface_find(route->ifname) != NULL;
+    pthread_rwlock_unlock(&ifaces_lock);
+    if (!ours) {
+      ++route;
+      continue;
+    }
+    arptab_entry stray;
+    stray.ipaddr_ia.s_addr = htonl(route->ip);
+    strncpy(stray.ifname, route->ifname, ARP_TABLE_ENTRY_LEN - 1);
+    LOG(LOG_DEBUG, "Route %s(%s) is stray", stray.ipaddr_ia, stray.ifname);
+    route_remove(context, &stray);
+    stats.routes_stray++;
+    ++route;
+  }
+}
+
+bool route_flush(const char *ifname) {
+  struct attr32 {
+    struct rtattr rta;
+    uint32_t val;
+  };
+  struct route_del {
+    struct nlmsghdr nlh;
+    struct rtmsg rtm;
+    attr32 dst, oif, priority, table;
+  };
+  std::vector<kernel_route> routes;
+  /* small enough for the acks of a batch to fit into the receive buffer */
+  char buf[64 * sizeof(route_del)];
+  size_t len = 0, batched = 0, flushed = 0;
+  bool success = true;
+  int sock;
+
+  /* the main table is shared, routes there go one by one with their entry */
+  if (option_route_table == ROUTE_TABLE_MAIN || !route_dump(routes)) {
+    return false;
+  }
+  if ((sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+    LOG(LOG_ERR, "error: netlink socket: %s", strerror(errno));
+    return false;
+  }
+
+  auto attr = [](unsigned short type, uint32_t val) {
+    return attr32{{sizeof(attr32), type}, val};
+  };
+  /* every delete is acked, a failed one with its error; a route that is
+   * gone already is fine */
+  auto acked = [sock](size_t pending) {
+    char ack[8192];
+    bool ok = true;
+    while (pending > 0) {
+      ssize_t n = recv(sock, ack, sizeof(ack), 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        LOG(LOG_ERR, "error: netlink RTM_DELROUTE ack: %s", strerror(errno));
+        return false;
+      }
+      int remaining = static_cast<int>(n);
+      for (auto *nlh = reinterpret_cast<struct nlmsghdr *>(ack); NLMSG_OK(nlh, remaining);
+           nlh = NLMSG_NEXT(nlh, remaining)) {
+        if (nlh->nlmsg_type != NLMSG_ERROR) {
+          continue;
+        }
+        pending--;
+        int error = static_cast<struct nlmsgerr *>(NLMSG_DATA(nlh))->error;
+        if (error != 0 && error != -ESRCH) {
+          LOG(LOG_ERR, "error: netlink RTM_DELROUTE: %s", strerror(-error));
+          ok = false;
+        }
+      }
+    }
+    return ok;
+  };
+  for (size_t i = 0; i <= routes.size() && success; i++) {
+    /* send when the buffer is full, and the rest at the end */
+    if (i == routes.size() || len + sizeof(route_del) > sizeof(buf)) {
+      if (len > 0 && send(sock, buf, len, 0) < 0) {
+        LOG(LOG_ERR, "error: netlink RTM_DELROUTE: %s", strerror(errno));
+        success = false;
+      } else if (!acked(batched)) {
+        success = false;
+      }
+      len = batched = 0;
+    }
+    if (i == routes.size() || (ifname != NULL && strcmp(routes[i].ifname, ifname) != 0)) {
+      continue;
+    }
+
+    route_del del{};
+    del.nlh.nlmsg_len = sizeof(del);
+    del.nlh.nlmsg_type = RTM_DELROUTE;
+    del.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    del.nlh.nlmsg_seq = static_cast<uint32_t>(i);
+    del.rtm.rtm_family = AF_INET;
+    del.rtm.rtm_dst_len = 32;
+    del.rtm.rtm_table = static_cast<unsigned char>(RT_TABLE_UNSPEC);
+    del.rtm.rtm_protocol = static_cast<unsigned char>(option_route_proto);
+    del.rtm.rtm_scope = RT_SCOPE_NOWHERE;
+    del.rtm.rtm_type = RTN_UNICAST;
+    del.dst = attr(RTA_DST, htonl(routes[i].ip));
+    del.oif = attr(RTA_OIF, static_cast<uint32_t>(routes[i].ifindex));
+    del.priority = attr(RTA_PRIORITY, ROUTE_METRIC);
+    del.table = attr(RTA_TABLE, option_route_table);
+    memcpy(buf + len, &del, sizeof(del));
+    len += sizeof(del);
+    batched++;
+    flushed++;
+  }
+  close(sock);
+
+  LOG(LOG_DEBUG, "Flushed %zu routes%s%s", flushed, ifname ? " via " : "", ifname ? ifname : "");
+  return success;
+}
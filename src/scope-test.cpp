@@ -0,0 +1,87 @@
+#include "scope.h"
+
+#include <catch2/catch.hpp>
+
+#include <arpa/inet.h>
+
+namespace {
+
+constexpr const char *TAGS = "scope";
+
+struct in_addr ip(const char *str) {
+  struct in_addr addr {};
+  inet_pton(AF_INET, str, &addr);
+  return addr;
+}
+
+TEST_CASE("scope-test", TAGS) {
+  Scope scope;
+
+  SECTION("longest prefix match") {
+    GIVEN("empty scope") {
+      THEN("everything is in scope") {
+        CHECK(scope.empty());
+        CHECK(scope.contains(ip("10.1.2.3")));
+        CHECK(scope.contains(ip("0.0.0.0")));
+      }
+    }
+    GIVEN("denied prefix only") {
+      scope.add(ip("192.168.0.0"), 16, false);
+      THEN("only the prefix is out of scope") {
+        CHECK(!scope.empty());
+        CHECK(!scope.contains(ip("192.168.7.1")));
+        CHECK(scope.contains(ip("192.169.0.1")));
+      }
+    }
+    GIVEN("allowed 10/8 with denied 10.1/16 and allowed 10.1.2/24") {
+      scope.add(ip("10.0.0.0"), 8, true);
+      scope.add(ip("10.1.0.0"), 16, false);
+      scope.add(ip("10.1.2.0"), 24, true);
+      THEN("the longest prefix decides") {
+        CHECK(scope.contains(ip("10.9.9.9")));
+        CHECK(!scope.contains(ip("10.1.9.9")));
+        CHECK(scope.contains(ip("10.1.2.9")));
+      }
+      THEN("unmatched addresses are out of scope") { CHECK(!scope.contains(ip("11.0.0.1"))); }
+    }
+    GIVEN("host route and default deny") {
+      scope.add(ip("0.0.0.0"), 0, false);
+      scope.add(ip("172.16.0.5"), 32, true);
+      THEN("only the host is in scope") {
+        CHECK(scope.contains(ip("172.16.0.5")));
+        CHECK(!scope.contains(ip("172.16.0.4")));
+      }
+    }
+  }
+
+  SECTION("scope_parse") {
+    scope_rule rule;
+
+    CHECK(scope_parse("eth0:10.0.0.0/8", rule));
+    CHECK(rule.pattern == "eth0");
+    CHECK(rule.allow);
+    CHECK(rule.len == 8);
+    CHECK(rule.prefix.s_addr == ip("10.0.0.0").s_addr);
+
+    CHECK(scope_parse("wlan*:!192.168.1.0/24", rule));
+    CHECK(rule.pattern == "wlan*");
+    CHECK(!rule.allow);
+    CHECK(rule.len == 24);
+
+    CHECK(!scope_parse("10.0.0.0/8", rule));
+    CHECK(!scope_parse("eth0:10.0.0.0", rule));
+    CHECK(!scope_parse("eth0:10.0.0.0/33", rule));
+    CHECK(!scope_parse("eth0:10.0.0/8x", rule));
+    CHECK(!scope_parse("eth0:300.0.0.0/8", rule));
+  }
+
+  SECTION("scope_build") {
+    scope_rules = {{"eth*", ip("10.0.0.0"), 8, true}, {"wlan0", ip("10.1.0.0"), 16, false}};
+    scope_build("eth1", scope);
+    CHECK(scope.contains(ip("10.1.0.1")));
+    CHECK(!scope.contains(ip("11.0.0.1")));
+    scope_rules.clear();
+  }
+}
+
+} // namespace
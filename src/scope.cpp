@@ -0,0 +1,107 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "scope.h"
+
+#include <arpa/inet.h>
+#include <fnmatch.h>
+
+#include <cstdlib>
+#include <cstring>
+
+std::vector<scope_rule> scope_rules;
+
+void Scope::add(struct in_addr prefix, int len, bool allow) {
+  uint32_t addr = ntohl(prefix.s_addr);
+  uint32_t idx = 0;
+
+  for (int bit = 0; bit < len; bit++) {
+    unsigned dir = (addr >> (31 - bit)) & 1;
+    if (nodes[idx].child[dir] == 0) {
+      nodes[idx].child[dir] = static_cast<uint32_t>(nodes.size());
+      nodes.push_back(Node{});
+    }
+    idx = nodes[idx].child[dir];
+  }
+  nodes[idx].verdict = allow ? ALLOW : DENY;
+  any_allow = any_allow || allow;
+}
+
+bool Scope::contains(struct in_addr addr) const {
+  uint32_t host = ntohl(addr.s_addr);
+  uint8_t verdict = nodes[0].verdict;
+  uint32_t idx = 0;
+
+  for (int bit = 0; bit < 32; bit++) {
+    idx = nodes[idx].child[(host >> (31 - bit)) & 1];
+    if (idx == 0) {
+      break;
+    }
+    if (nodes[idx].verdict != NONE) {
+      verdict = nodes[idx].verdict;
+    }
+  }
+
+  if (verdict == NONE) {
+    return !any_allow;
+  }
+  return verdict == ALLOW;
+}
+
+bool scope_parse(const char *spec, scope_rule &rule) {
+  const char *colon = strrchr(spec, ':');
+  const char *slash;
+  char ip[INET_ADDRSTRLEN];
+  char *end;
+
+  if (colon == NULL || colon == spec) {
+    return false;
+  }
+  rule.pattern.assign(spec, static_cast<size_t>(colon - spec));
+
+  const char *net = colon + 1;
+  rule.allow = *net != '!';
+  if (!rule.allow) {
+    net++;
+  }
+
+  if ((slash = strchr(net, '/')) == NULL || static_cast<size_t>(slash - net) >= sizeof(ip)) {
+    return false;
+  }
+  memcpy(ip, net, static_cast<size_t>(slash - net));
+  ip[slash - net] = '\0';
+  if (inet_pton(AF_INET, ip, &rule.prefix) != 1) {
+    return false;
+  }
+
+  long len = strtol(slash + 1, &end, 10);
+  if (*end != '\0' || end == slash + 1 || len < 0 || len > 32) {
+    return false;
+  }
+  rule.len = static_cast<int>(len);
+  return true;
+}
+
+/* Collect the rules of all patterns matching the interface */
+void scope_build(const char *ifname, Scope &scope) {
+  for (const auto &rule : scope_rules) {
+    if (fnmatch(rule.pattern.c_str(), ifname, 0) == 0) {
+      scope.add(rule.prefix, rule.len, rule.allow);
+    }
+  }
+}
@@ -0,0 +1,62 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Allowed and denied IPv4 prefixes of an interface, i.e. the addresses
+ * that may live behind it.
+ *
+ * Binary trie in one flat array, looked up on every received frame. The
+ * longest matching prefix decides; an address matching no prefix is in
+ * scope unless allowed prefixes were given. */
+class Scope {
+public:
+  void add(struct in_addr prefix, int len, bool allow);
+  bool contains(struct in_addr addr) const;
+  bool empty() const { return nodes.size() == 1; }
+
+private:
+  enum : uint8_t { NONE, ALLOW, DENY };
+
+  struct Node {
+    uint32_t child[2]; /* index into nodes, 0 = none (root is never a child) */
+    uint8_t verdict;
+  };
+
+  std::vector<Node> nodes{Node{}};
+  bool any_allow = false;
+};
+
+/* Command line scope: "pattern:[!]a.b.c.d/len" */
+struct scope_rule {
+  std::string pattern; /* interface name or fnmatch(3) pattern */
+  struct in_addr prefix;
+  int len;
+  bool allow;
+};
+
+extern std::vector<scope_rule> scope_rules;
+
+extern bool scope_parse(const char *spec, scope_rule &rule);
+extern void scope_build(const char *ifname, Scope &scope);
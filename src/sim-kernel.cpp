@@ -0,0 +1,275 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "sim-kernel.h"
+
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+
+namespace {
+
+std::string ipstr(uint32_t ip_host) {
+  char buf[INET_ADDRSTRLEN];
+  struct in_addr ia {
+    htonl(ip_host)
+  };
+  inet_ntop(AF_INET, &ia, buf, sizeof(buf));
+  return buf;
+}
+
+std::string ipstr(const uint8_t (&ip)[4]) {
+  char buf[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, ip, buf, sizeof(buf));
+  return buf;
+}
+
+std::string macstr(const unsigned char *hwaddr) {
+  char buf[18];
+  snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x", hwaddr[0], hwaddr[1], hwaddr[2],
+           hwaddr[3], hwaddr[4], hwaddr[5]);
+  return buf;
+}
+
+} // namespace
+
+const SimKernel::Iface &SimKernel::addIface(const std::string &name) {
+  auto idx = static_cast<uint16_t>(ifaces.size() + 1);
+  auto hi = static_cast<unsigned char>(idx >> 8), lo = static_cast<unsigned char>(idx);
+  Iface iface{name, idx, {0x02, 0x00, 0x00, 0x00, hi, lo}, {}};
+  /* 10.255-hi.lo.1 */
+  iface.addr.s_addr = htonl((0x0aff0001U - (static_cast<uint32_t>(hi) << 16)) |
+                            static_cast<uint32_t>(lo) << 8);
+  ifaces.push_back(iface);
+  return ifaces.back();
+}
+
+const SimKernel::Iface *SimKernel::findIface(const char *name) const {
+  for (const auto &iface : ifaces) {
+    if (iface.name == name) {
+      return &iface;
+    }
+  }
+  return nullptr;
+}
+
+const SimKernel::Iface *SimKernel::findIface(int ifindex) const {
+  for (const auto &iface : ifaces) {
+    if (iface.ifindex == ifindex) {
+      return &iface;
+    }
+  }
+  return nullptr;
+}
+
+sockaddr_ll SimKernel::linkAddr(const Iface &iface) const {
+  sockaddr_ll ifs{};
+  ifs.sll_family = AF_PACKET;
+  ifs.sll_protocol = htons(ETH_P_ARP);
+  ifs.sll_ifindex = iface.ifindex;
+  ifs.sll_hatype = ARPHRD_ETHER;
+  ifs.sll_pkttype = PACKET_BROADCAST;
+  ifs.sll_halen = ETH_ALEN;
+  memcpy(ifs.sll_addr, iface.hwaddr, ETH_ALEN);
+  return ifs;
+}
+
+int SimKernel::system(const char *command) {
+  char verb[16], dev[IFNAMSIZ + 1];
+  char ip[INET_ADDRSTRLEN];
+  struct in_addr ia;
+
+  if (sscanf(command, "/sbin/ip route %15s %15[^/]/32 metric %*d dev %16s", verb, ip, dev) != 3 ||
+      inet_aton(ip, &ia) == 0) {
+    if (trace) {
+      fprintf(trace, "%.6f exec '%s'\n", vtime.load(), command);
+    }
+    return 0;
+  }
+
+  std::lock_guard lock(mutex);
+  Key key{ntohl(ia.s_addr), dev};
+  int rc = 0;
+
+  if (!strcmp(verb, "add")) {
+    rc = routes.insert(key).second ? 0 : 2; /* RTNETLINK answers: File exists */
+    counters.route_adds++;
+  } else if (!strcmp(verb, "del")) {
+    rc = routes.erase(key) ? 0 : 2; /* RTNETLINK answers: No such process */
+    counters.route_dels++;
+  }
+  if (rc) {
+    counters.route_failures++;
+  }
+  if (trace) {
+    fprintf(trace, "%.6f route %s %s dev %s%s\n", vtime.load(), verb, ip, dev,
+            rc ? " failed" : "");
+  }
+  return rc;
+}
+
+int SimKernel::socket(int /* domain */, int /* type */, int /* protocol */) {
+  std::lock_guard lock(mutex);
+  fds.insert(nextFd);
+  return nextFd++;
+}
+
+int SimKernel::bind(int sockfd, const struct sockaddr * /* addr */, socklen_t /* addrlen */) {
+  std::lock_guard lock(mutex);
+  return fds.count(sockfd) ? 0 : -1;
+}
+
+int SimKernel::ioctl3(int fd, unsigned long request, void *arg) {
+  std::lock_guard lock(mutex);
+  if (!fds.count(fd)) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (request == SIOCSARP) {
+    auto *req = static_cast<struct arpreq *>(arg);
+    auto *sin = reinterpret_cast<struct sockaddr_in *>(&req->arp_pa);
+    Key key{ntohl(sin->sin_addr.s_addr), req->arp_dev};
+    Neighbour &neigh = neighbours[key];
+    memcpy(neigh.hwaddr, req->arp_ha.sa_data, ETH_ALEN);
+    neigh.flags = req->arp_flags;
+    counters.arp_updates++;
+    if (trace) {
+      fprintf(trace, "%.6f arp set %s lladdr %s dev %s%s\n", vtime.load(),
+              ipstr(key.first).c_str(), macstr(neigh.hwaddr).c_str(), req->arp_dev,
+              (req->arp_flags & ATF_PERM) ? " permanent" : "");
+    }
+    return 0;
+  }
+
+  auto *ifr = static_cast<struct ifreq *>(arg);
+  const Iface *iface = findIface(ifr->ifr_name);
+  if (iface == nullptr) {
+    errno = ENODEV;
+    return -1;
+  }
+
+  switch (request) {
+  case SIOCGIFHWADDR:
+    ifr->ifr_hwaddr.sa_family = ARPHRD_ETHER;
+    memcpy(ifr->ifr_hwaddr.sa_data, iface->hwaddr, ETH_ALEN);
+    return 0;
+  case SIOCGIFINDEX:
+    ifr->ifr_ifindex = iface->ifindex;
+    return 0;
+  case SIOCGIFADDR: {
+    struct sockaddr_in sin {};
+    sin.sin_family = AF_INET;
+    sin.sin_addr = iface->addr;
+    memcpy(&ifr->ifr_addr, &sin, sizeof(sin));
+    return 0;
+  }
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+}
+
+ssize_t SimKernel::sendto(int sockfd, const void *buf, size_t len, int /* flags */,
+                          const struct sockaddr *dest_addr, socklen_t /* addrlen */) {
+  const auto *ifs = reinterpret_cast<const sockaddr_ll *>(dest_addr);
+  const Iface *iface = findIface(ifs->sll_ifindex);
+  ether_arp_frame frame;
+
+  std::unique_lock lock(mutex);
+  if (!fds.count(sockfd) || iface == nullptr || len < sizeof(ether_arp_frame)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memcpy(&frame, buf, sizeof(frame));
+  counters.sends++;
+
+  if (trace) {
+    if (frame.arp.arp_op == htons(ARPOP_REPLY)) {
+      fprintf(trace, "%.6f send %s reply %s is-at %s to %s\n", vtime.load(),
+              iface->name.c_str(), ipstr(frame.arp.arp_spa).c_str(),
+              macstr(frame.arp.arp_sha).c_str(), ipstr(frame.arp.arp_tpa).c_str());
+    } else {
+      fprintf(trace, "%.6f send %s who-has %s tell %s\n", vtime.load(), iface->name.c_str(),
+              ipstr(frame.arp.arp_tpa).c_str(), ipstr(frame.arp.arp_spa).c_str());
+    }
+  }
+  lock.unlock();
+  if (onSend) {
+    onSend(*iface, frame);
+  }
+  return static_cast<ssize_t>(len);
+}
+
+int SimKernel::close(int fd) {
+  std::lock_guard lock(mutex);
+  return fds.erase(fd) ? 0 : -1;
+}
+
+Clock::time_point SimKernel::now() {
+  return time_point(std::chrono::duration_cast<time_point::duration>(
+      std::chrono::duration<double>(vtime.load())));
+}
+
+void SimKernel::sleep_for(std::chrono::microseconds duration) {
+  vtime += std::chrono::duration<double>(duration).count();
+}
+
+FILE *SimKernel::fopen(const char *pathname, const char *mode) {
+  if (strcmp(pathname, PROC_ARP) != 0) {
+    errno = ENOENT;
+    return nullptr;
+  }
+
+  std::lock_guard lock(mutex);
+  std::string content =
+      "IP address       HW type     Flags       HW address            Mask     Device\n";
+  for (const auto &[key, neigh] : neighbours) {
+    char line[ARP_LINE_LEN];
+    char flags[8];
+    snprintf(flags, sizeof(flags), "0x%x", neigh.flags);
+    snprintf(line, sizeof(line), "%-16s 0x1         %-11s %-21s *        %s\n",
+             ipstr(key.first).c_str(), flags, macstr(neigh.hwaddr).c_str(), key.second.c_str());
+    content += line;
+  }
+
+  /* fmemopen() does not copy, keep the buffer alive until fclose() */
+  auto buf = std::make_unique<std::string>(std::move(content));
+  FILE *file = ::fmemopen(buf->data(), buf->size(), mode);
+  if (file != nullptr) {
+    files.emplace(file, std::move(buf));
+  }
+  return file;
+}
+
+int SimKernel::fclose(FILE *stream) {
+  std::lock_guard lock(mutex);
+  auto it = files.find(stream);
+  int rc = ::fclose(stream);
+  if (it != files.end()) {
+    files.erase(it);
+  }
+  return rc;
+}
+
+int SimKernel::feof(FILE *stream) { return ::feof(stream); }
+
+int SimKernel::ferror(FILE *stream) { return ::ferror(stream); }
+
+char *SimKernel::fgets(char s[], int size, FILE *stream) { return ::fgets(s, size, stream); }
@@ -0,0 +1,114 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include "clock.h"
+#include "context.h"
+#include "fs.h"
+#include "parprouted.h"
+
+#include <linux/if_packet.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* In-memory stand-in for the kernel, used by the offline tools.
+ *
+ * Implements Context, FileSystem and Clock: the clock is virtual and only
+ * advances when the tool moves it. Interface ioctls are answered from a
+ * static interface list, SIOCSARP updates a simulated neighbour table that
+ * is rendered as /proc/net/arp, "ip route" commands update a simulated
+ * route table and every frame passed to sendto() is recorded. The calls
+ * are serialized internally so several receive workers can share it. */
+struct SimKernel final : Context, FileSystem, Clock {
+  struct Iface {
+    std::string name;
+    int ifindex;
+    unsigned char hwaddr[ETH_ALEN];
+    struct in_addr addr;
+  };
+
+  struct Neighbour {
+    unsigned char hwaddr[ETH_ALEN];
+    int flags;
+  };
+
+  struct Counters {
+    unsigned long sends;
+    unsigned long route_adds;
+    unsigned long route_dels;
+    unsigned long route_failures;
+    unsigned long arp_updates;
+  };
+
+  /* (ip in host byte order, device) */
+  using Key = std::pair<uint32_t, std::string>;
+
+  std::vector<Iface> ifaces;
+  std::map<Key, Neighbour> neighbours;
+  std::set<Key> routes;
+  Counters counters{};
+
+  /* virtual time in seconds, returned by now() and used to stamp trace lines */
+  std::atomic<double> vtime{};
+  /* output trace, nullptr to disable */
+  FILE *trace{};
+  /* invoked for every frame sent by the daemon */
+  std::function<void(const Iface &, const ether_arp_frame &)> onSend;
+
+  const Iface &addIface(const std::string &name);
+  const Iface *findIface(const char *name) const;
+  const Iface *findIface(int ifindex) const;
+  sockaddr_ll linkAddr(const Iface &) const;
+
+  /* Context */
+  int system(const char *command) override;
+  int socket(int domain, int type, int protocol) override;
+  int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) override;
+  int ioctl3(int fd, unsigned long request, void *arg) override;
+  ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
+                 const struct sockaddr *dest_addr, socklen_t addrlen) override;
+  int close(int fd) override;
+
+  /* Clock */
+  time_point now() override;
+  void sleep_for(std::chrono::microseconds duration) override;
+
+  /* FileSystem */
+  FILE *fopen(const char *pathname, const char *mode) override;
+  int fclose(FILE *) override;
+  int feof(FILE *) override;
+  int ferror(FILE *) override;
+  char *fgets(char s[], int size, FILE *stream) override;
+
+private:
+  std::mutex mutex;
+  int nextFd{100};
+  std::set<int> fds;
+  std::map<FILE *, std::unique_ptr<std::string>> files;
+};
@@ -0,0 +1,412 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* parprouted-sim: discrete-event simulation of a proxy ARP bridge.
+ *
+ * N interfaces and M hosts are modelled on a virtual clock. Hosts send ARP
+ * requests for random peers and answer requests the daemon sends on their
+ * segment. Some hosts roam between interfaces, some flap between alive
+ * and dead and some never answer. The daemon code (arp_handle_frame,
+ * parseproc, processarp, refresharp and the request queue) runs unchanged
+ * against SimKernel, whose neighbour table ages entries of hosts that left
+ * a segment the way the kernel would (FAILED, then garbage collected). */
+
+#include "parprouted.h"
+
+#include "sim-kernel.h"
+
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+/* kernel neighbour state machine, roughly: delay probe + 3 unicast probes */
+constexpr double NEIGH_FAIL_TIME = 8.0;
+constexpr double NEIGH_GC_TIME = 30.0;
+/* one-way latency of a host answering on its segment */
+constexpr double HOST_LATENCY = 0.001;
+
+struct Options {
+  int ifaces = 2;
+  int hosts = 1000;
+  double duration = 600;
+  double roaming = 0.05;
+  double flapping = 0.02;
+  double dead = 0.01;
+  double request_interval = 30;
+  double move_interval = 120;
+  double flap_interval = 60;
+  unsigned seed = 1;
+  bool trace = false;
+};
+
+enum class Kind { Stable, Roaming, Flapping, Dead };
+
+struct Host {
+  uint32_t ip; /* host byte order */
+  unsigned char hwaddr[ETH_ALEN];
+  size_t iface;
+  Kind kind;
+  bool alive;
+  double moved_at;
+  bool converging;
+};
+
+struct Event {
+  double t;
+  unsigned long seq;
+  std::function<void()> fn;
+  bool operator>(const Event &other) const {
+    return t != other.t ? t > other.t : seq > other.seq;
+  }
+};
+
+class Simulation {
+public:
+  explicit Simulation(const Options &options) : opt(options), rng(options.seed) {}
+  void run();
+
+private:
+  const Options &opt;
+  SimKernel kernel;
+  std::mt19937 rng;
+  std::vector<Host> hosts;
+  std::vector<sockaddr_ll> ifs;
+  std::vector<std::string> names;
+  std::priority_queue<Event, std::vector<Event>, std::greater<>> events;
+  unsigned long seq{};
+  double now{};
+
+  unsigned long host_requests{};
+  unsigned long moves{};
+  unsigned long converged{};
+  unsigned long polls{};
+  double convergence_total{};
+  double convergence_max{};
+
+  void at(double t, std::function<void()> fn) { events.push(Event{t, seq++, std::move(fn)}); }
+  double exp(double mean) { return std::exponential_distribution<double>(1.0 / mean)(rng); }
+  Host *findHost(const uint8_t (&ip)[4]);
+
+  void deliver(size_t iface, ether_arp_frame frame);
+  void onSend(const SimKernel::Iface &iface, const ether_arp_frame &frame);
+  void hostRequest(size_t idx);
+  void hostMove(size_t idx);
+  void hostFlap(size_t idx);
+  void neighbourFail(uint32_t ip, size_t iface);
+  void tick();
+  void garpFlush();
+  void checkConvergence();
+  void report(double cpu_secs);
+};
+
+Host *Simulation::findHost(const uint8_t (&ip)[4]) {
+  uint32_t addr;
+  memcpy(&addr, ip, sizeof(addr));
+  addr = ntohl(addr);
+  /* hosts are numbered consecutively from 10.0.0.1 */
+  size_t idx = addr - 0x0a000001U;
+  return idx < hosts.size() ? &hosts[idx] : nullptr;
+}
+
+void Simulation::deliver(size_t iface, ether_arp_frame frame) {
+  kernel.vtime = now;
+  arp_handle_frame(&frame, &ifs[iface], names[iface].c_str(), kernel, kernel, kernel);
+}
+
+/* A host on the segment answers the daemon's who-has for its own address */
+void Simulation::onSend(const SimKernel::Iface &iface, const ether_arp_frame &frame) {
+  if (frame.arp.arp_op != htons(ARPOP_REQUEST) ||
+      !memcmp(frame.arp.arp_spa, frame.arp.arp_tpa, sizeof(frame.arp.arp_spa))) {
+    return;
+  }
+  Host *host = findHost(frame.arp.arp_tpa);
+  size_t idx = static_cast<size_t>(iface.ifindex - 1);
+  if (host == nullptr || !host->alive || host->iface != idx) {
+    return;
+  }
+
+  ether_arp_frame reply = frame;
+  memcpy(reply.ether_hdr.ether_dhost, frame.arp.arp_sha, ETH_ALEN);
+  memcpy(reply.ether_hdr.ether_shost, host->hwaddr, ETH_ALEN);
+  memcpy(reply.arp.arp_tha, frame.arp.arp_sha, ETH_ALEN);
+  memcpy(reply.arp.arp_tpa, frame.arp.arp_spa, sizeof(reply.arp.arp_tpa));
+  memcpy(reply.arp.arp_sha, host->hwaddr, ETH_ALEN);
+  memcpy(reply.arp.arp_spa, frame.arp.arp_tpa, sizeof(reply.arp.arp_spa));
+  reply.arp.arp_op = htons(ARPOP_REPLY);
+
+  at(now + HOST_LATENCY, [this, idx, reply] { deliver(idx, reply); });
+}
+
+void Simulation::hostRequest(size_t idx) {
+  Host &host = hosts[idx];
+  if (host.alive) {
+    size_t peer = std::uniform_int_distribution<size_t>(0, hosts.size() - 1)(rng);
+    if (peer != idx) {
+      ether_arp_frame frame{};
+      uint32_t spa = htonl(host.ip), tpa = htonl(hosts[peer].ip);
+      memset(frame.ether_hdr.ether_dhost, 0xff, ETH_ALEN);
+      memcpy(frame.ether_hdr.ether_shost, host.hwaddr, ETH_ALEN);
+      frame.ether_hdr.ether_type = htons(ETHERTYPE_ARP);
+      frame.arp.arp_hrd = htons(ARPHRD_ETHER);
+      frame.arp.arp_pro = htons(ETH_P_IP);
+      frame.arp.arp_hln = ETH_ALEN;
+      frame.arp.arp_pln = 4;
+      frame.arp.arp_op = htons(ARPOP_REQUEST);
+      memcpy(frame.arp.arp_sha, host.hwaddr, ETH_ALEN);
+      memcpy(frame.arp.arp_spa, &spa, sizeof(spa));
+      memcpy(frame.arp.arp_tpa, &tpa, sizeof(tpa));
+      host_requests++;
+      deliver(host.iface, frame);
+    }
+  }
+  at(now + exp(opt.request_interval), [this, idx] { hostRequest(idx); });
+}
+
+void Simulation::hostMove(size_t idx) {
+  Host &host = hosts[idx];
+  size_t old_iface = host.iface;
+
+  host.iface = (host.iface + 1 + std::uniform_int_distribution<size_t>(
+                                     0, static_cast<size_t>(opt.ifaces) - 2)(rng)) %
+               static_cast<size_t>(opt.ifaces);
+  host.moved_at = now;
+  host.converging = true;
+  moves++;
+
+  at(now + NEIGH_FAIL_TIME, [this, ip = host.ip, old_iface] { neighbourFail(ip, old_iface); });
+  at(now + exp(opt.move_interval), [this, idx] { hostMove(idx); });
+}
+
+void Simulation::hostFlap(size_t idx) {
+  Host &host = hosts[idx];
+  host.alive = !host.alive;
+  if (!host.alive) {
+    at(now + NEIGH_FAIL_TIME,
+       [this, ip = host.ip, iface = host.iface] { neighbourFail(ip, iface); });
+  }
+  at(now + exp(opt.flap_interval), [this, idx] { hostFlap(idx); });
+}
+
+/* Unicast probes of the kernel went unanswered: entry becomes FAILED */
+void Simulation::neighbourFail(uint32_t ip, size_t iface) {
+  const Host &host = hosts[ip - 0x0a000001U];
+  if (host.alive && host.iface == iface) {
+    return;
+  }
+  auto it = kernel.neighbours.find(SimKernel::Key{ip, names[iface]});
+  if (it == kernel.neighbours.end()) {
+    return;
+  }
+  it->second.flags = 0;
+  memset(it->second.hwaddr, 0, ETH_ALEN);
+  at(now + NEIGH_GC_TIME, [this, key = it->first] {
+    auto gc = kernel.neighbours.find(key);
+    if (gc != kernel.neighbours.end() && gc->second.flags == 0) {
+      kernel.neighbours.erase(gc);
+    }
+  });
+}
+
+void Simulation::tick() {
+  kernel.vtime = now;
+  pthread_mutex_lock(&arptab_mutex);
+  parseproc(kernel, kernel, kernel);
+  processarp(kernel, kernel, false);
+  int interval = poll_next(proc_poll);
+  pthread_mutex_unlock(&arptab_mutex);
+  polls++;
+  if (!option_arpperm) {
+    pthread_mutex_lock(&arptab_mutex);
+    refresharp(arptab, kernel, kernel);
+    pthread_mutex_unlock(&arptab_mutex);
+  }
+  checkConvergence();
+  log_flush();
+  at(now + interval / 1e3, [this] { tick(); });
+}
+
+/* garp_thread() of the daemon */
+void Simulation::garpFlush() {
+  kernel.vtime = now;
+  garp_flush(kernel, kernel);
+  at(now + GARP_WINDOW / 1e6, [this] { garpFlush(); });
+}
+
+/* A move has converged once the only route for the host is via its new interface */
+void Simulation::checkConvergence() {
+  for (auto &host : hosts) {
+    if (!host.converging) {
+      continue;
+    }
+    bool ok = kernel.routes.count(SimKernel::Key{host.ip, names[host.iface]}) > 0;
+    for (size_t i = 0; ok && i < names.size(); i++) {
+      ok = i == host.iface || !kernel.routes.count(SimKernel::Key{host.ip, names[i]});
+    }
+    if (ok) {
+      double t = now - host.moved_at;
+      host.converging = false;
+      converged++;
+      convergence_total += t;
+      convergence_max = std::max(convergence_max, t);
+    }
+  }
+}
+
+void Simulation::run() {
+  for (int i = 0; i < opt.ifaces; i++) {
+    names.push_back("sim" + std::to_string(i));
+  }
+  for (const auto &name : names) {
+    kernel.addIface(name);
+    iface_add(name.c_str());
+  }
+  for (const auto &iface : kernel.ifaces) {
+    ifs.push_back(kernel.linkAddr(iface));
+  }
+  kernel.trace = opt.trace ? stdout : nullptr;
+  kernel.onSend = [this](const SimKernel::Iface &iface, const ether_arp_frame &frame) {
+    onSend(iface, frame);
+  };
+
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (int i = 0; i < opt.hosts; i++) {
+    double r = uniform(rng);
+    Kind kind = r < opt.dead                            ? Kind::Dead
+                : r < opt.dead + opt.flapping           ? Kind::Flapping
+                : r < opt.dead + opt.flapping + opt.roaming ? Kind::Roaming
+                                                        : Kind::Stable;
+    Host host{0x0a000001U + static_cast<uint32_t>(i),
+              {0x00, 0x16, 0x3e, static_cast<unsigned char>(i >> 16),
+               static_cast<unsigned char>(i >> 8), static_cast<unsigned char>(i)},
+              static_cast<size_t>(i % opt.ifaces),
+              kind,
+              kind != Kind::Dead,
+              0,
+              false};
+    hosts.push_back(host);
+
+    size_t idx = hosts.size() - 1;
+    at(exp(opt.request_interval), [this, idx] { hostRequest(idx); });
+    if (kind == Kind::Roaming && opt.ifaces > 1) {
+      at(exp(opt.move_interval), [this, idx] { hostMove(idx); });
+    } else if (kind == Kind::Flapping) {
+      at(exp(opt.flap_interval), [this, idx] { hostFlap(idx); });
+    }
+  }
+  at(0, [this] { tick(); });
+  at(0, [this] { garpFlush(); });
+
+  struct timespec cpu_start, cpu_end;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+
+  while (!events.empty() && events.top().t <= opt.duration) {
+    Event ev = events.top();
+    events.pop();
+    now = ev.t;
+    ev.fn();
+    /* keep the debug output next to the trace of the event */
+    if (debug) {
+      log_flush();
+    }
+  }
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+  report(static_cast<double>(cpu_end.tv_sec - cpu_start.tv_sec) +
+         static_cast<double>(cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9);
+}
+
+void Simulation::report(double cpu_secs) {
+  printf("interfaces:             %d\n", opt.ifaces);
+  printf("hosts:                  %d\n", opt.hosts);
+  printf("simulated time:         %.0f s\n", opt.duration);
+  printf("cpu per simulated sec:  %.3f ms\n", cpu_secs * 1e3 / opt.duration);
+  printf("host requests:          %lu\n", host_requests);
+  printf("daemon sends:           %lu\n", kernel.counters.sends);
+  printf("amplification:          %.2f\n",
+         host_requests ? static_cast<double>(kernel.counters.sends) /
+                             static_cast<double>(host_requests)
+                       : 0.0);
+  printf("route adds/dels/errors: %lu/%lu/%lu\n", kernel.counters.route_adds,
+         kernel.counters.route_dels, kernel.counters.route_failures);
+  printf("routes installed:       %zu\n", kernel.routes.size());
+  printf("arptab entries/evicted: %zu/%lu\n", arptab_len, stats.arptab_evictions.load());
+  printf("table polls:            %lu\n", polls);
+  printf("moves converged:        %lu/%lu\n", converged, moves);
+  printf("convergence avg/max:    %.3f/%.3f s\n",
+         converged ? convergence_total / static_cast<double>(converged) : 0.0, convergence_max);
+}
+
+void usage() {
+  printf("Usage: parprouted-sim [-d] [-v] [-i interfaces] [-n hosts] [-t seconds]\n"
+         "                      [-r roaming] [-f flapping] [-x dead] [-s seed]\n"
+         "roaming, flapping and dead are fractions of the hosts (0..1)\n");
+  exit(1);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (!strcmp(arg, "-d")) {
+      debug = true;
+      log_level = LOG_DEBUG;
+    } else if (!strcmp(arg, "-v")) {
+      opt.trace = true;
+    } else if (val == nullptr) {
+      usage();
+    } else if (!strcmp(arg, "-i")) {
+      opt.ifaces = atoi(val), i++;
+    } else if (!strcmp(arg, "-n")) {
+      opt.hosts = atoi(val), i++;
+    } else if (!strcmp(arg, "-t")) {
+      opt.duration = atof(val), i++;
+    } else if (!strcmp(arg, "-r")) {
+      opt.roaming = atof(val), i++;
+    } else if (!strcmp(arg, "-f")) {
+      opt.flapping = atof(val), i++;
+    } else if (!strcmp(arg, "-x")) {
+      opt.dead = atof(val), i++;
+    } else if (!strcmp(arg, "-s")) {
+      opt.seed = static_cast<unsigned>(atoi(val)), i++;
+    } else {
+      usage();
+    }
+  }
+
+  if (opt.ifaces < 1 || opt.ifaces > 0xffff || opt.hosts < 1 || opt.hosts > 0xffffff ||
+      opt.duration <= 0) {
+    usage();
+  }
+
+  openlog("parprouted-sim", LOG_PERROR, LOG_USER);
+  pthread_mutex_init(&arptab_mutex, NULL);
+  pthread_mutex_init(&req_queue_mutex, NULL);
+
+  Simulation sim(opt);
+  sim.run();
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "sweep.h"
+
+#include "parprouted.h"
+
+#include <catch2/catch.hpp>
+
+namespace {
+
+constexpr const char *TAGS = "sweep";
+
+std::vector<std::string> sweep(const char *ifname, const Scope &scope, const char *addr,
+                               const char *mask) {
+  struct in_addr a {}, m {};
+  std::vector<struct in_addr> targets;
+  std::vector<std::string> out;
+  char buf[INET_ADDRSTRLEN];
+
+  inet_pton(AF_INET, addr, &a);
+  inet_pton(AF_INET, mask, &m);
+  sweep_targets(ifname, scope, a, m, targets);
+  for (const auto &target : targets) {
+    out.emplace_back(inet_ntop(AF_INET, &target, buf, sizeof(buf)));
+  }
+  return out;
+}
+
+TEST_CASE("sweep-test", TAGS) {
+  scope_rules.clear();
+
+  GIVEN("an interface without scope") {
+    Scope scope;
+    THEN("the subnet of its address is swept, but for itself") {
+      auto targets = sweep("eth0", scope, "10.0.0.2", "255.255.255.252");
+      CHECK(targets == std::vector<std::string>{"10.0.0.1"});
+      CHECK(sweep("eth0", scope, "10.0.0.1", "255.255.255.0").size() == 253);
+    }
+    THEN("an interface without address is not swept") {
+      CHECK(sweep("eth0", scope, "0.0.0.0", "0.0.0.0").empty());
+    }
+    THEN("too large subnets are not swept") {
+      CHECK(sweep("eth0", scope, "10.0.0.1", "255.0.0.0").empty());
+    }
+  }
+
+  GIVEN("an interface with allowed and denied prefixes") {
+    Scope scope;
+    scope_rule rule;
+    for (const char *spec : {"wlan*:192.168.1.0/30", "wlan0:192.168.1.0/31",
+                             "wlan0:!192.168.1.2/32", "eth0:10.0.0.0/8"}) {
+      REQUIRE(scope_parse(spec, rule));
+      scope_rules.push_back(rule);
+    }
+    scope_build("wlan0", scope);
+    THEN("the allowed prefixes are swept once, without denied addresses") {
+      auto targets = sweep("wlan0", scope, "172.16.0.1", "255.255.0.0");
+      CHECK(targets == std::vector<std::string>{"192.168.1.0", "192.168.1.1"});
+    }
+  }
+
+  scope_rules.clear();
+}
+
+} // namespace
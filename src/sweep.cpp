@@ -0,0 +1,182 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/* Startup sweep.
+ *
+ * After a restart arptab is empty, and hosts are only learned as their
+ * peers look for them. The sweep sends ARP requests to every address of
+ * the subnets of the interfaces before main_thread() starts its polls.
+ * The replies take the usual way: the receive threads put them into the
+ * kernel ARP table, and the sweep ends with reading that table and adding
+ * the routes of all hosts that answered. */
+
+#include "sweep.h"
+
+#include "actor.h"
+#include "parprouted.h"
+
+#include <fnmatch.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+namespace {
+
+/* Address and netmask of ifname, zero if it has none */
+void sweep_ifaddr(const char *ifname, struct in_addr &addr, struct in_addr &mask,
+                  Context &context) {
+  struct ifreq ifr = {};
+  int sock;
+
+  addr.s_addr = mask.s_addr = 0;
+  if ((sock = context.socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    return;
+  }
+  snprintf(ifr.ifr_name, IFNAMSIZ, "%s", ifname);
+  if (context.ioctl(sock, SIOCGIFADDR, &ifr) == 0) {
+    addr = reinterpret_cast<struct sockaddr_in *>(&ifr.ifr_addr)->sin_addr;
+    if (context.ioctl(sock, SIOCGIFNETMASK, &ifr) == 0) {
+      mask = reinterpret_cast<struct sockaddr_in *>(&ifr.ifr_netmask)->sin_addr;
+    }
+  }
+  context.close(sock);
+}
+
+} // namespace
+
+void sweep_targets(const char *ifname, const Scope &scope, struct in_addr addr,
+                   struct in_addr mask, std::vector<struct in_addr> &targets) {
+  std::vector<std::pair<uint32_t, int>> nets; /* host byte order, length */
+  size_t first = targets.size();
+
+  for (const auto &rule : scope_rules) {
+    if (rule.allow && fnmatch(rule.pattern.c_str(), ifname, 0) == 0) {
+      nets.emplace_back(ntohl(rule.prefix.s_addr), rule.len);
+    }
+  }
+  if (nets.empty() && addr.s_addr != 0 && mask.s_addr != 0) {
+    nets.emplace_back(ntohl(addr.s_addr), __builtin_popcount(mask.s_addr));
+  }
+
+  for (auto [net, len] : nets) {
+    if (len < SWEEP_MIN_LEN) {
+      LOG(LOG_WARNING, "Sweep: /%d on %s is too large, skipped", len, ifname);
+      continue;
+    }
+    uint32_t size = 1U << (32 - len);
+    uint32_t base = net & ~(size - 1);
+    /* no network and broadcast address, except in /31 and /32 */
+    uint32_t lo = size > 2 ? 1 : 0;
+    uint32_t hi = size > 2 ? size - 1 : size;
+    for (uint32_t host = lo; host < hi; host++) {
+      struct in_addr target = {htonl(base + host)};
+      if (target.s_addr != addr.s_addr && scope.contains(target)) {
+        targets.push_back(target);
+      }
+    }
+  }
+
+  /* prefixes may overlap */
+  auto begin = targets.begin() + static_cast<std::ptrdiff_t>(first);
+  std::sort(begin, targets.end(), [](const in_addr &a, const in_addr &b) {
+    return ntohl(a.s_addr) < ntohl(b.s_addr);
+  });
+  auto same = [](const in_addr &a, const in_addr &b) { return a.s_addr == b.s_addr; };
+  targets.erase(std::unique(begin, targets.end(), same), targets.end());
+}
+
+void sweep_run(FileSystem &fileSystem, Context &context, Clock &clock) {
+  std::vector<std::pair<std::string, std::vector<struct in_addr>>> plan;
+  size_t total = 0;
+  size_t sent = 0;
+
+  if (option_sweep_rate <= 0 || arptab != NULL) {
+    return;
+  }
+
+  auto deadline = clock.now() + std::chrono::seconds(option_sweep_time);
+  while (!link_synced && clock.now() < deadline) {
+    clock.sleep_for(std::chrono::microseconds(SWEEP_TICK));
+  }
+  clock.sleep_for(std::chrono::microseconds(SWEEP_SETTLE));
+
+  pthread_rwlock_rdlock(&ifaces_lock);
+  for (const auto *it : ifaces) {
+    struct in_addr addr, mask;
+    sweep_ifaddr(it->name, addr, mask, context);
+    plan.emplace_back(it->name, std::vector<struct in_addr>{});
+    sweep_targets(it->name, it->scope, addr, mask, plan.back().second);
+    total += plan.back().second.size();
+  }
+  pthread_rwlock_unlock(&ifaces_lock);
+
+  syslog(LOG_INFO, "Sweeping %zu addresses on %zu interfaces.", total, plan.size());
+
+  /* a batch per interface and tick, the interfaces in turn */
+  std::vector<size_t> next(plan.size());
+  std::vector<struct in_addr> batch;
+  auto last = clock.now();
+  double budget = 0;
+  size_t turn = 0;
+
+  while (sent < total && clock.now() < deadline) {
+    clock.sleep_for(std::chrono::microseconds(SWEEP_TICK));
+    auto now = clock.now();
+    budget += option_sweep_rate * std::chrono::duration<double>(now - last).count();
+    last = now;
+
+    for (size_t idle = 0; budget >= 1 && idle < plan.size(); turn = (turn + 1) % plan.size()) {
+      auto &[ifname, targets] = plan[turn];
+      size_t n = std::min(targets.size() - next[turn],
+                          static_cast<size_t>(budget) / plan.size() + 1);
+      if (n == 0) {
+        idle++;
+        continue;
+      }
+      idle = 0;
+      batch.assign(targets.begin() + static_cast<std::ptrdiff_t>(next[turn]),
+                   targets.begin() + static_cast<std::ptrdiff_t>(next[turn] + n));
+      arp_req_batch(ifname.c_str(), batch, false, context);
+      next[turn] += n;
+      sent += n;
+      budget -= static_cast<double>(n);
+    }
+
+    if (option_actor) {
+      actor_drain(fileSystem, context, clock);
+    }
+  }
+
+  /* the last replies */
+  for (auto until = std::min(deadline, clock.now() + std::chrono::seconds(SWEEP_WAIT));
+       clock.now() < until;) {
+    clock.sleep_for(std::chrono::microseconds(SWEEP_TICK));
+    if (option_actor) {
+      actor_drain(fileSystem, context, clock);
+    }
+  }
+
+  pthread_mutex_lock(&arptab_mutex);
+  parseproc(fileSystem, context, clock);
+  processarp(context, clock, false);
+  syslog(LOG_INFO, "Sweep done: %zu of %zu addresses probed, %zu hosts known.", sent, total,
+         arptab_len);
+  pthread_mutex_unlock(&arptab_mutex);
+}
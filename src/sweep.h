@@ -0,0 +1,46 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#pragma once
+
+#include "clock.h"
+#include "context.h"
+#include "fs.h"
+#include "scope.h"
+
+#include <netinet/in.h>
+
+#include <vector>
+
+#define SWEEP_TICK 10000     /* us between batches of probes */
+#define SWEEP_SETTLE 100000  /* us for the receive threads to bind their sockets */
+#define SWEEP_WAIT 1         /* seconds for the last replies */
+#define SWEEP_MIN_LEN 16     /* shorter prefixes are too large to be swept */
+
+/* The addresses to probe on ifname: the prefixes its scope allows or, if
+ * there are none, the subnet of its own address addr/mask. Addresses the
+ * scope denies and the interface's own address are left out. The caller
+ * holds ifaces_lock. */
+extern void sweep_targets(const char *ifname, const Scope &scope, struct in_addr addr,
+                          struct in_addr mask, std::vector<struct in_addr> &targets);
+
+/* Startup sweep: probe the subnets of all attached interfaces at
+ * option_sweep_rate for at most option_sweep_time, then read the kernel
+ * ARP table the responders went to and add their routes. Does nothing
+ * when arptab was handed over. */
+extern void sweep_run(FileSystem &, Context &, Clock &);
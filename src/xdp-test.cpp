@@ -0,0 +1,116 @@
+#include "xdp.h"
+
+#include <catch2/catch.hpp>
+
+#include <linux/bpf.h>
+#include <net/if.h>
+#include <sys/syscall.h>
+
+namespace {
+
+constexpr const char *TAGS = "xdp";
+
+/* Run the program on a frame as if it came in, BPF_PROG_TEST_RUN */
+int test_run(int prog, ether_arp_frame &frame) {
+  union bpf_attr attr {};
+  ether_arp_frame out{};
+  attr.test.prog_fd = static_cast<uint32_t>(prog);
+  attr.test.data_in = reinterpret_cast<uintptr_t>(&frame);
+  attr.test.data_size_in = sizeof(frame);
+  attr.test.data_out = reinterpret_cast<uintptr_t>(&out);
+  attr.test.data_size_out = sizeof(out);
+  if (syscall(__NR_bpf, BPF_PROG_TEST_RUN, &attr, sizeof(attr)) < 0) {
+    return -1;
+  }
+  frame = out;
+  return static_cast<int>(attr.test.retval);
+}
+
+ether_arp_frame request(const char *sender, const char *target) {
+  ether_arp_frame frame{};
+  memset(frame.ether_hdr.ether_dhost, 0xff, ETH_ALEN);
+  memcpy(frame.ether_hdr.ether_shost, "\x02\x00\x00\x00\x00\x01", ETH_ALEN);
+  frame.ether_hdr.ether_type = htons(ETHERTYPE_ARP);
+  frame.arp.arp_hrd = htons(ARPHRD_ETHER);
+  frame.arp.arp_pro = htons(ETH_P_IP);
+  frame.arp.arp_hln = ETH_ALEN;
+  frame.arp.arp_pln = 4;
+  frame.arp.arp_op = htons(ARPOP_REQUEST);
+  memcpy(frame.arp.arp_sha, frame.ether_hdr.ether_shost, ETH_ALEN);
+  inet_pton(AF_INET, sender, frame.arp.arp_spa);
+  inet_pton(AF_INET, target, frame.arp.arp_tpa);
+  return frame;
+}
+
+TEST_CASE("xdp-test", TAGS) {
+  if (!xdp_open()) {
+    WARN("BPF is not available here, skipped");
+    return;
+  }
+
+  const unsigned char hwaddr[ETH_ALEN] = {0xe2, 0xb4, 0x6e, 0xfe, 0xfa, 0xaa};
+  /* a host behind lo, requests come in on a made up interface */
+  arptab_entry host{};
+  inet_pton(AF_INET, "10.0.0.9", &host.ipaddr_ia);
+  strcpy(host.ifname, "lo");
+  host.route_added = true;
+  xdp_sync(&host);
+
+  int prog = xdp_load(1000, 0, hwaddr);
+  REQUIRE(prog >= 0);
+
+  GIVEN("a request for the host") {
+    auto frame = request("10.0.0.1", "10.0.0.9");
+    auto replies = xdp_replies();
+
+    THEN("it is answered in place with our address") {
+      REQUIRE(test_run(prog, frame) == XDP_TX);
+      CHECK(frame.arp.arp_op == htons(ARPOP_REPLY));
+      CHECK(memcmp(frame.ether_hdr.ether_dhost, "\x02\x00\x00\x00\x00\x01", ETH_ALEN) == 0);
+      CHECK(memcmp(frame.ether_hdr.ether_shost, hwaddr, ETH_ALEN) == 0);
+      CHECK(memcmp(frame.arp.arp_sha, hwaddr, ETH_ALEN) == 0);
+      CHECK(memcmp(frame.arp.arp_tha, "\x02\x00\x00\x00\x00\x01", ETH_ALEN) == 0);
+      CHECK(memcmp(frame.arp.arp_spa, "\x0a\x00\x00\x09", 4) == 0);
+      CHECK(memcmp(frame.arp.arp_tpa, "\x0a\x00\x00\x01", 4) == 0);
+      CHECK(xdp_replies() == replies + 1);
+    }
+    WHEN("it comes in on the interface of the host") {
+      int lo = xdp_load(static_cast<int>(if_nametoindex("lo")), 0, hwaddr);
+      THEN("it is passed up") { CHECK(test_run(lo, frame) == XDP_PASS); }
+      close(lo);
+    }
+    WHEN("it comes in in another group") {
+      int other = xdp_load(1000, 1, hwaddr);
+      THEN("it is passed up") { CHECK(test_run(other, frame) == XDP_PASS); }
+      close(other);
+    }
+    WHEN("the host is gone") {
+      host.incomplete = true;
+      xdp_sync(&host);
+      THEN("it is passed up") {
+        CHECK(test_run(prog, frame) == XDP_PASS);
+        CHECK(frame.arp.arp_op == htons(ARPOP_REQUEST));
+        CHECK(xdp_replies() == replies);
+      }
+    }
+  }
+
+  GIVEN("other frames") {
+    THEN("they are passed up") {
+      auto unknown = request("10.0.0.1", "10.0.0.8");
+      CHECK(test_run(prog, unknown) == XDP_PASS);
+      auto probe = request("0.0.0.0", "10.0.0.9");
+      CHECK(test_run(prog, probe) == XDP_PASS);
+      auto announce = request("10.0.0.9", "10.0.0.9");
+      CHECK(test_run(prog, announce) == XDP_PASS);
+      auto reply = request("10.0.0.1", "10.0.0.9");
+      reply.arp.arp_op = htons(ARPOP_REPLY);
+      CHECK(test_run(prog, reply) == XDP_PASS);
+    }
+  }
+
+  close(prog);
+  xdp_sync(nullptr);
+}
+
+} // namespace
@@ -0,0 +1,445 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+/* In-kernel ARP responder (-x).
+ *
+ * A request for a host that is already known behind another interface is
+ * the common case, and its answer is fixed: our own address, as the
+ * kernel's proxy ARP would give it once the request came up the stack. An
+ * XDP program on each proxied interface answers it with XDP_TX right in
+ * the driver, so the frame reaches neither the stack nor our sockets; any
+ * other frame is passed up to arp_thread() as before.
+ *
+ * The program is a handful of instructions, assembled here the way
+ * join_fanout() writes its classic BPF filter, so the daemon needs neither
+ * a BPF compiler nor libbpf. The hosts it may answer for are in a hash map
+ * of (address, group) -> ifindex that main_thread() syncs from arptab after
+ * every poll. Maps and program links are handed over like the sockets, so
+ * the responders keep answering across a handover. */
+
+#include "xdp.h"
+
+#include "handover.h"
+
+#include <linux/bpf.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+bool option_xdp = false;
+
+namespace {
+
+/* Offsets in the frame */
+#define AT(member) static_cast<int16_t>(offsetof(ether_arp_frame, member))
+
+/* Registers of the program */
+enum { R0, R1, R2, R3, R4, R5, R6, R7, R8, R9, R10 };
+
+/* The program under assembly; jumps to the XDP_PASS exit are patched at the end */
+struct program {
+  std::vector<bpf_insn> insns;
+  std::vector<size_t> to_pass;
+
+  void add(int code, int dst, int src, int16_t off, int32_t imm) {
+    bpf_insn insn{};
+    insn.code = static_cast<uint8_t>(code);
+    insn.dst_reg = dst & 0xf;
+    insn.src_reg = src & 0xf;
+    insn.off = off;
+    insn.imm = imm;
+    insns.push_back(insn);
+  }
+  void ldx(int size, int dst, int src, int16_t off) {
+    add(BPF_LDX | size | BPF_MEM, dst, src, off, 0);
+  }
+  void stx(int size, int dst, int16_t off, int src) {
+    add(BPF_STX | size | BPF_MEM, dst, src, off, 0);
+  }
+  void st(int size, int dst, int16_t off, int32_t imm) {
+    add(BPF_ST | size | BPF_MEM, dst, 0, off, imm);
+  }
+  void mov(int dst, int src) { add(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0); }
+  void movi(int dst, int32_t imm) { add(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm); }
+  void addi(int dst, int32_t imm) { add(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm); }
+  /* 32 bit compare with an immediate, 64 bit with a register */
+  void pass_if(int op, int dst, int32_t imm) {
+    to_pass.push_back(insns.size());
+    add(BPF_JMP32 | op | BPF_K, dst, 0, 0, imm);
+  }
+  void pass_if_null(int dst) {
+    to_pass.push_back(insns.size());
+    add(BPF_JMP | BPF_JEQ | BPF_K, dst, 0, 0, 0);
+  }
+  void pass_if_reg(int op, int dst, int src) {
+    to_pass.push_back(insns.size());
+    add(BPF_JMP | op | BPF_X, dst, src, 0, 0);
+  }
+  void ld_map(int dst, int fd) {
+    add(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+    add(0, 0, 0, 0, 0);
+  }
+  void call(int32_t helper) { add(BPF_JMP | BPF_CALL, 0, 0, 0, helper); }
+  void exit(int32_t ret) {
+    movi(R0, ret);
+    add(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+  }
+  void exit_pass() {
+    for (size_t pos : to_pass) {
+      insns[pos].off = static_cast<int16_t>(insns.size() - pos - 1);
+    }
+    exit(XDP_PASS);
+  }
+};
+
+int hosts_map = -1;   /* (address, group) -> ifindex of the known hosts */
+int replies_map = -1; /* one counter, requests answered */
+
+/* what the host map holds, by key_id() */
+std::unordered_map<uint64_t, uint32_t> synced;
+
+struct xdp_link {
+  int fd;
+  int group;
+};
+
+/* Responders by interface name */
+std::mutex links_mutex;
+std::map<std::string, xdp_link> links;
+
+long sys_bpf(int cmd, union bpf_attr &attr) {
+  return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+uint64_t ptr(const void *p) { return reinterpret_cast<uintptr_t>(p); }
+
+uint64_t key_id(const xdp_host_key &key) {
+  return static_cast<uint64_t>(key.ipaddr) << 32 | key.group;
+}
+
+int32_t word(const unsigned char *bytes) {
+  int32_t w;
+  memcpy(&w, bytes, sizeof(w));
+  return w;
+}
+
+int32_t half(const unsigned char *bytes) {
+  uint16_t h;
+  memcpy(&h, bytes, sizeof(h));
+  return h;
+}
+
+int map_create(bpf_map_type type, uint32_t key_size, uint32_t value_size, uint32_t entries,
+               const char *name) {
+  union bpf_attr attr {};
+  attr.map_type = type;
+  attr.key_size = key_size;
+  attr.value_size = value_size;
+  attr.max_entries = entries;
+  snprintf(attr.map_name, sizeof(attr.map_name), "%s", name);
+  return static_cast<int>(sys_bpf(BPF_MAP_CREATE, attr));
+}
+
+int map_op(int cmd, int map, const void *key, const void *value, uint64_t flags = 0) {
+  union bpf_attr attr {};
+  attr.map_fd = static_cast<uint32_t>(map);
+  attr.key = ptr(key);
+  attr.value = ptr(value);
+  attr.flags = flags;
+  return static_cast<int>(sys_bpf(cmd, attr));
+}
+
+/* An inherited map, or a new one */
+int map_open(const char *name, bpf_map_type type, uint32_t key_size, uint32_t value_size,
+             uint32_t entries) {
+  int map = handover_take(HANDOVER_XDP, name);
+  if (map < 0 && (map = map_create(type, key_size, value_size, entries, name)) < 0) {
+    syslog(LOG_ERR, "error: XDP map %s: %s", name, strerror(errno));
+    return -1;
+  }
+  handover_register(HANDOVER_XDP, name, map);
+  return map;
+}
+
+} // namespace
+
+bool xdp_open() {
+  if (hosts_map >= 0) {
+    return true;
+  }
+  if ((hosts_map = map_open("hosts", BPF_MAP_TYPE_HASH, sizeof(xdp_host_key), sizeof(uint32_t),
+                            XDP_MAX_HOSTS)) < 0 ||
+      (replies_map = map_open("replies", BPF_MAP_TYPE_ARRAY, sizeof(uint32_t),
+                              sizeof(uint64_t), 1)) < 0) {
+    return false;
+  }
+
+  /* an inherited map holds the hosts of the previous instance */
+  xdp_host_key key, next;
+  const void *prev = NULL;
+  while (map_op(BPF_MAP_GET_NEXT_KEY, hosts_map, prev, &next) == 0) {
+    uint32_t ifindex;
+    if (map_op(BPF_MAP_LOOKUP_ELEM, hosts_map, &next, &ifindex) == 0) {
+      synced[key_id(next)] = ifindex;
+    }
+    key = next;
+    prev = &key;
+  }
+  return true;
+}
+
+int xdp_load(int ifindex, int group, const unsigned char *hwaddr) {
+  /* hrd, pro, hln, pln and op of a request, as on the wire */
+  static const unsigned char arp_request[8] = {0, ARPHRD_ETHER, 8, 0, ETH_ALEN, 4,
+                                               0, ARPOP_REQUEST};
+  program p;
+
+  /* r6 = data, the frame must hold an ARP packet */
+  p.ldx(BPF_W, R6, R1, offsetof(struct xdp_md, data));
+  p.ldx(BPF_W, R3, R1, offsetof(struct xdp_md, data_end));
+  p.mov(R4, R6);
+  p.addi(R4, sizeof(ether_arp_frame));
+  p.pass_if_reg(BPF_JGT, R4, R3);
+
+  /* an Ethernet/IPv4 request, not a probe or an announcement */
+  p.ldx(BPF_H, R4, R6, AT(ether_hdr.ether_type));
+  p.pass_if(BPF_JNE, R4, htons(ETHERTYPE_ARP));
+  p.ldx(BPF_W, R4, R6, AT(arp.ea_hdr.ar_hrd));
+  p.pass_if(BPF_JNE, R4, word(arp_request));
+  p.ldx(BPF_W, R4, R6, AT(arp.ea_hdr.ar_hln));
+  p.pass_if(BPF_JNE, R4, word(arp_request + 4));
+  p.ldx(BPF_W, R4, R6, AT(arp.arp_spa));
+  p.pass_if(BPF_JEQ, R4, 0);
+  p.ldx(BPF_W, R5, R6, AT(arp.arp_tpa));
+  p.pass_if_reg(BPF_JEQ, R4, R5);
+
+  /* the target is known in our group, behind another interface */
+  p.stx(BPF_W, R10, -8, R5);
+  p.st(BPF_W, R10, -4, group);
+  p.mov(R2, R10);
+  p.addi(R2, -8);
+  p.ld_map(R1, hosts_map);
+  p.call(BPF_FUNC_map_lookup_elem);
+  p.pass_if_null(R0);
+  p.ldx(BPF_W, R1, R0, 0);
+  p.pass_if(BPF_JEQ, R1, ifindex);
+
+  /* turn the request into the reply, as arp_send_reply() does */
+  p.ldx(BPF_W, R1, R6, AT(arp.arp_sha));
+  p.ldx(BPF_H, R2, R6, AT(arp.arp_sha) + 4);
+  p.stx(BPF_W, R6, AT(ether_hdr.ether_dhost), R1);
+  p.stx(BPF_H, R6, AT(ether_hdr.ether_dhost) + 4, R2);
+  p.stx(BPF_W, R6, AT(arp.arp_tha), R1);
+  p.stx(BPF_H, R6, AT(arp.arp_tha) + 4, R2);
+  p.st(BPF_W, R6, AT(ether_hdr.ether_shost), word(hwaddr));
+  p.st(BPF_H, R6, AT(ether_hdr.ether_shost) + 4, half(hwaddr + 4));
+  p.st(BPF_W, R6, AT(arp.arp_sha), word(hwaddr));
+  p.st(BPF_H, R6, AT(arp.arp_sha) + 4, half(hwaddr + 4));
+  p.ldx(BPF_W, R1, R6, AT(arp.arp_spa));
+  p.ldx(BPF_W, R2, R6, AT(arp.arp_tpa));
+  p.stx(BPF_W, R6, AT(arp.arp_spa), R2);
+  p.stx(BPF_W, R6, AT(arp.arp_tpa), R1);
+  p.st(BPF_H, R6, AT(arp.ea_hdr.ar_op), htons(ARPOP_REPLY));
+
+  /* count it */
+  p.st(BPF_W, R10, -12, 0);
+  p.mov(R2, R10);
+  p.addi(R2, -12);
+  p.ld_map(R1, replies_map);
+  p.call(BPF_FUNC_map_lookup_elem);
+  p.add(BPF_JMP | BPF_JEQ | BPF_K, R0, 0, 2, 0);
+  p.movi(R1, 1);
+  p.add(BPF_STX | BPF_DW | BPF_ATOMIC, R0, R1, 0, BPF_ADD);
+  p.exit(XDP_TX);
+
+  p.exit_pass();
+
+  union bpf_attr attr {};
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = ptr(p.insns.data());
+  attr.insn_cnt = static_cast<uint32_t>(p.insns.size());
+  attr.license = ptr("GPL");
+  snprintf(attr.prog_name, sizeof(attr.prog_name), "parprouted_arp");
+  int prog = static_cast<int>(sys_bpf(BPF_PROG_LOAD, attr));
+  if (prog < 0) {
+    /* again, for the verifier to tell why */
+    std::vector<char> log(65536);
+    int err = errno;
+    attr.log_level = 1;
+    attr.log_buf = ptr(log.data());
+    attr.log_size = static_cast<uint32_t>(log.size());
+    sys_bpf(BPF_PROG_LOAD, attr);
+    syslog(LOG_ERR, "error: XDP program: %s", strerror(err));
+    LOG(LOG_DEBUG, "verifier: %s", log.data());
+  }
+  return prog;
+}
+
+void xdp_attach(const iface *it) {
+  /* VLANs are received on their trunk; requests that the scope or rate
+   * limit of the interface must see go up to arp_thread() */
+  if (it->vlan.trunk != 0 || !it->scope.empty() || it->limit.rate > 0) {
+    xdp_detach(it->name);
+    return;
+  }
+
+  std::lock_guard lock(links_mutex);
+  auto pos = links.find(it->name);
+  if (pos != links.end() && pos->second.group == it->group) {
+    return;
+  }
+
+  unsigned char hwaddr[ETH_ALEN];
+  struct ifreq ifr {};
+  int ifindex;
+  int sock;
+  snprintf(ifr.ifr_name, IFNAMSIZ, "%s", it->name);
+  if ((sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+      ioctl(sock, SIOCGIFHWADDR, &ifr) < 0) {
+    syslog(LOG_ERR, "error: XDP on %s: %s", it->name, strerror(errno));
+    if (sock >= 0) {
+      close(sock);
+    }
+    return;
+  }
+  close(sock);
+  memcpy(hwaddr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+  if ((ifindex = static_cast<int>(if_nametoindex(it->name))) == 0) {
+    return; /* gone already */
+  }
+
+  int prog = xdp_load(ifindex, it->group, hwaddr);
+  if (prog < 0) {
+    return;
+  }
+
+  /* a responder of ours or of the previous instance gets the new program,
+   * the interface is never without one */
+  int link = pos != links.end() ? pos->second.fd : handover_take(HANDOVER_XDP, it->name);
+  union bpf_attr attr {};
+  if (link >= 0) {
+    attr.link_update.link_fd = static_cast<uint32_t>(link);
+    attr.link_update.new_prog_fd = static_cast<uint32_t>(prog);
+    if (sys_bpf(BPF_LINK_UPDATE, attr) < 0) {
+      syslog(LOG_ERR, "error: XDP update on %s: %s", it->name, strerror(errno));
+    }
+  } else {
+    attr.link_create.prog_fd = static_cast<uint32_t>(prog);
+    attr.link_create.target_ifindex = static_cast<uint32_t>(ifindex);
+    attr.link_create.attach_type = BPF_XDP;
+    if ((link = static_cast<int>(sys_bpf(BPF_LINK_CREATE, attr))) < 0) {
+      /* e.g. another XDP program is there; we answer in userspace */
+      syslog(LOG_ERR, "error: XDP on %s: %s", it->name, strerror(errno));
+      close(prog);
+      return;
+    }
+  }
+  close(prog);
+
+  if (pos == links.end()) {
+    handover_register(HANDOVER_XDP, it->name, link);
+  }
+  links[it->name] = {link, it->group};
+  syslog(LOG_INFO, "Answering requests for known hosts on %s in the kernel.", it->name);
+}
+
+void xdp_detach(const char *ifname) {
+  std::lock_guard lock(links_mutex);
+  /* one of the previous instance, not taken over */
+  int inherited = handover_take(HANDOVER_XDP, ifname);
+  if (inherited >= 0) {
+    close(inherited);
+  }
+  auto pos = links.find(ifname);
+  if (pos == links.end()) {
+    return;
+  }
+  /* the program goes with the last reference to its link */
+  handover_unregister(pos->second.fd);
+  close(pos->second.fd);
+  links.erase(pos);
+}
+
+void xdp_sync(const arptab_entry *arptab) {
+  std::unordered_map<uint64_t, uint32_t> wanted;
+  std::map<std::string, uint32_t> ifindexes;
+
+  if (hosts_map < 0) {
+    return;
+  }
+
+  /* the hosts the kernel has a route for, as its proxy ARP would answer */
+  wanted.reserve(synced.size());
+  for (const arptab_entry *cur = arptab; cur != NULL; cur = cur->next) {
+    if (cur->incomplete || !cur->route_added) {
+      continue;
+    }
+    auto [pos, added] = ifindexes.try_emplace(cur->ifname, 0);
+    if (added) {
+      pos->second = if_nametoindex(cur->ifname);
+    }
+    if (pos->second != 0) {
+      xdp_host_key key{cur->ipaddr_ia.s_addr, static_cast<uint32_t>(cur->group)};
+      wanted[key_id(key)] = pos->second;
+    }
+  }
+
+  for (auto pos = synced.begin(); pos != synced.end();) {
+    auto want = wanted.find(pos->first);
+    if (want != wanted.end() && want->second == pos->second) {
+      ++pos;
+      continue;
+    }
+    xdp_host_key key{static_cast<uint32_t>(pos->first >> 32),
+                     static_cast<uint32_t>(pos->first)};
+    if (want == wanted.end()) {
+      map_op(BPF_MAP_DELETE_ELEM, hosts_map, &key, NULL);
+      pos = synced.erase(pos);
+    } else if (map_op(BPF_MAP_UPDATE_ELEM, hosts_map, &key, &want->second) == 0) {
+      pos->second = want->second;
+      ++pos;
+    } else {
+      map_op(BPF_MAP_DELETE_ELEM, hosts_map, &key, NULL);
+      pos = synced.erase(pos);
+    }
+  }
+
+  /* hosts over XDP_MAX_HOSTS stay with arp_thread() */
+  for (const auto &[id, ifindex] : wanted) {
+    if (synced.count(id) == 0) {
+      xdp_host_key key{static_cast<uint32_t>(id >> 32), static_cast<uint32_t>(id)};
+      if (map_op(BPF_MAP_UPDATE_ELEM, hosts_map, &key, &ifindex) == 0) {
+        synced[id] = ifindex;
+      }
+    }
+  }
+}
+
+unsigned long xdp_replies() {
+  uint32_t key = 0;
+  uint64_t replies = 0;
+
+  if (replies_map >= 0) {
+    map_op(BPF_MAP_LOOKUP_ELEM, replies_map, &key, &replies);
+  }
+  return replies;
+}
@@ -0,0 +1,48 @@
+/*
+ * This application is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+#pragma once
+
+#include "parprouted.h"
+
+#define XDP_MAX_HOSTS 65536 /* entries of the host map, hosts over it are answered in userspace */
+
+/* Key of the host map: a known host and its bridge group */
+struct xdp_host_key {
+  uint32_t ipaddr; /* network order */
+  uint32_t group;
+};
+
+/* Create the maps, or take them over from the previous instance; false if
+ * the kernel does not let us. Called once, before any interface is attached. */
+extern bool xdp_open();
+
+/* The responder program of an interface: answers requests for hosts of
+ * group known behind another interface than ifindex with hwaddr, passes
+ * everything else up. A program fd, -1 on error. */
+extern int xdp_load(int ifindex, int group, const unsigned char *hwaddr);
+
+/* Attach the responder to an interface, or detach it if the scope or rate
+ * limit of the interface must see its requests. Caller holds ifaces_lock. */
+extern void xdp_attach(const iface *it);
+extern void xdp_detach(const char *ifname);
+
+/* Make the host map what arptab says; under arptab_mutex */
+extern void xdp_sync(const arptab_entry *arptab);
+
+/* Requests answered by the responders so far */
+extern unsigned long xdp_replies();